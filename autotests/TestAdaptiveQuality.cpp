@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include "adaptivequality_p.h"
+
+using Load = AdaptiveQualityController::Load;
+
+static const Load idle{.pendingFrames = 0, .maxPendingFrames = 100, .droppedFrames = 0, .encoderLoad = 20};
+
+class TestAdaptiveQuality : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testStartsAtMaximum()
+    {
+        AdaptiveQualityController controller;
+        QVERIFY(!controller.quality());
+        QCOMPARE(controller.update(idle, 40, 80), quint8(80));
+        QCOMPARE(controller.adjustments(), quint64(0));
+    }
+
+    void testStepsDownWhenOverloaded()
+    {
+        AdaptiveQualityController controller;
+        controller.update(idle, 40, 80);
+
+        // A busy encoder
+        QCOMPARE(controller.update({.pendingFrames = 0, .maxPendingFrames = 100, .droppedFrames = 0, .encoderLoad = 95}, 40, 80), quint8(70));
+        // Waits an interval for the step to show
+        QCOMPARE(controller.update({.pendingFrames = 0, .maxPendingFrames = 100, .droppedFrames = 0, .encoderLoad = 95}, 40, 80), quint8(70));
+        // Queues filling up
+        QCOMPARE(controller.update({.pendingFrames = 60, .maxPendingFrames = 100, .droppedFrames = 0, .encoderLoad = 50}, 40, 80), quint8(60));
+        controller.update(idle, 40, 80);
+        // Frames dropped since the last update, the count is a total
+        QCOMPARE(controller.update({.pendingFrames = 0, .maxPendingFrames = 100, .droppedFrames = 5, .encoderLoad = 50}, 40, 80), quint8(50));
+        controller.update(idle, 40, 80);
+        QCOMPARE(controller.update({.pendingFrames = 0, .maxPendingFrames = 100, .droppedFrames = 5, .encoderLoad = 50}, 40, 80), quint8(50));
+
+        QCOMPARE(controller.adjustments(), quint64(3));
+    }
+
+    void testStaysWithinBounds()
+    {
+        AdaptiveQualityController controller;
+        const Load overloaded{.pendingFrames = 100, .maxPendingFrames = 100, .droppedFrames = 0, .encoderLoad = 100};
+        for (int i = 0; i < 20; ++i) {
+            QVERIFY(controller.update(overloaded, 40, 80) >= 40);
+        }
+        QCOMPARE(*controller.quality(), quint8(40));
+
+        // Moves into new bounds right away
+        QCOMPARE(controller.update(overloaded, 50, 80), quint8(50));
+        QCOMPARE(controller.update(idle, 20, 30), quint8(30));
+    }
+
+    void testRecoversSlowly()
+    {
+        AdaptiveQualityController controller;
+        controller.update(idle, 40, 80);
+        controller.update({.pendingFrames = 0, .maxPendingFrames = 100, .droppedFrames = 0, .encoderLoad = 95}, 40, 80);
+        QCOMPARE(*controller.quality(), quint8(70));
+
+        // The cooldown, then recovery intervals before stepping up
+        controller.update(idle, 40, 80);
+        for (int i = 0; i < AdaptiveQualityController::RecoveryIntervals - 1; ++i) {
+            QCOMPARE(controller.update(idle, 40, 80), quint8(70));
+        }
+        QCOMPARE(controller.update(idle, 40, 80), quint8(70 + AdaptiveQualityController::StepUp));
+
+        // A moderately loaded interval restarts the count
+        for (int i = 0; i < AdaptiveQualityController::RecoveryIntervals - 1; ++i) {
+            controller.update(idle, 40, 80);
+        }
+        controller.update({.pendingFrames = 0, .maxPendingFrames = 100, .droppedFrames = 0, .encoderLoad = 75}, 40, 80);
+        QCOMPARE(controller.update(idle, 40, 80), quint8(70 + AdaptiveQualityController::StepUp));
+
+        controller.reset();
+        QVERIFY(!controller.quality());
+        QCOMPARE(controller.update(idle, 40, 80), quint8(80));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestAdaptiveQuality)
+
+#include "TestAdaptiveQuality.moc"
@@ -40,6 +40,17 @@ public:
     QList<std::pair<int64_t, int64_t>> packets;
 };
 
+class CountingOpusEncoder : public LibOpusEncoder
+{
+public:
+    using LibOpusEncoder::LibOpusEncoder;
+
+    int bufferAllocations() const
+    {
+        return m_framePool.allocations();
+    }
+};
+
 class TestAudioEncoder : public QObject
 {
     Q_OBJECT
@@ -171,6 +182,58 @@ private Q_SLOTS:
         QVERIFY(qAbs(totalDuration - pts) <= frameSize);
     }
 
+    // Once the pipeline has warmed up, frames should come from the encoder's
+    // pool instead of allocating new buffers for each of them.
+    void testSteadyStateAllocations()
+    {
+        if (!avcodec_find_encoder_by_name("libopus")) {
+            QSKIP("Skipping because the encoder was not found");
+        }
+
+        TestProduce produce;
+        CountingOpusEncoder encoder(&produce);
+        QVERIFY(encoder.initialize(1, false));
+
+        constexpr int sampleCount = 480;
+        int64_t pts = 0;
+        auto pushFrames = [&](int count) {
+            for (int i = 0; i < count; ++i) {
+                auto frame = encoder.inputFrame(sampleCount, 2, 48000);
+                QVERIFY(frame);
+                std::fill_n(reinterpret_cast<float *>(frame->data[0]), sampleCount * 2, 0.5f);
+                frame->pts = pts;
+                pts += sampleCount;
+                QVERIFY(encoder.filterFrame(0, frame));
+                av_frame_unref(frame);
+
+                encoder.encodeFrame(std::numeric_limits<int>::max());
+                encoder.receivePacket();
+            }
+        };
+
+        pushFrames(50);
+        const int warmedUp = encoder.bufferAllocations();
+        QVERIFY(warmedUp > 0);
+
+        pushFrames(500);
+        QCOMPARE(encoder.bufferAllocations(), warmedUp);
+
+        // Silence shares a single buffer and never touches the pool
+        for (int i = 0; i < 10; ++i) {
+            auto frame = encoder.silenceFrame(48000, 2, 48000);
+            QVERIFY(frame);
+            frame->pts = pts;
+            pts += 48000;
+            QVERIFY(encoder.filterFrame(0, frame));
+            av_frame_unref(frame);
+            encoder.encodeFrame(std::numeric_limits<int>::max());
+            encoder.receivePacket();
+        }
+        QCOMPARE(encoder.bufferAllocations(), warmedUp);
+
+        QVERIFY(!produce.packets.isEmpty());
+    }
+
 private:
     std::unique_ptr<TestProduce> m_produce;
 };
@@ -0,0 +1,358 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QPainter>
+#include <QtTest>
+
+#include <array>
+
+#include <epoxy/egl.h>
+#include <epoxy/gl.h>
+#include <unistd.h>
+
+#include "dmabufhandler.h"
+
+using namespace Qt::StringLiterals;
+
+// Runs on Mesa's software rasterizer through a surfaceless EGL display, no GPU
+// or session needed. Textures are exported as DMA-BUFs to play the frames a
+// compositor would send.
+class TestDmaBufHandler : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+        // DmaBufHandler picks the same display when it has no session to go by
+        qputenv("LIBGL_ALWAYS_SOFTWARE", "1");
+        qunsetenv("WAYLAND_DISPLAY");
+
+        if (!epoxy_has_egl_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+            QSKIP("No surfaceless EGL platform");
+        }
+        m_display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr)) {
+            QSKIP("Cannot initialize a surfaceless EGL display");
+        }
+        if (!epoxy_has_egl_extension(m_display, "EGL_MESA_image_dma_buf_export") || !epoxy_has_egl_extension(m_display, "EGL_EXT_image_dma_buf_import")) {
+            QSKIP("The EGL driver cannot share DMA-BUFs, llvmpipe needs Mesa 23.1 and udmabuf");
+        }
+
+        QVERIFY(eglBindAPI(EGL_OPENGL_API));
+        m_context = eglCreateContext(m_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, nullptr);
+        QVERIFY(m_context != EGL_NO_CONTEXT);
+    }
+
+    void cleanupTestCase()
+    {
+        if (m_context != EGL_NO_CONTEXT) {
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(m_display, m_context);
+        }
+    }
+
+    void testPartialDownload()
+    {
+        const QSize size(150, 100);
+        QImage content(size, QImage::Format_RGBA8888_Premultiplied);
+        content.fill(Qt::red);
+
+        QVERIFY(makeCurrent());
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.width(), size.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, content.constBits());
+        auto deleteTexture = qScopeGuard([&] {
+            makeCurrent();
+            glDeleteTextures(1, &texture);
+        });
+
+        PipeWireFrame frame;
+        QVERIFY(exportTexture(texture, size, frame));
+        auto closeFd = qScopeGuard([&] {
+            close(frame.dmabuf->planes[0].fd);
+        });
+
+        DmaBufHandler handler;
+        QImage image(size, QImage::Format_RGBA8888_Premultiplied);
+        image.fill(Qt::black);
+        QVERIFY(handler.downloadFrame(image, frame));
+        QCOMPARE(image, content);
+
+        // Change two areas of the frame, but report only one of them as damaged
+        const QRect damaged(10, 20, 30, 7);
+        const QRect undamaged(120, 80, 16, 16);
+        QVERIFY(makeCurrent());
+        for (const QRect &rect : {damaged, undamaged}) {
+            QImage blue(rect.size(), QImage::Format_RGBA8888_Premultiplied);
+            blue.fill(Qt::blue);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x(), rect.y(), rect.width(), rect.height(), GL_RGBA, GL_UNSIGNED_BYTE, blue.constBits());
+        }
+        glFinish();
+
+        QVERIFY(handler.downloadFrame(image, frame, damaged));
+        QPainter(&content).fillRect(damaged, Qt::blue);
+        // Only what was damaged is read back, the rest is left as it was
+        QCOMPARE(image, content);
+
+        // An empty damage does not touch the image at all
+        QVERIFY(handler.downloadFrame(image, frame, QRegion()));
+        QCOMPARE(image, content);
+
+        QVERIFY(handler.downloadFrame(image, frame));
+        QPainter(&content).fillRect(undamaged, Qt::blue);
+        QCOMPARE(image, content);
+    }
+
+    void testQueuedDownload()
+    {
+        const QSize size(150, 100);
+        QImage content(size, QImage::Format_RGBA8888_Premultiplied);
+        content.fill(Qt::red);
+
+        QVERIFY(makeCurrent());
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.width(), size.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, content.constBits());
+        auto deleteTexture = qScopeGuard([&] {
+            makeCurrent();
+            glDeleteTextures(1, &texture);
+        });
+
+        PipeWireFrame frame;
+        QVERIFY(exportTexture(texture, size, frame));
+        auto closeFd = qScopeGuard([&] {
+            close(frame.dmabuf->planes[0].fd);
+        });
+
+        // Fill the ring, changing the frame after every download was queued
+        DmaBufHandler handler;
+        const QRect damaged(40, 30, 20, 50);
+        QList<QImage> expected;
+        for (int i = 0; i < DmaBufHandler::DownloadRingSize; ++i) {
+            QVERIFY(handler.queueDownload(frame, i == 0 ? QRegion(content.rect()) : QRegion(damaged)));
+            expected.append(content.copy());
+
+            const QColor color = QColor::fromHsv(i * 100, 255, 255);
+            QVERIFY(makeCurrent());
+            QImage fill(damaged.size(), QImage::Format_RGBA8888_Premultiplied);
+            fill.fill(color);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, damaged.x(), damaged.y(), damaged.width(), damaged.height(), GL_RGBA, GL_UNSIGNED_BYTE, fill.constBits());
+            QPainter(&content).fillRect(damaged, color);
+        }
+        QCOMPARE(handler.queuedDownloads(), DmaBufHandler::DownloadRingSize);
+
+        // Every download shows the frame as it was when it was queued
+        QImage image(size, QImage::Format_RGBA8888_Premultiplied);
+        image.fill(Qt::black);
+        for (const QImage &frameContent : std::as_const(expected)) {
+            QTRY_VERIFY(handler.isDownloadReady());
+            QVERIFY(handler.takeDownload(image));
+            QCOMPARE(image, frameContent);
+        }
+        QCOMPARE(handler.queuedDownloads(), 0);
+
+        // A download can be dropped and the ring used again
+        QVERIFY(handler.queueDownload(frame, content.rect()));
+        QImage none;
+        QVERIFY(handler.takeDownload(none));
+        QVERIFY(handler.queueDownload(frame, content.rect()));
+        QVERIFY(handler.takeDownload(image));
+        QCOMPARE(image, content);
+    }
+
+    void testReusedFileDescriptor()
+    {
+        const QSize size(64, 32);
+        QVERIFY(makeCurrent());
+        std::array<GLuint, 2> textures = {};
+        glGenTextures(textures.size(), textures.data());
+        auto deleteTextures = qScopeGuard([&] {
+            makeCurrent();
+            glDeleteTextures(textures.size(), textures.data());
+        });
+        std::array<QImage, 2> contents;
+        for (int i = 0; i < 2; ++i) {
+            contents[i] = QImage(size, QImage::Format_RGBA8888_Premultiplied);
+            contents[i].fill(i == 0 ? Qt::red : Qt::green);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.width(), size.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, contents[i].constBits());
+        }
+
+        // Buffers are imported once and read again from then on
+        DmaBufHandler handler;
+        QImage image(size, QImage::Format_RGBA8888_Premultiplied);
+        PipeWireFrame frame;
+        QVERIFY(exportTexture(textures[0], size, frame));
+        const int fd = frame.dmabuf->planes[0].fd;
+        for (int i = 0; i < 2; ++i) {
+            image.fill(Qt::black);
+            QVERIFY(handler.downloadFrame(image, frame));
+            QCOMPARE(image, contents[0]);
+        }
+
+        // A buffer that is gone can leave its file descriptor to a new one
+        close(fd);
+        QVERIFY(exportTexture(textures[1], size, frame));
+        auto closeFd = qScopeGuard([&] {
+            close(frame.dmabuf->planes[0].fd);
+        });
+        if (frame.dmabuf->planes[0].fd != fd) {
+            QEXPECT_FAIL("", "The file descriptor was not reused", Continue);
+        }
+        QCOMPARE(frame.dmabuf->planes[0].fd, fd);
+        QVERIFY(handler.downloadFrame(image, frame));
+        QCOMPARE(image, contents[1]);
+    }
+
+    void testConvertedDownload_data()
+    {
+        QTest::addColumn<DmaBufHandler::DownloadFormat>("format");
+
+        QTest::newRow("limited") << DmaBufHandler::DownloadFormat::YUV420PLimited;
+        QTest::newRow("full") << DmaBufHandler::DownloadFormat::YUV420PFull;
+    }
+
+    void testConvertedDownload()
+    {
+        QFETCH(DmaBufHandler::DownloadFormat, format);
+
+        // Odd sizes leave chroma samples that cover a single column or row
+        const QSize size(151, 101);
+        QImage content(size, QImage::Format_RGBA8888_Premultiplied);
+        content.fill(Qt::black);
+        QPainter painter(&content);
+        painter.fillRect(0, 0, 75, 101, QColor(200, 30, 90));
+        painter.fillRect(75, 0, 76, 50, QColor(10, 250, 130));
+        painter.end();
+
+        QVERIFY(makeCurrent());
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.width(), size.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, content.constBits());
+        auto deleteTexture = qScopeGuard([&] {
+            makeCurrent();
+            glDeleteTextures(1, &texture);
+        });
+
+        PipeWireFrame frame;
+        QVERIFY(exportTexture(texture, size, frame));
+        auto closeFd = qScopeGuard([&] {
+            close(frame.dmabuf->planes[0].fd);
+        });
+
+        DmaBufHandler handler;
+        if (!handler.supportsDownloadFormat(format)) {
+            QSKIP("The GL driver cannot convert frames");
+        }
+
+        const QSize chromaSize(76, 51);
+        const int strides[] = {size.width() + 9, chromaSize.width() + 3, chromaSize.width() + 3};
+        QByteArray y(strides[0] * size.height(), 0);
+        QByteArray u(strides[1] * chromaSize.height(), 0);
+        QByteArray v(strides[2] * chromaSize.height(), 0);
+        uchar *const planes[] = {reinterpret_cast<uchar *>(y.data()), reinterpret_cast<uchar *>(u.data()), reinterpret_cast<uchar *>(v.data())};
+
+        QVERIFY(handler.queueDownload(frame, content.rect(), format));
+        QVERIFY(handler.takeDownload(planes, strides));
+        compareYuv(content, format, planes, strides);
+
+        // Damage at odd coordinates is read back from the even ones before
+        const QRect damaged(31, 41, 20, 7);
+        QVERIFY(makeCurrent());
+        QImage fill(damaged.size(), QImage::Format_RGBA8888_Premultiplied);
+        fill.fill(Qt::white);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, damaged.x(), damaged.y(), damaged.width(), damaged.height(), GL_RGBA, GL_UNSIGNED_BYTE, fill.constBits());
+        QPainter(&content).fillRect(damaged, Qt::white);
+
+        QVERIFY(handler.queueDownload(frame, damaged, format));
+        QVERIFY(handler.takeDownload(planes, strides));
+        compareYuv(content, format, planes, strides);
+    }
+
+private:
+    // Compare to BT.601, allowing for rounding
+    static void compareYuv(const QImage &content, DmaBufHandler::DownloadFormat format, const uchar *const *planes, const int *strides)
+    {
+        const bool full = format == DmaBufHandler::DownloadFormat::YUV420PFull;
+        const auto luma = [full](QRgb color) {
+            const double y = (0.299 * qRed(color) + 0.587 * qGreen(color) + 0.114 * qBlue(color)) / 255;
+            return full ? 255 * y : 16 + 219 * y;
+        };
+        const auto chroma = [full](double difference, double scale) {
+            return 128 + (full ? 255 : 224) * difference / scale / 255;
+        };
+
+        for (int y = 0; y < content.height(); ++y) {
+            for (int x = 0; x < content.width(); ++x) {
+                QVERIFY2(qAbs(planes[0][y * strides[0] + x] - luma(content.pixel(x, y))) <= 1, qPrintable(u"Y at %1,%2"_s.arg(x).arg(y)));
+            }
+        }
+
+        for (int y = 0; y < (content.height() + 1) / 2; ++y) {
+            for (int x = 0; x < (content.width() + 1) / 2; ++x) {
+                // The average of the pixels a chroma sample covers, the last row and column are repeated
+                double red = 0;
+                double green = 0;
+                double blue = 0;
+                for (const QPoint &offset : {QPoint(0, 0), QPoint(1, 0), QPoint(0, 1), QPoint(1, 1)}) {
+                    const QRgb color = content.pixel(std::min(2 * x + offset.x(), content.width() - 1), std::min(2 * y + offset.y(), content.height() - 1));
+                    red += qRed(color) / 4.0;
+                    green += qGreen(color) / 4.0;
+                    blue += qBlue(color) / 4.0;
+                }
+                const double luma = 0.299 * red + 0.587 * green + 0.114 * blue;
+                QVERIFY2(qAbs(planes[1][y * strides[1] + x] - chroma(blue - luma, 1.772)) <= 1, qPrintable(u"U at %1,%2"_s.arg(x).arg(y)));
+                QVERIFY2(qAbs(planes[2][y * strides[2] + x] - chroma(red - luma, 1.402)) <= 1, qPrintable(u"V at %1,%2"_s.arg(x).arg(y)));
+            }
+        }
+    }
+
+    bool makeCurrent()
+    {
+        return eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context);
+    }
+
+    bool exportTexture(GLuint texture, const QSize &size, PipeWireFrame &frame)
+    {
+        const EGLImage image = eglCreateImage(m_display, m_context, EGL_GL_TEXTURE_2D, reinterpret_cast<EGLClientBuffer>(quintptr(texture)), nullptr);
+        if (image == EGL_NO_IMAGE) {
+            return false;
+        }
+        auto destroyImage = qScopeGuard([&] {
+            eglDestroyImage(m_display, image);
+        });
+
+        int fourcc = 0;
+        int planes = 0;
+        EGLuint64KHR modifier = 0;
+        if (!eglExportDMABUFImageQueryMESA(m_display, image, &fourcc, &planes, &modifier) || planes != 1) {
+            return false;
+        }
+        int fd = -1;
+        EGLint stride = 0;
+        EGLint offset = 0;
+        if (!eglExportDMABUFImageMESA(m_display, image, &fd, &stride, &offset)) {
+            return false;
+        }
+
+        frame.format = SPA_VIDEO_FORMAT_RGBA;
+        frame.dmabuf = DmaBufAttributes{
+            .width = size.width(),
+            .height = size.height(),
+            .format = uint32_t(fourcc),
+            .modifier = modifier,
+            .planes = {DmaBufPlane{fd, uint32_t(offset), uint32_t(stride)}},
+        };
+        return true;
+    }
+
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLContext m_context = EGL_NO_CONTEXT;
+};
+
+QTEST_GUILESS_MAIN(TestDmaBufHandler)
+
+#include "TestDmaBufHandler.moc"
@@ -3,12 +3,14 @@
 
 #include <QtTest>
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 #include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavfilter/buffersrc.h>
 }
 
 #include "encoder_p.h"
@@ -33,10 +35,14 @@ public:
     {
     }
 
-    void processPacket([[maybe_unused]] AVPacket *packet) override
+    void processPacket(AVPacket *packet) override
     {
+        m_keyPackets.push_back(packet->flags & AV_PKT_FLAG_KEY);
     }
 
+    // Whether each packet received so far was a key frame
+    std::vector<bool> m_keyPackets;
+
     // Expose the resize state reset and let the test drive the members it
     // clears. In production these are set up by initialize(), which needs a live
     // PipeWire stream we don't have here, so prime them by hand.
@@ -60,6 +66,30 @@ public:
     }
 };
 
+// Has nothing to encode, so the worker threads go straight back to waiting
+class IdleEncoder : public Encoder
+{
+public:
+    using Encoder::Encoder;
+
+    bool initialize(const QSize &) override
+    {
+        return true;
+    }
+    bool filterFrame(const PipeWireFrame &) override
+    {
+        return false;
+    }
+    std::pair<int, int> encodeFrame(int) override
+    {
+        return {0, 0};
+    }
+    int receivePacket() override
+    {
+        return 0;
+    }
+};
+
 // This is a pretty simple smoke test that verifies all the encoders can
 // initialize properly. This verifies that things like filter chains are correct.
 class TestEncoder : public QObject
@@ -185,7 +215,170 @@ private Q_SLOTS:
         QVERIFY(m_produce->frameStateCleared());
     }
 
+    // Stopping the worker threads right as they start over must not leave one
+    // of them waiting for a wakeup that already happened, which hangs the join.
+    void testStartStopThreads()
+    {
+        m_produce->m_encoder = std::make_unique<IdleEncoder>(m_produce.get());
+        for (int i = 0; i < 2000; ++i) {
+            m_produce->startThreads();
+            m_produce->stopThreads();
+        }
+        m_produce->m_encoder.reset();
+    }
+
+    // A key frame requested mid-stream must be the next frame out of the encoder,
+    // on top of the one every stream starts with.
+    void testRequestKeyFrame_data()
+    {
+        QTest::addColumn<std::shared_ptr<Encoder>>("encoder");
+        QTest::addColumn<QByteArray>("avcodecEncoder");
+
+        QTest::addRow("x264") << std::shared_ptr<Encoder>(new LibX264Encoder(Encoder::H264Profile::Main, m_produce.get())) << "libx264"_ba;
+        QTest::addRow("openh264") << std::shared_ptr<Encoder>(new LibOpenH264Encoder(Encoder::H264Profile::Main, m_produce.get())) << "libopenh264"_ba;
+        QTest::addRow("vp8") << std::shared_ptr<Encoder>(new LibVpxEncoder(m_produce.get())) << "libvpx"_ba;
+        QTest::addRow("vp9") << std::shared_ptr<Encoder>(new LibVpxVp9Encoder(m_produce.get())) << "libvpx-vp9"_ba;
+    }
+
+    void testRequestKeyFrame()
+    {
+        QFETCH(std::shared_ptr<Encoder>, encoder);
+        QFETCH(QByteArray, avcodecEncoder);
+
+        if (!avcodec_find_encoder_by_name(avcodecEncoder.data())) {
+            QSKIP("Skipping because the encoder was not found");
+        }
+
+        constexpr int frameCount = 30;
+        constexpr int keyFrame = 12;
+        const QSize size(128, 128);
+
+        m_produce->m_keyPackets.clear();
+        m_produce->m_keyFrameRequested = false;
+        QVERIFY(encoder->initialize(size));
+
+        auto frame = av_frame_alloc();
+        QVERIFY(frame);
+        for (int i = 0; i < frameCount; ++i) {
+            if (i == keyFrame) {
+                m_produce->requestKeyFrame();
+            }
+
+            // Without a source stream the filter graph takes RGBA
+            frame->format = AV_PIX_FMT_RGBA;
+            frame->width = size.width();
+            frame->height = size.height();
+            frame->pts = av_rescale_q(i, AVRational{1, 25}, FrameTimeBase);
+            QCOMPARE(av_frame_get_buffer(frame, 0), 0);
+            std::fill_n(frame->data[0], frame->linesize[0] * frame->height, 0x80);
+            QCOMPARE(av_buffersrc_add_frame(FilterAccess::inputFilter(encoder.get()), frame), 0);
+            av_frame_unref(frame);
+
+            encoder->encodeFrame(frameCount);
+            encoder->receivePacket();
+        }
+        av_frame_free(&frame);
+
+        QVERIFY(!m_produce->m_keyFrameRequested);
+        encoder->finish();
+        encoder->receivePacket();
+
+        // Static content, so nothing but the request makes the encoders start a new group of pictures
+        QVERIFY(m_produce->m_keyPackets.size() > std::size_t(keyFrame));
+        QVERIFY(m_produce->m_keyPackets.front());
+        QCOMPARE(std::count(m_produce->m_keyPackets.cbegin(), m_produce->m_keyPackets.cend(), true), 2);
+    }
+
+    // Every encoder must open with bitrate based rate control, constant and
+    // variable, and change it while encoding when it says it can.
+    void testRateControl_data()
+    {
+        QTest::addColumn<std::shared_ptr<Encoder>>("encoder");
+        QTest::addColumn<QByteArray>("avcodecEncoder");
+        QTest::addColumn<bool>("constant");
+        QTest::addColumn<bool>("runtime");
+
+        for (bool constant : {true, false}) {
+            const auto mode = constant ? "cbr" : "vbr";
+            QTest::addRow("x264_%s", mode) << std::shared_ptr<Encoder>(new LibX264Encoder(Encoder::H264Profile::Main, m_produce.get())) << "libx264"_ba
+                                           << constant << true;
+            QTest::addRow("openh264_%s", mode) << std::shared_ptr<Encoder>(new LibOpenH264Encoder(Encoder::H264Profile::Main, m_produce.get()))
+                                               << "libopenh264"_ba << constant << false;
+            QTest::addRow("vp8_%s", mode) << std::shared_ptr<Encoder>(new LibVpxEncoder(m_produce.get())) << "libvpx"_ba << constant << false;
+            QTest::addRow("vp9_%s", mode) << std::shared_ptr<Encoder>(new LibVpxVp9Encoder(m_produce.get())) << "libvpx-vp9"_ba << constant << false;
+            QTest::addRow("h264_vaapi_%s", mode) << std::shared_ptr<Encoder>(new H264VAAPIEncoder(Encoder::H264Profile::Main, m_produce.get()))
+                                                 << "h264_vaapi"_ba << constant << false;
+        }
+    }
+
+    void testRateControl()
+    {
+        QFETCH(std::shared_ptr<Encoder>, encoder);
+        QFETCH(QByteArray, avcodecEncoder);
+        QFETCH(bool, constant);
+        QFETCH(bool, runtime);
+
+        if (!avcodec_find_encoder_by_name(avcodecEncoder.data())) {
+            QSKIP("Skipping because the encoder was not found");
+        }
+
+        if (avcodecEncoder.contains("vaapi") && VaapiUtils::instance()->devicePath().isEmpty()) {
+            QSKIP("Skipping because hardware encoding is not supported on this device");
+        }
+
+        const qint64 target = 2'000'000;
+        encoder->setRateControl({.targetBitrate = target, .maxBitrate = constant ? target : target * 2, .bufferSize = std::nullopt});
+        QVERIFY(encoder->initialize(QSize(512, 512)));
+
+        auto context = encoder->avCodecContext();
+        QCOMPARE(qint64(context->bit_rate), target);
+        QCOMPARE(qint64(context->rc_max_rate), constant ? target : target * 2);
+        QCOMPARE(context->rc_buffer_size, int(context->rc_max_rate));
+
+        QCOMPARE(encoder->setRuntimeRateControl({.targetBitrate = target / 2, .maxBitrate = target / 2, .bufferSize = target}), runtime);
+        if (runtime) {
+            QCOMPARE(qint64(context->bit_rate), target / 2);
+            QCOMPARE(context->rc_buffer_size, int(target));
+        }
+        // Switching to quality based rate control needs a new encoder
+        QVERIFY(!encoder->setRuntimeRateControl({}));
+    }
+
+    // Simulcast layers fit the source into their maximum size
+    void testFitLayerSize_data()
+    {
+        QTest::addColumn<QSize>("source");
+        QTest::addColumn<QSize>("maxSize");
+        QTest::addColumn<QSize>("expected");
+
+        QTest::addRow("fits") << QSize(1280, 720) << QSize(1920, 1080) << QSize(1280, 720);
+        QTest::addRow("same") << QSize(1920, 1080) << QSize(1920, 1080) << QSize(1920, 1080);
+        QTest::addRow("half") << QSize(1920, 1080) << QSize(960, 540) << QSize(960, 540);
+        QTest::addRow("width_bound") << QSize(1920, 1080) << QSize(640, 1080) << QSize(640, 360);
+        QTest::addRow("height_bound") << QSize(1080, 1920) << QSize(1280, 640) << QSize(360, 640);
+        QTest::addRow("even") << QSize(1366, 768) << QSize(640, 640) << QSize(640, 358);
+        QTest::addRow("tiny") << QSize(1920, 4) << QSize(320, 320) << QSize(320, 2);
+        QTest::addRow("empty") << QSize() << QSize(320, 320) << QSize();
+    }
+
+    void testFitLayerSize()
+    {
+        QFETCH(QSize, source);
+        QFETCH(QSize, maxSize);
+        QFETCH(QSize, expected);
+
+        QCOMPARE(PipeWireProduce::fitLayerSize(source, maxSize), expected);
+    }
+
 private:
+    // Gives access to the filter graph input, to feed frames without a PipeWire stream
+    struct FilterAccess : Encoder {
+        static AVFilterContext *inputFilter(Encoder *encoder)
+        {
+            return encoder->*(&FilterAccess::m_inputFilter);
+        }
+    };
+
     std::unique_ptr<TestProduce> m_produce;
 };
 
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include "encodingstatistics_p.h"
+
+using namespace std::chrono_literals;
+
+class TestEncodingStatistics : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testCounts()
+    {
+        EncodingStatisticsCollector collector;
+        using DropReason = EncodingStatisticsCollector::DropReason;
+
+        for (int pts = 0; pts < 10; ++pts) {
+            collector.frameCaptured();
+        }
+        collector.frameDropped(DropReason::FramerateLimit);
+        collector.frameDropped(DropReason::FramerateLimit);
+        collector.frameDropped(DropReason::OutOfOrder);
+        collector.frameDropped(DropReason::FilterQueueFull);
+        collector.frameDropped(DropReason::FilterFailed);
+        collector.frameUnchanged();
+        collector.frameUnchanged();
+
+        for (int pts = 0; pts < 5; ++pts) {
+            collector.frameSubmitted(pts, std::nullopt);
+            collector.frameFiltered(pts, pts != 4);
+        }
+        for (int pts = 0; pts < 4; ++pts) {
+            collector.packetReceived(pts, 1000);
+        }
+
+        const auto statistics = collector.takeSnapshot(2, 3);
+        QCOMPARE(statistics.capturedFrames, quint64(10));
+        QCOMPARE(statistics.filteredFrames, quint64(5));
+        QCOMPARE(statistics.encodedFrames, quint64(4));
+        QCOMPARE(statistics.droppedFramerateLimit, quint64(2));
+        QCOMPARE(statistics.droppedOutOfOrder, quint64(1));
+        QCOMPARE(statistics.droppedFilterQueueFull, quint64(1));
+        QCOMPARE(statistics.droppedFilterFailed, quint64(1));
+        QCOMPARE(statistics.droppedEncodeQueueFull, quint64(1));
+        // Skipping an unchanged frame is not a drop
+        QCOMPARE(statistics.unchangedFrames, quint64(2));
+        QCOMPARE(statistics.droppedFrames(), quint64(6));
+        QCOMPARE(statistics.pendingFilterFrames, 2);
+        QCOMPARE(statistics.pendingEncodeFrames, 3);
+        QVERIFY(statistics.bitrate > 0);
+
+        // Counts are totals, the bitrate only covers the last interval
+        const auto next = collector.takeSnapshot(0, 0);
+        QCOMPARE(next.encodedFrames, quint64(4));
+        QCOMPARE(next.bitrate, qint64(0));
+    }
+
+    void testLatencies()
+    {
+        EncodingStatisticsCollector collector;
+
+        const auto captured = std::chrono::steady_clock::now().time_since_epoch();
+        collector.frameSubmitted(1, captured);
+        QTest::qSleep(5);
+        collector.frameFiltered(1, true);
+        QTest::qSleep(20);
+        collector.packetReceived(1, 100);
+
+        auto statistics = collector.takeSnapshot(0, 0);
+        QVERIFY(statistics.filterLatencyP50 >= 5000);
+        QVERIFY(statistics.encodeLatencyP50 >= 20000);
+        QVERIFY(statistics.totalLatencyP50 >= 25000);
+        QVERIFY(statistics.totalLatencyP99 >= statistics.encodeLatencyP99);
+
+        // Packets of frames that weren't followed don't count towards latencies
+        collector.packetReceived(2, 100);
+        statistics = collector.takeSnapshot(0, 0);
+        QCOMPARE(statistics.encodeLatencyP50, qint64(0));
+        QCOMPARE(statistics.encodedFrames, quint64(2));
+    }
+
+    // Only the time spent on a frame counts, not the time it waited in between
+    void testConversionTime()
+    {
+        EncodingStatisticsCollector collector;
+
+        collector.frameSubmitted(1, std::nullopt, 1ms);
+        QTest::qSleep(20);
+        collector.frameFiltered(1, true, 2ms);
+
+        auto statistics = collector.takeSnapshot(0, 0);
+        QVERIFY(statistics.filterLatencyP50 >= 20000);
+        QCOMPARE(statistics.conversionTimeP50, qint64(3250));
+
+        // Discarded frames were converted all the same
+        collector.frameSubmitted(2, std::nullopt);
+        collector.frameFiltered(2, false, 500us);
+        statistics = collector.takeSnapshot(0, 0);
+        QCOMPARE(statistics.conversionTimeP50, qint64(750));
+
+        statistics = collector.takeSnapshot(0, 0);
+        QCOMPARE(statistics.conversionTimeP50, qint64(0));
+    }
+
+    // Frames that never come out again must not pile up
+    void testDiscardPending()
+    {
+        EncodingStatisticsCollector collector;
+        for (int pts = 0; pts < 1000; ++pts) {
+            collector.frameSubmitted(pts, std::nullopt);
+        }
+        collector.frameFiltered(999, true);
+        collector.discardPending();
+        collector.packetReceived(999, 100);
+
+        const auto statistics = collector.takeSnapshot(0, 0);
+        QCOMPARE(statistics.filteredFrames, quint64(1));
+        QCOMPARE(statistics.encodeLatencyP50, qint64(0));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestEncodingStatistics)
+
+#include "TestEncodingStatistics.moc"
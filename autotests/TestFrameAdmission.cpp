@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include "frameadmission_p.h"
+
+using Decision = FrameAdmission::Decision;
+using Policy = FrameAdmission::Policy;
+
+class TestFrameAdmission : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testDropNewest()
+    {
+        FrameAdmission admission;
+        QCOMPARE(admission.policy(), Policy::DropNewest);
+        QCOMPARE(admission.admit(0, 10), Decision::Admit);
+        QCOMPARE(admission.admit(9, 10), Decision::Admit);
+        QCOMPARE(admission.admit(10, 10), Decision::Drop);
+        QCOMPARE(admission.admit(12, 10), Decision::Drop);
+    }
+
+    void testDropOldest()
+    {
+        FrameAdmission admission;
+        admission.setPolicy(Policy::DropOldest);
+        QCOMPARE(admission.admit(9, 10), Decision::Admit);
+        // Held until handleEncodedFramesChanged() finds room for it
+        QCOMPARE(admission.admit(10, 10), Decision::Hold);
+        QVERIFY(!FrameAdmission::hasRoom(10, 10));
+        QVERIFY(FrameAdmission::hasRoom(9, 10));
+    }
+
+    void testKeepEveryNth()
+    {
+        FrameAdmission admission;
+        admission.setPolicy(Policy::KeepEveryNth, 3);
+
+        // Everything gets in while the queues are less than half full
+        for (int i = 0; i < 5; ++i) {
+            QCOMPARE(admission.admit(4, 10), Decision::Admit);
+        }
+
+        // Then one in three frames
+        QList<Decision> decisions;
+        for (int i = 0; i < 6; ++i) {
+            decisions << admission.admit(6, 10);
+        }
+        QCOMPARE(decisions, (QList<Decision>{Decision::Drop, Decision::Drop, Decision::Admit, Decision::Drop, Decision::Drop, Decision::Admit}));
+
+        // Nothing fits once they are full
+        for (int i = 0; i < 5; ++i) {
+            QCOMPARE(admission.admit(10, 10), Decision::Drop);
+        }
+        // And the next frame with room is let in, as enough were skipped
+        QCOMPARE(admission.admit(9, 10), Decision::Admit);
+
+        // Back to everything once they drain
+        QCOMPARE(admission.admit(2, 10), Decision::Admit);
+        QCOMPARE(admission.admit(5, 10), Decision::Drop);
+    }
+
+    void testKeepInterval()
+    {
+        FrameAdmission admission;
+        // Keeping every frame is the same as dropping the newest ones
+        admission.setPolicy(Policy::KeepEveryNth, 0);
+        QCOMPARE(admission.admit(8, 10), Decision::Admit);
+        QCOMPARE(admission.admit(8, 10), Decision::Admit);
+        QCOMPARE(admission.admit(10, 10), Decision::Drop);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestFrameAdmission)
+
+#include "TestFrameAdmission.moc"
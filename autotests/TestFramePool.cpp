@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include <deque>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+}
+
+#include "framepool_p.h"
+
+class TestFramePool : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    // A steady stream of frames should only ever allocate as many buffers as
+    // there are frames in flight, like a filter graph holding on to a few.
+    void testSteadyStateVideo()
+    {
+        constexpr int inFlight = 3;
+
+        FramePool pool;
+        std::deque<AVFrame *> queue;
+
+        for (int i = 0; i < 1000; ++i) {
+            auto frame = av_frame_alloc();
+            QVERIFY(frame);
+            frame->format = AV_PIX_FMT_RGBA;
+            frame->width = 1920;
+            frame->height = 1080;
+            QVERIFY(pool.allocateVideo(frame));
+            QVERIFY(frame->data[0]);
+            QCOMPARE(frame->linesize[0], 1920 * 4);
+            queue.push_back(frame);
+
+            if (queue.size() > inFlight) {
+                av_frame_free(&queue.front());
+                queue.pop_front();
+            }
+        }
+
+        QCOMPARE(pool.allocations(), inFlight + 1);
+
+        for (auto frame : queue) {
+            av_frame_free(&frame);
+        }
+    }
+
+    void testSmallerFramesReuseBuffers()
+    {
+        FramePool pool;
+
+        auto frame = av_frame_alloc();
+        QVERIFY(frame);
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 1920;
+        frame->height = 1080;
+        QVERIFY(pool.allocateVideo(frame));
+        av_frame_unref(frame);
+
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 1280;
+        frame->height = 720;
+        QVERIFY(pool.allocateVideo(frame));
+        av_frame_unref(frame);
+
+        QCOMPARE(pool.allocations(), 1);
+
+        frame->format = AV_PIX_FMT_YUV420P;
+        frame->width = 3840;
+        frame->height = 2160;
+        QVERIFY(pool.allocateVideo(frame));
+        av_frame_unref(frame);
+
+        QCOMPARE(pool.allocations(), 2);
+
+        av_frame_free(&frame);
+    }
+
+    // Buffers still referenced when the pool goes away must stay valid.
+    void testOutlivesPool()
+    {
+        auto frame = av_frame_alloc();
+        QVERIFY(frame);
+        {
+            FramePool pool;
+            frame->format = AV_PIX_FMT_RGBA;
+            frame->width = 64;
+            frame->height = 64;
+            QVERIFY(pool.allocateVideo(frame));
+        }
+        std::fill_n(frame->data[0], frame->linesize[0] * frame->height, 0xff);
+        av_frame_free(&frame);
+    }
+
+    void testSteadyStateAudio()
+    {
+        static const AVChannelLayout stereoLayout = AV_CHANNEL_LAYOUT_STEREO;
+
+        FramePool pool;
+        auto frame = av_frame_alloc();
+        QVERIFY(frame);
+
+        for (int i = 0; i < 1000; ++i) {
+            frame->format = AV_SAMPLE_FMT_FLT;
+            frame->nb_samples = 256 + (i % 4) * 256;
+            av_channel_layout_copy(&frame->ch_layout, &stereoLayout);
+            QVERIFY(pool.allocateAudio(frame));
+            QCOMPARE(frame->extended_data[0], frame->data[0]);
+            av_frame_unref(frame);
+        }
+
+        // Grows to the biggest frame once, every request before it is smaller
+        QCOMPARE(pool.allocations(), 4);
+
+        frame->format = AV_SAMPLE_FMT_FLTP;
+        frame->nb_samples = 256;
+        av_channel_layout_copy(&frame->ch_layout, &stereoLayout);
+        QVERIFY(!pool.allocateAudio(frame));
+
+        av_frame_free(&frame);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestFramePool)
+
+#include "TestFramePool.moc"
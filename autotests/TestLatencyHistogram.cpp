@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include "latencyhistogram_p.h"
+
+using namespace std::chrono_literals;
+
+class TestLatencyHistogram : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testEmpty()
+    {
+        LatencyHistogram histogram;
+        QCOMPARE(histogram.count(), quint64(0));
+        QCOMPARE(histogram.percentile(0.5), 0us);
+    }
+
+    void testPercentiles()
+    {
+        LatencyHistogram histogram;
+        // 98 fast frames and two that got stuck behind something else
+        for (int i = 0; i < 98; ++i) {
+            histogram.record(100us);
+        }
+        histogram.record(3ms);
+        histogram.record(9ms + 100us);
+
+        QCOMPARE(histogram.count(), quint64(100));
+        QCOMPARE(histogram.percentile(0.5), LatencyHistogram::BucketWidth);
+        QCOMPARE(histogram.percentile(0.98), LatencyHistogram::BucketWidth);
+        QCOMPARE(histogram.percentile(0.99), 3ms + LatencyHistogram::BucketWidth);
+        QCOMPARE(histogram.percentile(1.0), 9ms + LatencyHistogram::BucketWidth);
+
+        histogram.reset();
+        QCOMPARE(histogram.count(), quint64(0));
+    }
+
+    void testOutOfRange()
+    {
+        LatencyHistogram histogram;
+        // Timestamps from a different clock can end up in the future
+        histogram.record(-5ms);
+        QCOMPARE(histogram.percentile(1.0), LatencyHistogram::BucketWidth);
+
+        histogram.record(10s);
+        QCOMPARE(histogram.percentile(1.0), LatencyHistogram::BucketWidth * (LatencyHistogram::BucketCount + 1));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestLatencyHistogram)
+
+#include "TestLatencyHistogram.moc"
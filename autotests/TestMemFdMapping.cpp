@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "pipewiresourcestream.h"
+#include "pwhelpers.h"
+
+// Feeds a fake MemFd backed buffer through PipeWireSourceStream::handleFrame(),
+// the same way PipeWire delivers frames, to measure the per-frame ingest cost.
+class TestMemFdMapping : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+        const QSize size(3840, 2160);
+        const uint32_t frameSize = size.width() * size.height() * 4;
+
+        m_fd = memfd_create("kpipewire-test-frame", MFD_CLOEXEC);
+        QVERIFY(m_fd >= 0);
+        QCOMPARE(ftruncate(m_fd, frameSize), 0);
+
+        m_chunk.offset = 0;
+        m_chunk.size = frameSize;
+        m_chunk.stride = size.width() * 4;
+        m_chunk.flags = SPA_CHUNK_FLAG_NONE;
+
+        m_data.type = SPA_DATA_MemFd;
+        m_data.fd = m_fd;
+        m_data.mapoffset = 0;
+        m_data.maxsize = frameSize;
+        m_data.chunk = &m_chunk;
+
+        m_spaBuffer.n_datas = 1;
+        m_spaBuffer.datas = &m_data;
+        m_buffer.buffer = &m_spaBuffer;
+    }
+
+    void cleanupTestCase()
+    {
+        PWHelpers::unmapBuffer(&m_buffer);
+        close(m_fd);
+    }
+
+    void testFramesShareMapping()
+    {
+        PipeWireSourceStream stream;
+        QList<std::shared_ptr<PipeWireFrameData>> frames;
+        connect(&stream, &PipeWireSourceStream::frameReceived, this, [&frames](const PipeWireFrame &frame) {
+            frames << frame.dataFrame;
+        });
+
+        PWHelpers::mapBuffer(&m_buffer);
+        stream.handleFrame(&m_buffer);
+        stream.handleFrame(&m_buffer);
+        QCOMPARE(frames.size(), 2);
+        QVERIFY(frames[0] && frames[1]);
+        QCOMPARE(frames[0]->data, frames[1]->data);
+        QCOMPARE(frames[0]->cleanup, frames[1]->cleanup);
+
+        // Frames outliving their buffer keep the mapping alive
+        PWHelpers::unmapBuffer(&m_buffer);
+        QVERIFY(!m_buffer.user_data);
+        QCOMPARE(static_cast<const uint8_t *>(frames[1]->data)[m_chunk.size - 1], uint8_t(0));
+    }
+
+    void benchmarkIngest_data()
+    {
+        QTest::addColumn<bool>("cached");
+
+        QTest::addRow("mmap per frame") << false;
+        QTest::addRow("cached mapping") << true;
+    }
+
+    void benchmarkIngest()
+    {
+        QFETCH(bool, cached);
+
+        PipeWireSourceStream stream;
+        quint64 sum = 0;
+        connect(&stream, &PipeWireSourceStream::frameReceived, this, [this, &sum](const PipeWireFrame &frame) {
+            // Touch every page like a consumer reading the frame would
+            const auto data = static_cast<const uint8_t *>(frame.dataFrame->data);
+            for (uint32_t i = 0; i < m_chunk.size; i += 4096) {
+                sum += data[i];
+            }
+        });
+
+        if (cached) {
+            PWHelpers::mapBuffer(&m_buffer);
+        }
+        QBENCHMARK {
+            stream.handleFrame(&m_buffer);
+            if (!cached) {
+                PWHelpers::unmapBuffer(&m_buffer);
+            }
+        }
+        PWHelpers::unmapBuffer(&m_buffer);
+        QCOMPARE(sum, quint64(0));
+    }
+
+private:
+    int m_fd = -1;
+    spa_chunk m_chunk{};
+    spa_data m_data{};
+    spa_buffer m_spaBuffer{};
+    pw_buffer m_buffer{};
+};
+
+QTEST_GUILESS_MAIN(TestMemFdMapping)
+
+#include "TestMemFdMapping.moc"
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/buffersrc.h>
+#include <libavformat/avformat.h>
+}
+
+#include "encoder_p.h"
+#include "libvpxencoder_p.h"
+#include "pipewirerecord.h"
+#include "pipewirerecord_p.h"
+
+using namespace Qt::StringLiterals;
+
+// Records without a PipeWire stream, feeding frames to the filter graph directly
+class TestRecord : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    // The packets consumers of newPacket() get are the ones written to the
+    // recording, and connecting to it leaves the recording as it is.
+    void testNewPacket()
+    {
+        if (!avcodec_find_encoder_by_name("libvpx")) {
+            QSKIP("Skipping because the encoder was not found");
+        }
+
+        constexpr int frameCount = 30;
+        constexpr int keyFrame = 12;
+        const QSize size(128, 128);
+
+        QTemporaryDir directory;
+        QVERIFY(directory.isValid());
+        const QString output = directory.filePath(u"recording.webm"_s);
+
+        PipeWireRecord record;
+        PipeWireRecordProduce produce(PipeWireBaseEncodedStream::VP8, 0, 0, 0, Fraction{.numerator = 25, .denominator = 1}, output, {}, &record);
+        produce.m_stream.reset(new PipeWireSourceStream(nullptr));
+        produce.m_encoder = std::make_unique<LibVpxEncoder>(&produce);
+        QVERIFY(produce.m_encoder->initialize(size));
+        QVERIFY(produce.setupFormat());
+
+        std::vector<PipeWireEncodedStream::Packet> packets;
+        connect(&record, &PipeWireRecord::newPacket, this, [&packets](const PipeWireEncodedStream::Packet &packet) {
+            packets.push_back(packet);
+        });
+
+        auto frame = av_frame_alloc();
+        QVERIFY(frame);
+        for (int i = 0; i < frameCount; ++i) {
+            if (i == keyFrame) {
+                produce.requestKeyFrame();
+            }
+
+            // Without a source stream the filter graph takes RGBA
+            frame->format = AV_PIX_FMT_RGBA;
+            frame->width = size.width();
+            frame->height = size.height();
+            frame->pts = av_rescale_q(i, AVRational{1, 25}, FrameTimeBase);
+            QCOMPARE(av_frame_get_buffer(frame, 0), 0);
+            std::fill_n(frame->data[0], frame->linesize[0] * frame->height, 0x80);
+            QCOMPARE(av_buffersrc_add_frame(FilterAccess::inputFilter(produce.m_encoder.get()), frame), 0);
+            av_frame_unref(frame);
+
+            produce.m_encoder->encodeFrame(frameCount);
+            produce.m_encoder->receivePacket();
+        }
+        av_frame_free(&frame);
+
+        produce.m_encoder->finish();
+        produce.m_encoder->receivePacket();
+        produce.cleanup();
+
+        // Static content, so nothing but the request makes the encoder start a new group of pictures
+        QVERIFY(packets.size() > std::size_t(keyFrame));
+        QVERIFY(packets.front().isKeyFrame());
+        QCOMPARE(std::count_if(packets.cbegin(),
+                               packets.cend(),
+                               [](const PipeWireEncodedStream::Packet &packet) {
+                                   return packet.isKeyFrame();
+                               }),
+                 2);
+
+        // Read the recording back, it has to hold the very same packets
+        AVFormatContext *input = nullptr;
+        QCOMPARE(avformat_open_input(&input, QFile::encodeName(output).constData(), nullptr, nullptr), 0);
+        auto packet = av_packet_alloc();
+        QVERIFY(packet);
+        std::size_t read = 0;
+        while (av_read_frame(input, packet) >= 0) {
+            QVERIFY(read < packets.size());
+            QCOMPARE(QByteArray(reinterpret_cast<const char *>(packet->data), packet->size), packets[read].data());
+            QCOMPARE(bool(packet->flags & AV_PKT_FLAG_KEY), packets[read].isKeyFrame());
+            av_packet_unref(packet);
+            read++;
+        }
+        av_packet_free(&packet);
+        avformat_close_input(&input);
+        QCOMPARE(read, packets.size());
+    }
+
+private:
+    // Gives access to the filter graph input, to feed frames without a PipeWire stream
+    struct FilterAccess : Encoder {
+        static AVFilterContext *inputFilter(Encoder *encoder)
+        {
+            return encoder->*(&FilterAccess::m_inputFilter);
+        }
+    };
+};
+
+QTEST_MAIN(TestRecord)
+#include "TestRecord.moc"
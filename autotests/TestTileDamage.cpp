@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include "tiledamage_p.h"
+
+class TestTileDamage : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testUnchanged()
+    {
+        const QSize size(200, 130);
+        QByteArray frame(size.width() * 4 * size.height(), 'a');
+
+        TileDamage damage;
+        QCOMPARE(damage.update(data(frame), size.width() * 4, size, 4), QRegion(0, 0, 200, 130));
+        QVERIFY(damage.update(data(frame), size.width() * 4, size, 4).isEmpty());
+
+        damage.reset();
+        QCOMPARE(damage.update(data(frame), size.width() * 4, size, 4), QRegion(0, 0, 200, 130));
+    }
+
+    void testChangedPixel_data()
+    {
+        QTest::addColumn<int>("bytesPerPixel");
+        QTest::addColumn<QPoint>("pixel");
+        QTest::addColumn<QRect>("expected");
+
+        QTest::newRow("rgba-origin") << 4 << QPoint(0, 0) << QRect(0, 0, 64, 64);
+        QTest::newRow("rgba-inside") << 4 << QPoint(70, 65) << QRect(64, 64, 64, 64);
+        QTest::newRow("rgba-corner") << 4 << QPoint(199, 129) << QRect(192, 128, 8, 2);
+        QTest::newRow("rgb-edge") << 3 << QPoint(63, 10) << QRect(0, 0, 64, 64);
+        QTest::newRow("rgb-corner") << 3 << QPoint(199, 129) << QRect(192, 128, 8, 2);
+        QTest::newRow("gray-corner") << 1 << QPoint(199, 129) << QRect(192, 128, 8, 2);
+    }
+
+    void testChangedPixel()
+    {
+        QFETCH(int, bytesPerPixel);
+        QFETCH(QPoint, pixel);
+        QFETCH(QRect, expected);
+
+        // Padding at the end of the rows must not count
+        const QSize size(200, 130);
+        const int stride = size.width() * bytesPerPixel + 24;
+        QByteArray frame(stride * size.height(), 'a');
+
+        TileDamage damage;
+        damage.update(data(frame), stride, size, bytesPerPixel);
+
+        frame[stride * size.height() - 1] = 'b';
+        QVERIFY(damage.update(data(frame), stride, size, bytesPerPixel).isEmpty());
+
+        for (int byte = 0; byte < bytesPerPixel; ++byte) {
+            frame[pixel.y() * stride + pixel.x() * bytesPerPixel + byte] = char(0x80 >> byte);
+            QCOMPARE(damage.update(data(frame), stride, size, bytesPerPixel), QRegion(expected));
+        }
+    }
+
+    void testMerge()
+    {
+        const QSize size(256, 128);
+        QByteArray frame(size.width() * 4 * size.height(), 0);
+
+        TileDamage damage;
+        damage.update(data(frame), size.width() * 4, size, 4);
+
+        // Neighbouring tiles are merged, the high bits matter as much as the low ones
+        frame[(1 * size.width() + 0) * 4 + 3] = char(0x80);
+        frame[(2 * size.width() + 64) * 4 + 3] = char(0x80);
+        frame[(100 * size.width() + 255) * 4] = 1;
+        QCOMPARE(damage.update(data(frame), size.width() * 4, size, 4), QRegion(0, 0, 128, 64) + QRect(192, 64, 64, 64));
+    }
+
+    void testFormatChange()
+    {
+        QByteArray frame(512 * 512 * 4, 'a');
+
+        TileDamage damage;
+        damage.update(data(frame), 512 * 4, QSize(512, 512), 4);
+        QVERIFY(damage.update(data(frame), 512 * 4, QSize(512, 512), 4).isEmpty());
+        QCOMPARE(damage.update(data(frame), 256 * 4, QSize(256, 256), 4), QRegion(0, 0, 256, 256));
+        QCOMPARE(damage.update(data(frame), 256 * 4, QSize(256, 256), 3), QRegion(0, 0, 256, 256));
+        QCOMPARE(damage.update(nullptr, 256 * 4, QSize(256, 256), 4), QRegion(0, 0, 256, 256));
+        QCOMPARE(damage.update(data(frame), 256 * 4, QSize(256, 256), 4), QRegion(0, 0, 256, 256));
+    }
+
+    void benchmarkUpdate_data()
+    {
+        QTest::addColumn<QSize>("size");
+
+        QTest::newRow("1080p") << QSize(1920, 1080);
+        QTest::newRow("4k") << QSize(3840, 2160);
+    }
+
+    void benchmarkUpdate()
+    {
+        QFETCH(QSize, size);
+        qDebug() << "Using" << TileDamage::implementation();
+
+        QByteArray frame(size.width() * 4 * size.height(), 'a');
+        TileDamage damage;
+        damage.update(data(frame), size.width() * 4, size, 4);
+        QBENCHMARK {
+            damage.update(data(frame), size.width() * 4, size, 4);
+        }
+    }
+
+private:
+    static const uint8_t *data(const QByteArray &frame)
+    {
+        return reinterpret_cast<const uint8_t *>(frame.constData());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestTileDamage)
+
+#include "TestTileDamage.moc"
@@ -0,0 +1,148 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QtTest>
+
+#include <thread>
+
+#include "spscqueue_p.h"
+#include "workersignal_p.h"
+
+static std::atomic_int s_livePayloads = 0;
+
+struct Payload {
+    Payload()
+    {
+        s_livePayloads++;
+    }
+    ~Payload()
+    {
+        s_livePayloads--;
+    }
+};
+
+struct SyntheticFrame {
+    int sequence = -1;
+    std::shared_ptr<Payload> payload;
+};
+
+// Pushes @p frame, parking on @p space while the queue is full
+static void pushBlocking(SpscQueue<SyntheticFrame> &queue, WorkerSignal &space, SyntheticFrame &&frame)
+{
+    for (;;) {
+        const auto seen = space.generation();
+        if (queue.push(std::move(frame))) {
+            return;
+        }
+        space.wait(seen);
+    }
+}
+
+class TestWorkerHandoff : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void testStopIdleWorker()
+    {
+        WorkerSignal signal;
+        // Stopping right as the worker starts over used to leave it parked for good
+        for (int i = 0; i < 10000; ++i) {
+            std::atomic_bool running = true;
+            std::thread worker([&] {
+                for (;;) {
+                    const auto seen = signal.generation();
+                    if (!running) {
+                        break;
+                    }
+                    signal.wait(seen);
+                }
+            });
+            running = false;
+            signal.notify();
+            worker.join();
+        }
+    }
+
+    // Mirrors PipeWireProduce: frames go from the produce thread to the
+    // passthrough thread and from there to the output thread. With queues
+    // this small the threads keep parking on each other, so a lost wakeup
+    // leaves frames stranded and the test times out.
+    void testStress_data()
+    {
+        QTest::addColumn<int>("capacity");
+        QTest::newRow("tight") << 1;
+        QTest::newRow("small") << 4;
+        QTest::newRow("roomy") << 64;
+    }
+
+    void testStress()
+    {
+        QFETCH(int, capacity);
+        constexpr int frameCount = 10000;
+
+        SpscQueue<SyntheticFrame> filterQueue(capacity);
+        SpscQueue<SyntheticFrame> encodeQueue(capacity);
+        WorkerSignal passthroughSignal;
+        WorkerSignal outputSignal;
+        WorkerSignal filterSpace;
+        WorkerSignal encodeSpace;
+        std::atomic_bool running = true;
+        std::atomic_int received = 0;
+        std::atomic_int outOfOrder = 0;
+
+        std::thread passthrough([&] {
+            for (;;) {
+                const auto seen = passthroughSignal.generation();
+                if (!running) {
+                    break;
+                }
+                while (auto frame = filterQueue.pop()) {
+                    filterSpace.notify();
+                    pushBlocking(encodeQueue, encodeSpace, std::move(*frame));
+                    outputSignal.notify();
+                }
+                passthroughSignal.wait(seen);
+            }
+        });
+
+        std::thread output([&] {
+            int expected = 0;
+            for (;;) {
+                const auto seen = outputSignal.generation();
+                if (!running) {
+                    break;
+                }
+                while (auto frame = encodeQueue.pop()) {
+                    encodeSpace.notify();
+                    if (frame->sequence != expected++) {
+                        outOfOrder++;
+                    }
+                    received++;
+                }
+                outputSignal.wait(seen);
+            }
+        });
+
+        for (int i = 0; i < frameCount; ++i) {
+            pushBlocking(filterQueue, filterSpace, {i, std::make_shared<Payload>()});
+            passthroughSignal.notify();
+        }
+
+        // Nothing gets notified anymore, the last frames have to make it on their own
+        QTRY_COMPARE_WITH_TIMEOUT(received.load(), frameCount, 10000);
+
+        running = false;
+        passthroughSignal.notify();
+        outputSignal.notify();
+        passthrough.join();
+        output.join();
+
+        QCOMPARE(outOfOrder.load(), 0);
+        QVERIFY(filterQueue.isEmpty());
+        QVERIFY(encodeQueue.isEmpty());
+        QCOMPARE(s_livePayloads.load(), 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestWorkerHandoff)
+#include "TestWorkerHandoff.moc"
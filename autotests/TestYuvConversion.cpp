@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+#include <QRandomGenerator>
+#include <QtTest>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "yuvconversion_p.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+class TestYuvConversion : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void initTestCase()
+    {
+        qDebug() << "Using" << YuvConversion::implementation();
+    }
+
+    void testConvert_data()
+    {
+        QTest::addColumn<int>("format");
+        QTest::addColumn<int>("bytesPerPixel");
+        QTest::addColumn<QList<int>>("channels");
+        QTest::addColumn<bool>("fullRange");
+
+        for (bool fullRange : {false, true}) {
+            const char *range = fullRange ? "full" : "limited";
+            QTest::addRow("rgbx-%s", range) << int(SPA_VIDEO_FORMAT_RGBx) << 4 << QList<int>{0, 1, 2} << fullRange;
+            QTest::addRow("rgba-%s", range) << int(SPA_VIDEO_FORMAT_RGBA) << 4 << QList<int>{0, 1, 2} << fullRange;
+            QTest::addRow("bgrx-%s", range) << int(SPA_VIDEO_FORMAT_BGRx) << 4 << QList<int>{2, 1, 0} << fullRange;
+            QTest::addRow("xrgb-%s", range) << int(SPA_VIDEO_FORMAT_xRGB) << 4 << QList<int>{1, 2, 3} << fullRange;
+            QTest::addRow("xbgr-%s", range) << int(SPA_VIDEO_FORMAT_xBGR) << 4 << QList<int>{3, 2, 1} << fullRange;
+            QTest::addRow("rgb-%s", range) << int(SPA_VIDEO_FORMAT_RGB) << 3 << QList<int>{0, 1, 2} << fullRange;
+            QTest::addRow("bgr-%s", range) << int(SPA_VIDEO_FORMAT_BGR) << 3 << QList<int>{2, 1, 0} << fullRange;
+            QTest::addRow("gray8-%s", range) << int(SPA_VIDEO_FORMAT_GRAY8) << 1 << QList<int>{0, 0, 0} << fullRange;
+        }
+    }
+
+    void testConvert()
+    {
+        QFETCH(int, format);
+        QFETCH(int, bytesPerPixel);
+        QFETCH(QList<int>, channels);
+        QFETCH(bool, fullRange);
+
+        QVERIFY(YuvConversion::supports(spa_video_format(format)));
+
+        // Odd sizes that leave tails for every SIMD width, with padded rows
+        for (const QSize size : {QSize(1, 1), QSize(7, 3), QSize(33, 2), QSize(101, 37)}) {
+            const int stride = size.width() * bytesPerPixel + 7;
+            QByteArray frame(stride * size.height(), Qt::Uninitialized);
+            QRandomGenerator random(size.width());
+            for (char &byte : frame) {
+                byte = char(random.bounded(256));
+            }
+
+            const QSize chromaSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+            const std::array<int, 3> strides = {size.width() + 5, chromaSize.width() + 3, chromaSize.width() + 1};
+            std::array<QByteArray, 3> planes = {QByteArray(strides[0] * size.height(), 0),
+                                                QByteArray(strides[1] * chromaSize.height(), 0),
+                                                QByteArray(strides[2] * chromaSize.height(), 0)};
+            std::array<uint8_t *, 3> data = {};
+            for (int i = 0; i < 3; ++i) {
+                data[i] = reinterpret_cast<uint8_t *>(planes[i].data());
+            }
+
+            YuvConversion::convert(pixels(frame), stride, spa_video_format(format), size, fullRange, data.data(), strides.data());
+
+            const auto pixel = [&](int x, int y) {
+                x = std::min(x, size.width() - 1);
+                y = std::min(y, size.height() - 1);
+                const uint8_t *pixel = pixels(frame) + y * stride + x * bytesPerPixel;
+                return std::array<double, 3>{double(pixel[channels[0]]), double(pixel[channels[1]]), double(pixel[channels[2]])};
+            };
+            const double lumaScale = (fullRange ? 255.0 : 219.0) / 255;
+            const double lumaOffset = fullRange ? 0 : 16;
+            const double chromaScale = (fullRange ? 255.0 : 224.0) / 255;
+
+            for (int y = 0; y < size.height(); ++y) {
+                for (int x = 0; x < size.width(); ++x) {
+                    const auto [r, g, b] = pixel(x, y);
+                    const double expected = (0.299 * r + 0.587 * g + 0.114 * b) * lumaScale + lumaOffset;
+                    QVERIFY2(std::abs(data[0][y * strides[0] + x] - expected) <= 1, qPrintable(QStringLiteral("Y at %1,%2").arg(x).arg(y)));
+                }
+            }
+            for (int y = 0; y < chromaSize.height(); ++y) {
+                for (int x = 0; x < chromaSize.width(); ++x) {
+                    double r = 0;
+                    double g = 0;
+                    double b = 0;
+                    for (const QPoint offset : {QPoint(0, 0), QPoint(1, 0), QPoint(0, 1), QPoint(1, 1)}) {
+                        const auto channels = pixel(x * 2 + offset.x(), y * 2 + offset.y());
+                        r += channels[0] / 4;
+                        g += channels[1] / 4;
+                        b += channels[2] / 4;
+                    }
+                    const double u = std::clamp((-0.168736 * r - 0.331264 * g + 0.5 * b) * chromaScale + 128, 0.0, 255.0);
+                    const double v = std::clamp((0.5 * r - 0.418688 * g - 0.081312 * b) * chromaScale + 128, 0.0, 255.0);
+                    QVERIFY2(std::abs(data[1][y * strides[1] + x] - u) <= 1, qPrintable(QStringLiteral("U at %1,%2").arg(x).arg(y)));
+                    QVERIFY2(std::abs(data[2][y * strides[2] + x] - v) <= 1, qPrintable(QStringLiteral("V at %1,%2").arg(x).arg(y)));
+                }
+            }
+
+            // The padding of the planes is left alone
+            QCOMPARE(int(data[0][strides[0] - 1]), 0);
+            QCOMPARE(int(data[1][strides[1] - 1]), 0);
+        }
+    }
+
+    void testColors_data()
+    {
+        QTest::addColumn<QColor>("color");
+        QTest::addColumn<bool>("fullRange");
+        QTest::addColumn<QList<int>>("expected");
+
+        QTest::newRow("black-limited") << QColor(Qt::black) << false << QList<int>{16, 128, 128};
+        QTest::newRow("white-limited") << QColor(Qt::white) << false << QList<int>{235, 128, 128};
+        QTest::newRow("grey-limited") << QColor(128, 128, 128) << false << QList<int>{126, 128, 128};
+        QTest::newRow("red-limited") << QColor(Qt::red) << false << QList<int>{81, 90, 240};
+        QTest::newRow("black-full") << QColor(Qt::black) << true << QList<int>{0, 128, 128};
+        QTest::newRow("white-full") << QColor(Qt::white) << true << QList<int>{255, 128, 128};
+        QTest::newRow("red-full") << QColor(Qt::red) << true << QList<int>{76, 85, 255};
+        QTest::newRow("blue-full") << QColor(Qt::blue) << true << QList<int>{29, 255, 107};
+    }
+
+    void testColors()
+    {
+        QFETCH(QColor, color);
+        QFETCH(bool, fullRange);
+        QFETCH(QList<int>, expected);
+
+        // Wide enough for the SIMD paths
+        const QSize size(64, 2);
+        QByteArray frame;
+        for (int i = 0; i < size.width() * size.height(); ++i) {
+            frame += char(color.red());
+            frame += char(color.green());
+            frame += char(color.blue());
+            frame += char(0xff);
+        }
+
+        QByteArray y(size.width() * size.height(), 0);
+        QByteArray u(size.width() / 2, 0);
+        QByteArray v(size.width() / 2, 0);
+        uint8_t *planes[] = {pixels(y), pixels(u), pixels(v)};
+        const int strides[] = {size.width(), size.width() / 2, size.width() / 2};
+        YuvConversion::convert(pixels(frame), size.width() * 4, SPA_VIDEO_FORMAT_RGBA, size, fullRange, planes, strides);
+
+        for (int i = 0; i < size.width() / 2; ++i) {
+            QCOMPARE(int(pixels(y)[i * 2]), expected[0]);
+            QCOMPARE(int(pixels(u)[i]), expected[1]);
+            QCOMPARE(int(pixels(v)[i]), expected[2]);
+        }
+    }
+
+    void testUnsupported()
+    {
+        QVERIFY(!YuvConversion::supports(SPA_VIDEO_FORMAT_NV12));
+        QVERIFY(!YuvConversion::supports(SPA_VIDEO_FORMAT_I420));
+        QVERIFY(!YuvConversion::supports(SPA_VIDEO_FORMAT_RGBA102));
+    }
+
+    void benchmarkConvert_data()
+    {
+        QTest::addColumn<QSize>("size");
+        QTest::addColumn<bool>("swscale");
+
+        for (bool swscale : {false, true}) {
+            const char *implementation = swscale ? "swscale" : "yuvconversion";
+            QTest::addRow("1080p-%s", implementation) << QSize(1920, 1080) << swscale;
+            QTest::addRow("1440p-%s", implementation) << QSize(2560, 1440) << swscale;
+            QTest::addRow("4k-%s", implementation) << QSize(3840, 2160) << swscale;
+        }
+    }
+
+    void benchmarkConvert()
+    {
+        QFETCH(QSize, size);
+        QFETCH(bool, swscale);
+
+        // Like the BGRx frames most compositors send
+        const int stride = size.width() * 4;
+        QByteArray frame(stride * size.height(), Qt::Uninitialized);
+        QRandomGenerator random(1);
+        for (char &byte : frame) {
+            byte = char(random.bounded(256));
+        }
+
+        uint8_t *planes[4] = {};
+        int strides[4] = {};
+        QVERIFY(av_image_alloc(planes, strides, size.width(), size.height(), AV_PIX_FMT_YUV420P, 32) >= 0);
+
+        if (swscale) {
+            // What the format filter in the filter graphs of the software encoders does
+            SwsContext *context = sws_getContext(size.width(),
+                                                 size.height(),
+                                                 AV_PIX_FMT_BGR0,
+                                                 size.width(),
+                                                 size.height(),
+                                                 AV_PIX_FMT_YUV420P,
+                                                 SWS_BICUBIC,
+                                                 nullptr,
+                                                 nullptr,
+                                                 nullptr);
+            QVERIFY(context);
+            const uint8_t *source[] = {pixels(frame)};
+            const int sourceStride[] = {stride};
+            QBENCHMARK {
+                sws_scale(context, source, sourceStride, 0, size.height(), planes, strides);
+            }
+            sws_freeContext(context);
+        } else {
+            QBENCHMARK {
+                YuvConversion::convert(pixels(frame), stride, SPA_VIDEO_FORMAT_BGRx, size, false, planes, strides);
+            }
+        }
+
+        av_freep(&planes[0]);
+    }
+
+private:
+    static uint8_t *pixels(QByteArray &frame)
+    {
+        return reinterpret_cast<uint8_t *>(frame.data());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestYuvConversion)
+
+#include "TestYuvConversion.moc"
@@ -0,0 +1,115 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <optional>
+
+/**
+ * Steps the encoding quality down when the encoder falls behind and back up
+ * once it has room again.
+ *
+ * It is fed the load of the pipeline once per statistics interval. Dropping
+ * quality reacts to a single overloaded interval, going back up needs several
+ * quiet ones in a row, so a source right at the edge settles on a quality the
+ * encoder keeps up with instead of oscillating around it.
+ */
+class AdaptiveQualityController
+{
+public:
+    struct Load {
+        // Frames in the filter and encode queues, and how many they may hold
+        int pendingFrames = 0;
+        int maxPendingFrames = 0;
+        // Total frames dropped because a queue was full
+        quint64 droppedFrames = 0;
+        // Share of the interval spent inside the codec, in percent
+        int encoderLoad = 0;
+    };
+
+    static constexpr int StepDown = 10;
+    static constexpr int StepUp = 5;
+    // Quiet intervals needed before stepping back up
+    static constexpr int RecoveryIntervals = 3;
+    static constexpr int OverloadedEncoderLoad = 90;
+    static constexpr int IdleEncoderLoad = 60;
+
+    /**
+     * Decide the quality to encode the next interval with.
+     *
+     * @param minimum The lowest quality to drop to.
+     * @param maximum The quality to use when there is no pressure, it starts there.
+     *
+     * @return The quality to use, between @p minimum and @p maximum.
+     */
+    quint8 update(const Load &load, quint8 minimum, quint8 maximum)
+    {
+        maximum = std::max(minimum, maximum);
+
+        const auto dropped = load.droppedFrames - m_droppedFrames;
+        m_droppedFrames = load.droppedFrames;
+
+        int quality = m_quality.value_or(maximum);
+        if (m_cooldown > 0) {
+            // Give the queues time to drain after a step down before judging again
+            m_cooldown--;
+        } else if (dropped > 0 || load.pendingFrames * 2 > load.maxPendingFrames || load.encoderLoad >= OverloadedEncoderLoad) {
+            quality -= StepDown;
+            m_idleIntervals = 0;
+            m_cooldown = 1;
+        } else if (load.pendingFrames * 4 <= load.maxPendingFrames && load.encoderLoad < IdleEncoderLoad) {
+            if (++m_idleIntervals >= RecoveryIntervals) {
+                quality += StepUp;
+                m_idleIntervals = 0;
+            }
+        } else {
+            m_idleIntervals = 0;
+        }
+
+        quality = std::clamp<int>(quality, minimum, maximum);
+        if (m_quality && *m_quality != quality) {
+            m_adjustments++;
+        }
+        m_quality = quality;
+        return quality;
+    }
+
+    /**
+     * The quality decided on last, if update() was called at all.
+     */
+    std::optional<quint8> quality() const
+    {
+        return m_quality;
+    }
+
+    /**
+     * How often the quality was changed.
+     */
+    quint64 adjustments() const
+    {
+        return m_adjustments;
+    }
+
+    /**
+     * Start over at the maximum quality, e.g. for a new encoder.
+     */
+    void reset()
+    {
+        m_quality.reset();
+        m_idleIntervals = 0;
+        m_cooldown = 0;
+    }
+
+private:
+    std::optional<quint8> m_quality;
+    quint64 m_droppedFrames = 0;
+    quint64 m_adjustments = 0;
+    int m_idleIntervals = 0;
+    int m_cooldown = 0;
+};
@@ -23,11 +23,22 @@ extern "C" {
 AudioEncoder::AudioEncoder(PipeWireProduce *produce)
     : QObject(nullptr)
     , m_produce(produce)
+    , m_inputFrame(av_frame_alloc())
+    , m_filteredFrame(av_frame_alloc())
+    , m_packet(av_packet_alloc())
 {
+    if (!m_inputFrame || !m_filteredFrame || !m_packet) {
+        qFatal("Failed to allocate memory");
+    }
 }
 
 AudioEncoder::~AudioEncoder()
 {
+    av_frame_free(&m_inputFrame);
+    av_frame_free(&m_filteredFrame);
+    av_packet_free(&m_packet);
+    av_buffer_unref(&m_silence);
+
     if (m_avFilterGraph) {
         avfilter_graph_free(&m_avFilterGraph);
     }
@@ -37,6 +48,55 @@ AudioEncoder::~AudioEncoder()
     }
 }
 
+AVFrame *AudioEncoder::inputFrame(int sampleCount, quint32 channels, quint32 rate)
+{
+    auto frame = m_inputFrame;
+    av_frame_unref(frame);
+
+    frame->format = AV_SAMPLE_FMT_FLT;
+    frame->sample_rate = rate;
+    frame->nb_samples = sampleCount;
+    av_channel_layout_default(&frame->ch_layout, channels);
+    if (!m_framePool.allocateAudio(frame)) {
+        av_frame_unref(frame);
+        return nullptr;
+    }
+
+    return frame;
+}
+
+AVFrame *AudioEncoder::silenceFrame(int sampleCount, quint32 channels, quint32 rate)
+{
+    auto frame = m_inputFrame;
+    av_frame_unref(frame);
+
+    frame->format = AV_SAMPLE_FMT_FLT;
+    frame->sample_rate = rate;
+    frame->nb_samples = sampleCount;
+    av_channel_layout_default(&frame->ch_layout, channels);
+
+    const int size = av_samples_get_buffer_size(nullptr, channels, sampleCount, AV_SAMPLE_FMT_FLT, 0);
+    if (size < 0) {
+        return nullptr;
+    }
+    if (!m_silence || m_silence->size < size_t(size)) {
+        // Frames still referencing the previous buffer keep it alive
+        av_buffer_unref(&m_silence);
+        m_silence = av_buffer_allocz(size);
+        if (!m_silence) {
+            return nullptr;
+        }
+    }
+
+    frame->buf[0] = av_buffer_ref(m_silence);
+    if (!frame->buf[0]) {
+        return nullptr;
+    }
+    av_samples_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, channels, sampleCount, AV_SAMPLE_FMT_FLT, 0);
+    frame->extended_data = frame->data;
+    return frame;
+}
+
 bool AudioEncoder::filterFrame(int input, AVFrame *frame)
 {
     std::lock_guard guard(m_avFilterGraphMutex);
@@ -58,10 +118,7 @@ void AudioEncoder::endInput(int input)
 
 std::pair<int, int> AudioEncoder::encodeFrame(int maximumFrames)
 {
-    auto frame = av_frame_alloc();
-    if (!frame) {
-        qFatal("Failed to allocate memory");
-    }
+    auto frame = m_filteredFrame;
 
     int filtered = 0;
     int queued = 0;
@@ -112,17 +169,14 @@ std::pair<int, int> AudioEncoder::encodeFrame(int maximumFrames)
         av_frame_unref(frame);
     }
 
-    av_frame_free(&frame);
+    av_frame_unref(frame);
 
     return std::make_pair(filtered, queued);
 }
 
 int AudioEncoder::receivePacket()
 {
-    auto packet = av_packet_alloc();
-    if (!packet) {
-        qFatal("Failed to allocate memory");
-    }
+    auto packet = m_packet;
 
     int received = 0;
 
@@ -146,8 +200,6 @@ int AudioEncoder::receivePacket()
         av_packet_unref(packet);
     }
 
-    av_packet_free(&packet);
-
     return received;
 }
 
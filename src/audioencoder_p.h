@@ -12,6 +12,7 @@
 #include <QList>
 #include <QObject>
 
+#include "framepool_p.h"
 #include "pipewireproduce_p.h"
 
 extern "C" {
@@ -50,6 +51,28 @@ public:
      * @return true if initialization was succesful, false if not.
      */
     virtual bool initialize(int inputCount, bool globalHeader) = 0;
+    /**
+     * Get a frame with room for interleaved float samples, to fill in and pass to filterFrame().
+     *
+     * The frame and its buffer are reused, so it has to be passed on or unreferenced
+     * before asking for the next one.
+     *
+     * @param sampleCount The number of samples per channel.
+     * @param channels The number of channels.
+     * @param rate The sample rate.
+     *
+     * @return The frame, or nullptr if no buffer could be allocated for it.
+     *
+     * @note This method must always be called from the same thread.
+     */
+    AVFrame *inputFrame(int sampleCount, quint32 channels, quint32 rate);
+    /**
+     * Like inputFrame(), but the frame is already filled with silence.
+     *
+     * All silence frames share one read-only buffer, so they cost no allocation
+     * however long the gap they fill is.
+     */
+    AVFrame *silenceFrame(int sampleCount, quint32 channels, quint32 rate);
     /**
      * Pass an audio frame to libav for filtering.
      *
@@ -126,5 +149,12 @@ protected:
     QList<AVFilterContext *> m_inputFilters;
     AVFilterContext *m_outputFilter = nullptr;
 
+    // Reused for every frame, see Encoder.
+    AVFrame *m_inputFrame = nullptr;
+    AVFrame *m_filteredFrame = nullptr;
+    AVPacket *m_packet = nullptr;
+    FramePool m_framePool;
+    AVBufferRef *m_silence = nullptr;
+
     std::optional<quint8> m_quality;
 };
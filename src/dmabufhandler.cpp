@@ -4,14 +4,38 @@
 #include "dmabufhandler.h"
 #include "glhelpers.h"
 #include "rendernodecontext_p.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <epoxy/gl.h>
 #include <fcntl.h>
 #include <gbm.h>
 #include <logging_dmabuf.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <QElapsedTimer>
+#include <QVarLengthArray>
+
 struct DmaBufHandlerPrivate {
     ~DmaBufHandlerPrivate()
     {
+        if (egl.context != EGL_NO_CONTEXT && eglMakeCurrent(egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, egl.context)) {
+            for (auto &download : downloads) {
+                glDeleteSync(download.fence);
+                glDeleteBuffers(1, &download.buffer);
+            }
+            for (auto &buffer : importedBuffers) {
+                release(buffer);
+            }
+            if (conversion.program) {
+                glDeleteProgram(conversion.program);
+                glDeleteVertexArrays(1, &conversion.vertexArray);
+                glDeleteBuffers(1, &conversion.vertexBuffer);
+                glDeleteFramebuffers(conversion.framebuffers.size(), conversion.framebuffers.data());
+                glDeleteTextures(conversion.textures.size(), conversion.textures.data());
+            }
+        }
         if (gbmDevice) {
             gbm_device_destroy(gbmDevice);
         }
@@ -29,8 +53,258 @@ struct DmaBufHandlerPrivate {
         EGLContext context = EGL_NO_CONTEXT;
     };
     EGLStruct egl;
+
+    // A read back in flight, into a pixel buffer object laid out like the frame
+    struct Download {
+        GLuint buffer = 0;
+        qsizetype bytes = 0;
+        GLsync fence = nullptr;
+        QSize size;
+        QRegion region;
+        DmaBufHandler::DownloadFormat format = DmaBufHandler::DownloadFormat::RGBA;
+    };
+    std::array<Download, DmaBufHandler::DownloadRingSize> downloads;
+    int firstDownload = 0;
+    int queuedDownloads = 0;
+
+    // Converts frames to YUV, one plane per framebuffer
+    struct Conversion {
+        bool failed = false;
+        GLuint program = 0;
+        GLint scaleLocation = -1;
+        GLint coefficientsLocation = -1;
+        GLuint vertexArray = 0;
+        GLuint vertexBuffer = 0;
+        std::array<GLuint, 3> textures = {};
+        std::array<GLuint, 3> framebuffers = {};
+        QSize size;
+    };
+    Conversion conversion;
+
+    // A buffer of the stream imported as a texture, with a framebuffer to read it through
+    struct ImportedBuffer {
+        DmaBufAttributes attributes;
+        spa_video_format format = SPA_VIDEO_FORMAT_UNKNOWN;
+        // Tells a buffer apart from one that is gone and had the same file descriptor
+        QVarLengthArray<ino_t, 4> inodes;
+        EGLImageKHR image = EGL_NO_IMAGE_KHR;
+        GLuint texture = 0;
+        GLuint framebuffer = 0;
+        quint64 lastUse = 0;
+    };
+    // Streams cycle through a few buffers, importing them once saves creating an EGLImage for every frame
+    static constexpr std::size_t maxImportedBuffers = 16;
+    std::vector<ImportedBuffer> importedBuffers;
+    quint64 importUses = 0;
+    int reusedImports = 0;
+    int newImports = 0;
+    QElapsedTimer importReport;
+
+    // The import of the buffer of @p frame, bound to GL_TEXTURE_2D and GL_FRAMEBUFFER
+    ImportedBuffer *importBuffer(const PipeWireFrame &frame);
+    void release(ImportedBuffer &buffer);
 };
 
+DmaBufHandlerPrivate::ImportedBuffer *DmaBufHandlerPrivate::importBuffer(const PipeWireFrame &frame)
+{
+    const auto &attributes = *frame.dmabuf;
+    QVarLengthArray<ino_t, 4> inodes;
+    for (const auto &plane : attributes.planes) {
+        struct stat status;
+        inodes.append(fstat(plane.fd, &status) == 0 ? status.st_ino : 0);
+    }
+
+    const auto sameLayout = [&](const ImportedBuffer &buffer) {
+        return buffer.format == frame.format && buffer.attributes.width == attributes.width && buffer.attributes.height == attributes.height
+            && buffer.attributes.format == attributes.format && buffer.attributes.modifier == attributes.modifier;
+    };
+    const auto samePlanes = [&](const ImportedBuffer &buffer) {
+        if (buffer.attributes.planes.size() != attributes.planes.size() || buffer.inodes != inodes) {
+            return false;
+        }
+        for (int i = 0; i < attributes.planes.size(); ++i) {
+            const auto &a = buffer.attributes.planes[i];
+            const auto &b = attributes.planes[i];
+            if (a.fd != b.fd || a.offset != b.offset || a.stride != b.stride) {
+                return false;
+            }
+        }
+        return true;
+    };
+    const auto sharesFd = [&](const ImportedBuffer &buffer) {
+        return std::ranges::any_of(buffer.attributes.planes, [&](const DmaBufPlane &plane) {
+            return std::ranges::any_of(attributes.planes, [&](const DmaBufPlane &other) {
+                return plane.fd == other.fd;
+            });
+        });
+    };
+
+    // The stream was renegotiated, or the buffer is gone and another one got its file descriptor
+    std::erase_if(importedBuffers, [&](ImportedBuffer &buffer) {
+        const bool stale = !sameLayout(buffer) || (sharesFd(buffer) && !samePlanes(buffer));
+        if (stale) {
+            release(buffer);
+        }
+        return stale;
+    });
+
+    if (PIPEWIREDMABUF_LOGGING().isDebugEnabled()) {
+        if (!importReport.isValid()) {
+            importReport.start();
+        } else if (importReport.hasExpired(10'000)) {
+            qCDebug(PIPEWIREDMABUF_LOGGING) << reusedImports << "frames read from buffers imported before," << newImports << "imported,"
+                                            << importedBuffers.size() << "buffers kept.";
+            reusedImports = 0;
+            newImports = 0;
+            importReport.restart();
+        }
+    }
+
+    auto cached = std::ranges::find_if(importedBuffers, samePlanes);
+    if (cached != importedBuffers.end()) {
+        reusedImports++;
+        cached->lastUse = ++importUses;
+        glBindTexture(GL_TEXTURE_2D, cached->texture);
+        glBindFramebuffer(GL_FRAMEBUFFER, cached->framebuffer);
+        return &*cached;
+    }
+
+    if (importedBuffers.size() == maxImportedBuffers) {
+        auto leastRecent = std::ranges::min_element(importedBuffers, {}, &ImportedBuffer::lastUse);
+        release(*leastRecent);
+        importedBuffers.erase(leastRecent);
+    }
+
+    const QSize size = {attributes.width, attributes.height};
+    EGLImageKHR image = GLHelpers::createImage(egl.display, attributes, PipeWireSourceStream::spaVideoFormatToDrmFormat(frame.format), size, gbmDevice);
+    if (image == EGL_NO_IMAGE_KHR) {
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to record frame: Error creating EGLImageKHR - " << GLHelpers::formatEGLError(eglGetError());
+        return nullptr;
+    }
+    newImports++;
+
+    GLHelpers::initDebugOutput();
+    // create GL 2D texture for framebuffer
+    ImportedBuffer buffer{
+        .attributes = attributes,
+        .format = frame.format,
+        .inodes = inodes,
+        .image = image,
+        .lastUse = ++importUses,
+    };
+    glGenTextures(1, &buffer.texture);
+    glBindTexture(GL_TEXTURE_2D, buffer.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
+    glGenFramebuffers(1, &buffer.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, buffer.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer.texture, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        release(buffer);
+        return nullptr;
+    }
+
+    importedBuffers.push_back(std::move(buffer));
+    return &importedBuffers.back();
+}
+
+void DmaBufHandlerPrivate::release(ImportedBuffer &buffer)
+{
+    // GL keeps them around until reads that are still in flight are done
+    glDeleteFramebuffers(1, &buffer.framebuffer);
+    glDeleteTextures(1, &buffer.texture);
+    eglDestroyImageKHR(egl.display, buffer.image);
+}
+
+namespace
+{
+// A plane of a download. Planes follow each other in the pixel buffer, their rows are packed.
+struct Plane {
+    QSize size;
+    int bytesPerPixel;
+    qsizetype offset;
+};
+
+QVarLengthArray<Plane, 3> downloadPlanes(DmaBufHandler::DownloadFormat format, const QSize &size)
+{
+    if (format == DmaBufHandler::DownloadFormat::RGBA) {
+        return {Plane{size, 4, 0}};
+    }
+    const QSize chromaSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+    const qsizetype lumaBytes = qsizetype(size.width()) * size.height();
+    const qsizetype chromaBytes = qsizetype(chromaSize.width()) * chromaSize.height();
+    return {Plane{size, 1, 0}, Plane{chromaSize, 1, lumaBytes}, Plane{chromaSize, 1, lumaBytes + chromaBytes}};
+}
+
+// The part of plane @p plane that @p rect of the frame covers, @p rect starts at even coordinates for YUV
+QRect planeRect(const QRect &rect, int plane)
+{
+    if (plane == 0) {
+        return rect;
+    }
+    return QRect(rect.x() / 2, rect.y() / 2, (rect.width() + 1) / 2, (rect.height() + 1) / 2);
+}
+
+// Widen @p region to even coordinates, or the edge of @p size
+QRegion alignToChroma(const QRegion &region, const QSize &size)
+{
+    QRegion aligned;
+    for (const QRect &rect : region) {
+        const int right = std::min((rect.x() + rect.width() + 1) & ~1, size.width());
+        const int bottom = std::min((rect.y() + rect.height() + 1) & ~1, size.height());
+        aligned += QRect(QPoint(rect.x() & ~1, rect.y() & ~1), QPoint(right - 1, bottom - 1));
+    }
+    return aligned;
+}
+
+const char vertexShader[] = R"(#version 130
+in vec2 position;
+
+void main()
+{
+    gl_Position = vec4(position, 0.0, 1.0);
+}
+)";
+
+// Chroma is sampled between 2x2 pixels, where linear filtering averages them
+const char fragmentShader[] = R"(#version 130
+uniform sampler2D frame;
+// From window to texture coordinates
+uniform vec2 scale;
+// The weights of red, green and blue, and the offset
+uniform vec4 coefficients;
+out vec4 value;
+
+void main()
+{
+    vec3 color = texture(frame, gl_FragCoord.xy * scale).rgb;
+    value = vec4(dot(color, coefficients.rgb) + coefficients.a);
+}
+)";
+
+GLuint compileShader(GLenum type, const char *source)
+{
+    const GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        std::array<char, 1024> log = {};
+        glGetShaderInfoLog(shader, log.size(), nullptr, log.data());
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to compile shader:" << log.data();
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+}
+
 DmaBufHandler::DmaBufHandler()
     : d(std::make_unique<DmaBufHandlerPrivate>())
 {
@@ -54,15 +328,21 @@ void DmaBufHandler::setupEgl()
         return;
     }
 
-    if (d->egl.display == EGL_NO_DISPLAY) {
+    if (d->egl.display == EGL_NO_DISPLAY && qEnvironmentVariableIsSet("WAYLAND_DISPLAY")) {
         d->egl.display = eglGetPlatformDisplay(EGL_PLATFORM_WAYLAND_KHR, (void *)EGL_DEFAULT_DISPLAY, nullptr);
     }
-    if (d->egl.display == EGL_NO_DISPLAY) {
-        const QByteArray renderNode = renderContext.renderNode;
-        if (renderNode.isEmpty()) {
+    const QByteArray renderNode = renderContext.renderNode;
+    if (d->egl.display == EGL_NO_DISPLAY && renderNode.isEmpty()) {
+        // Without a session, e.g. in tests, let Mesa pick a device or fall back to software rendering
+        if (epoxy_has_egl_extension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless")) {
+            d->egl.display = eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        }
+        if (d->egl.display == EGL_NO_DISPLAY) {
             qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to resolve a render node for the current session";
             return;
         }
+    }
+    if (d->egl.display == EGL_NO_DISPLAY) {
         d->drmFd = open(renderNode.constData(), O_RDWR);
 
         if (d->drmFd < 0) {
@@ -120,16 +400,14 @@ void DmaBufHandler::setupEgl()
             return false;
         }
         qCWarning(PIPEWIREDMABUF_LOGGING) << "eglChooseConfig returned this many configs:" << count;
-        return true;
+        // Surfaceless displays have no window configs, we only ever render to textures anyway
+        return count > 0;
     };
 
     bool b = createConfig();
     static const EGLint configAttribs[] = {EGL_CONTEXT_OPENGL_DEBUG, EGL_TRUE, EGL_NONE};
-    Q_ASSERT(configs);
     d->egl.context = eglCreateContext(d->egl.display, b ? configs : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, configAttribs);
 
-    Q_ASSERT(b);
-    Q_ASSERT(d->egl.context);
     if (d->egl.context == EGL_NO_CONTEXT) {
         qCWarning(PIPEWIREDMABUF_LOGGING) << "Couldn't create EGL context: " << GLHelpers::formatEGLError(eglGetError());
         return;
@@ -160,53 +438,358 @@ GLenum closestGLType(const QImage &image)
 }
 
 bool DmaBufHandler::downloadFrame(QImage &qimage, const PipeWireFrame &frame)
+{
+    return downloadFrame(qimage, frame, QRect(QPoint(0, 0), qimage.size()));
+}
+
+bool DmaBufHandler::downloadFrame(QImage &qimage, const PipeWireFrame &frame, const QRegion &damage)
 {
     Q_ASSERT(frame.dmabuf);
     const QSize streamSize = {frame.dmabuf->width, frame.dmabuf->height};
     Q_ASSERT(qimage.size() == streamSize);
+    return readFrame(frame, closestGLType(qimage), qimage.depth() / 8, damage & qimage.rect(), qimage.bits());
+}
+
+bool DmaBufHandler::supportsDownloadFormat(DownloadFormat format)
+{
+    if (format == DownloadFormat::RGBA) {
+        return true;
+    }
     setupEgl();
-    if (!d->eglInitialized) {
+    if (!d->eglInitialized || !eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, d->egl.context)) {
         return false;
     }
+    return setupConversion();
+}
+
+bool DmaBufHandler::queueDownload(const PipeWireFrame &frame, const QRegion &damage, DownloadFormat format)
+{
+    Q_ASSERT(frame.dmabuf);
+    Q_ASSERT(d->queuedDownloads < DownloadRingSize);
+    const QSize size = {frame.dmabuf->width, frame.dmabuf->height};
+    QRegion region = damage & QRect(QPoint(0, 0), size);
+    if (format != DownloadFormat::RGBA) {
+        region = alignToChroma(region, size);
+    }
+
+    setupEgl();
+    if (!d->eglInitialized || !eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, d->egl.context)) {
+        return false;
+    }
+
+    auto &download = d->downloads[(d->firstDownload + d->queuedDownloads) % DownloadRingSize];
+    const auto lastPlane = downloadPlanes(format, size).constLast();
+    const qsizetype bytes = lastPlane.offset + qsizetype(lastPlane.size.width()) * lastPlane.bytesPerPixel * lastPlane.size.height();
+    if (!download.buffer) {
+        glGenBuffers(1, &download.buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, download.buffer);
+    if (download.bytes != bytes) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        download.bytes = bytes;
+    }
+    auto unbind = qScopeGuard([] {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    });
+
+    // With a pack buffer bound, the destination is an offset into it and glReadPixels() returns right away
+    if (!readFrame(frame, GL_RGBA, 4, region, nullptr, format)) {
+        return false;
+    }
+
+    download.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Have the GPU start right away rather than when the download is taken
+    glFlush();
+    download.size = size;
+    download.region = region;
+    download.format = format;
+    d->queuedDownloads++;
+    return true;
+}
+
+void DmaBufHandler::forgetBuffers()
+{
+    if (d->importedBuffers.empty()) {
+        return;
+    }
+    if (!eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, d->egl.context)) {
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to make context current" << GLHelpers::formatEGLError(eglGetError());
+        return;
+    }
+    for (auto &buffer : d->importedBuffers) {
+        d->release(buffer);
+    }
+    d->importedBuffers.clear();
+}
+
+int DmaBufHandler::queuedDownloads() const
+{
+    return d->queuedDownloads;
+}
+
+bool DmaBufHandler::isDownloadReady() const
+{
+    Q_ASSERT(d->queuedDownloads > 0);
+    if (!eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, d->egl.context)) {
+        return true; // Let takeDownload() deal with it
+    }
+    const auto status = glClientWaitSync(d->downloads[d->firstDownload].fence, 0, 0);
+    return status != GL_TIMEOUT_EXPIRED;
+}
+
+bool DmaBufHandler::takeDownload(QImage &image)
+{
+    Q_ASSERT(d->queuedDownloads > 0);
+    Q_ASSERT(d->downloads[d->firstDownload].format == DownloadFormat::RGBA);
+    Q_ASSERT(image.isNull() || (image.size() == d->downloads[d->firstDownload].size && image.depth() == 32));
+    if (image.isNull()) {
+        return takeDownload(nullptr, nullptr);
+    }
+    uchar *const planes[] = {image.bits()};
+    const int strides[] = {int(image.bytesPerLine())};
+    return takeDownload(planes, strides);
+}
+
+bool DmaBufHandler::takeDownload(uchar *const *planes, const int *strides)
+{
+    Q_ASSERT(d->queuedDownloads > 0);
+    auto &download = d->downloads[d->firstDownload];
+
+    d->firstDownload = (d->firstDownload + 1) % DownloadRingSize;
+    d->queuedDownloads--;
 
     if (!eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, d->egl.context)) {
         qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to make context current" << GLHelpers::formatEGLError(eglGetError());
         return false;
     }
-    EGLImageKHR image =
-        GLHelpers::createImage(d->egl.display, *frame.dmabuf, PipeWireSourceStream::spaVideoFormatToDrmFormat(frame.format), qimage.size(), d->gbmDevice);
 
-    if (image == EGL_NO_IMAGE_KHR) {
-        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to record frame: Error creating EGLImageKHR - " << GLHelpers::formatEGLError(eglGetError());
+    // Give up on a GPU that takes more than a second
+    constexpr GLuint64 timeout = 1'000'000'000;
+    const auto status = glClientWaitSync(download.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    glDeleteSync(download.fence);
+    download.fence = nullptr;
+    if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to wait for a frame to be read back" << GLHelpers::formatGLError(glGetError());
         return false;
     }
 
-    GLHelpers::initDebugOutput();
-    // create GL 2D texture for framebuffer
-    GLuint texture = 0;
-    GLuint fbo = 0;
-    glGenTextures(1, &texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    if (download.region.isEmpty() || !planes) {
+        return true;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, download.buffer);
+    auto unbind = qScopeGuard([] {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    });
+    const auto data = static_cast<const uchar *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, download.bytes, GL_MAP_READ_BIT));
+    if (!data) {
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to map a read back frame" << GLHelpers::formatGLError(glGetError());
+        return false;
+    }
+
+    // The buffer is laid out like the frame, copy what was read back
+    const auto layout = downloadPlanes(download.format, download.size);
+    for (int i = 0; i < layout.size(); ++i) {
+        const auto &plane = layout[i];
+        const qsizetype stride = qsizetype(plane.size.width()) * plane.bytesPerPixel;
+        for (const QRect &damaged : download.region) {
+            const QRect rect = planeRect(damaged, i);
+            const qsizetype x = qsizetype(rect.x()) * plane.bytesPerPixel;
+            for (int y = rect.top(); y <= rect.bottom(); ++y) {
+                std::memcpy(planes[i] + y * qsizetype(strides[i]) + x, data + plane.offset + y * stride + x, rect.width() * plane.bytesPerPixel);
+            }
+        }
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    return true;
+}
+
+bool DmaBufHandler::setupConversion()
+{
+    auto &conversion = d->conversion;
+    if (conversion.program || conversion.failed) {
+        return conversion.program;
+    }
+    conversion.failed = true;
+
+    // GLSL 1.30 and single channel render targets
+    if (epoxy_gl_version() < 30) {
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Converting frames on the GPU needs OpenGL 3.0, have" << epoxy_gl_version();
+        return false;
+    }
+
+    const GLuint vertex = compileShader(GL_VERTEX_SHADER, vertexShader);
+    const GLuint fragment = compileShader(GL_FRAGMENT_SHADER, fragmentShader);
+    auto deleteShaders = qScopeGuard([&] {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+    });
+    if (!vertex || !fragment) {
+        return false;
+    }
+
+    const GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glBindAttribLocation(program, 0, "position");
+    glLinkProgram(program);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        std::array<char, 1024> log = {};
+        glGetProgramInfoLog(program, log.size(), nullptr, log.data());
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to link the conversion program:" << log.data();
+        glDeleteProgram(program);
+        return false;
+    }
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "frame"), 0);
+    glUseProgram(0);
+    conversion.scaleLocation = glGetUniformLocation(program, "scale");
+    conversion.coefficientsLocation = glGetUniformLocation(program, "coefficients");
+
+    // One triangle covering the whole viewport
+    constexpr std::array<GLfloat, 6> triangle = {-1, -1, 3, -1, -1, 3};
+    glGenVertexArrays(1, &conversion.vertexArray);
+    glBindVertexArray(conversion.vertexArray);
+    glGenBuffers(1, &conversion.vertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, conversion.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(triangle), triangle.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    glGenTextures(conversion.textures.size(), conversion.textures.data());
+    glGenFramebuffers(conversion.framebuffers.size(), conversion.framebuffers.data());
+
+    conversion.program = program;
+    conversion.failed = false;
+    return true;
+}
+
+bool DmaBufHandler::convertFrame(quint32 texture, const QSize &size, DownloadFormat format, const QRect &area)
+{
+    if (!setupConversion()) {
+        return false;
+    }
+    auto &conversion = d->conversion;
+    const auto planes = downloadPlanes(format, size);
+
+    if (conversion.size != size) {
+        for (int i = 0; i < planes.size(); ++i) {
+            glBindTexture(GL_TEXTURE_2D, conversion.textures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, planes[i].size.width(), planes[i].size.height(), 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+            glBindFramebuffer(GL_FRAMEBUFFER, conversion.framebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, conversion.textures[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                qCWarning(PIPEWIREDMABUF_LOGGING) << "Cannot render to a plane of" << size;
+                return false;
+            }
+        }
+        conversion.size = size;
+    }
+
+    // BT.601, Y = Kr * R + Kg * G + Kb * B, U and V are the scaled differences of B and R to it
+    constexpr GLfloat kr = 0.299;
+    constexpr GLfloat kb = 0.114;
+    constexpr GLfloat kg = 1 - kr - kb;
+    const bool full = format == DownloadFormat::YUV420PFull;
+    const GLfloat lumaScale = full ? 1 : 219.0 / 255;
+    const GLfloat lumaOffset = full ? 0 : 16.0 / 255;
+    const GLfloat chromaScale = full ? 1 : 224.0 / 255;
+    constexpr GLfloat chromaOffset = 128.0 / 255;
+    const GLfloat coefficients[3][4] = {
+        {kr * lumaScale, kg * lumaScale, kb * lumaScale, lumaOffset},
+        {-kr / (2 * (1 - kb)) * chromaScale, -kg / (2 * (1 - kb)) * chromaScale, 0.5f * chromaScale, chromaOffset},
+        {0.5f * chromaScale, -kg / (2 * (1 - kr)) * chromaScale, -kb / (2 * (1 - kr)) * chromaScale, chromaOffset},
+    };
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    glUseProgram(conversion.program);
+    glBindVertexArray(conversion.vertexArray);
+    // Only what is going to be read back needs converting
+    glEnable(GL_SCISSOR_TEST);
+    for (int i = 0; i < planes.size(); ++i) {
+        const QRect rect = planeRect(area, i);
+        const GLfloat step = i == 0 ? 1 : 2;
+        glBindFramebuffer(GL_FRAMEBUFFER, conversion.framebuffers[i]);
+        glViewport(0, 0, planes[i].size.width(), planes[i].size.height());
+        glScissor(rect.x(), rect.y(), rect.width(), rect.height());
+        glUniform2f(conversion.scaleLocation, step / size.width(), step / size.height());
+        glUniform4fv(conversion.coefficientsLocation, 1, coefficients[i]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glDisable(GL_SCISSOR_TEST);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    return true;
+}
 
-    glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, image);
-    glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
-
-    auto releaseResources = qScopeGuard([&]() {
-        glDeleteFramebuffers(1, &fbo);
-        glDeleteTextures(1, &texture);
-        eglDestroyImageKHR(d->egl.display, image);
-    });
+bool DmaBufHandler::readFrame(const PipeWireFrame &frame, quint32 glFormat, int bytesPerPixel, const QRegion &region, uchar *destination, DownloadFormat format)
+{
+    const QSize size = {frame.dmabuf->width, frame.dmabuf->height};
+    setupEgl();
+    if (!d->eglInitialized) {
+        return false;
+    }
 
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    if (!eglMakeCurrent(d->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, d->egl.context)) {
+        qCWarning(PIPEWIREDMABUF_LOGGING) << "Failed to make context current" << GLHelpers::formatEGLError(eglGetError());
         return false;
     }
+    const auto imported = d->importBuffer(frame);
+    if (!imported) {
+        return false;
+    }
+    const GLuint texture = imported->texture;
 
-    glReadPixels(0, 0, frame.dmabuf->width, frame.dmabuf->height, closestGLType(qimage), GL_UNSIGNED_BYTE, qimage.bits());
+    if (region.isEmpty()) {
+        return true;
+    }
+
+    // Every read back waits for the GPU, past a handful of rectangles one big one is faster
+    constexpr int maxRects = 8;
+    const auto rects = region.rectCount() > maxRects ? QRegion(region.boundingRect()) : region;
+
+    if (format != DownloadFormat::RGBA) {
+        if (!convertFrame(texture, size, format, rects.boundingRect())) {
+            return false;
+        }
+        // The planes follow each other in the destination, packed
+        const auto planes = downloadPlanes(format, size);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        for (int i = 0; i < planes.size(); ++i) {
+            const auto &plane = planes[i];
+            glBindFramebuffer(GL_FRAMEBUFFER, d->conversion.framebuffers[i]);
+            glPixelStorei(GL_PACK_ROW_LENGTH, plane.size.width());
+            for (const QRect &frameRect : rects) {
+                const QRect rect = planeRect(frameRect, i);
+                glReadPixels(rect.x(),
+                             rect.y(),
+                             rect.width(),
+                             rect.height(),
+                             GL_RED,
+                             GL_UNSIGNED_BYTE,
+                             destination + plane.offset + rect.y() * qsizetype(plane.size.width()) + rect.x());
+            }
+        }
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        return true;
+    }
+
+    // Rows are packed to 4 bytes, like in a QImage
+    const qsizetype stride = (qsizetype(size.width()) * bytesPerPixel + 3) & ~qsizetype(3);
+    glPixelStorei(GL_PACK_ROW_LENGTH, size.width());
+    for (const QRect &rect : rects) {
+        glReadPixels(rect.x(), rect.y(), rect.width(), rect.height(), glFormat, GL_UNSIGNED_BYTE, destination + rect.y() * stride + rect.x() * bytesPerPixel);
+    }
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
     return true;
 }
@@ -10,6 +10,7 @@
 #include "kpipewiredmabuf_export.h"
 #include "pipewiresourcestream.h"
 #include <QImage>
+#include <QRegion>
 #include <memory>
 
 struct DmaBufHandlerPrivate;
@@ -21,9 +22,98 @@ public:
     ~DmaBufHandler();
 
     bool downloadFrame(QImage &image, const PipeWireFrame &frame);
+    /**
+     * Download only the parts of @p frame within @p damage into @p image.
+     *
+     * The rest of @p image is left untouched, so it should hold the frame
+     * @p damage is relative to. Rows of @p image must be packed to 4 bytes.
+     */
+    bool downloadFrame(QImage &image, const PipeWireFrame &frame, const QRegion &damage);
+
+    /**
+     * How many downloads can be queued at the same time.
+     */
+    static constexpr int DownloadRingSize = 3;
+
+    /**
+     * What queued downloads are read back as.
+     */
+    enum class DownloadFormat {
+        RGBA, ///< The frame as it is, 4 bytes per pixel in one plane
+        /// Converted on the GPU to 8 bit YUV 4:2:0 in three planes, with the
+        /// BT.601 coefficients swscale converts RGB with, in limited range
+        YUV420PLimited,
+        YUV420PFull, ///< Like YUV420PLimited, in full range
+    };
+
+    /**
+     * Whether frames can be downloaded as @p format.
+     *
+     * Sets up EGL as needed, call it from the thread frames are downloaded on.
+     */
+    bool supportsDownloadFormat(DownloadFormat format);
+
+    /**
+     * Start downloading the parts of @p frame within @p damage, without waiting for the GPU.
+     *
+     * The frame is read back into a ring of pixel buffer objects while the
+     * caller goes on, take the downloads with takeDownload() in the order they
+     * were queued. There must be less than DownloadRingSize downloads queued.
+     * The DMA-BUF must not be written to until the download is taken, keep its
+     * buffer from going back to the compositor, see PipeWireSourceStream::holdCurrentBuffer().
+     *
+     * YUV formats read back half the bytes RGBA does. Their damage is widened
+     * to even coordinates, so that it covers whole chroma samples.
+     *
+     * @return false if the frame cannot be read, nothing is queued then.
+     */
+    bool queueDownload(const PipeWireFrame &frame, const QRegion &damage, DownloadFormat format = DownloadFormat::RGBA);
+    int queuedDownloads() const;
+    /**
+     * Whether the oldest queued download arrived, never waits for the GPU.
+     */
+    bool isDownloadReady() const;
+    /**
+     * Take the oldest queued download and copy it into @p image, waiting for the GPU if needed.
+     *
+     * Like with downloadFrame(), only the damaged parts of @p image are written
+     * to. It must have the size of the frame and 4 bytes per pixel, or be null
+     * to drop the download.
+     *
+     * @return false if reading back failed, the download is dropped anyway.
+     */
+    bool takeDownload(QImage &image);
+    /**
+     * Like takeDownload(QImage &), for downloads in any format.
+     *
+     * @p planes and @p strides have an entry for every plane of the format the
+     * download was queued with, the planes are the size of the frame's.
+     * @p planes is null to drop the download.
+     */
+    bool takeDownload(uchar *const *planes, const int *strides);
+
+    /**
+     * Drop the imports of the buffers frames were read from so far.
+     *
+     * Imports are kept to read later frames from the same buffers, call this
+     * when the stream's buffers are removed or renegotiated so they don't keep
+     * the memory of buffers that are gone.
+     */
+    void forgetBuffers();
 
 private:
     void setupEgl();
+    // Compile what converts frames to YUV, once
+    bool setupConversion();
+    // Render the planes of @p format from @p texture into the conversion's framebuffers
+    bool convertFrame(quint32 texture, const QSize &size, DownloadFormat format, const QRect &area);
+    // For YUV formats @p glFormat and @p bytesPerPixel are ignored, every plane is read as bytes
+    bool readFrame(const PipeWireFrame &frame,
+                   quint32 glFormat,
+                   int bytesPerPixel,
+                   const QRegion &region,
+                   uchar *destination,
+                   DownloadFormat format = DownloadFormat::RGBA);
     std::unique_ptr<DmaBufHandlerPrivate> d;
 };
 
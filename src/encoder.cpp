@@ -8,6 +8,7 @@
 
 #include "encoder_p.h"
 
+#include <limits>
 #include <mutex>
 
 extern "C" {
@@ -23,7 +24,9 @@ extern "C" {
 
 #include <libdrm/drm_fourcc.h>
 
+#include "pwhelpers.h"
 #include "vaapiutils_p.h"
+#include "yuvconversion_p.h"
 
 #include "logging_record.h"
 
@@ -35,26 +38,49 @@ char *av_err2str(int errnum)
     return av_make_error_string(str, AV_ERROR_MAX_STRING_SIZE, errnum);
 }
 
-static AVPixelFormat convertQImageFormatToAVPixelFormat(QImage::Format format)
+static AVPixelFormat convertSpaFormatToAVPixelFormat(spa_video_format format)
 {
-    // Listing those handed by SpaToQImageFormat
+    // SPA formats are named after their byte order in memory, like libav's
     switch (format) {
-    case QImage::Format_RGB888:
+    case SPA_VIDEO_FORMAT_BGRx:
+        return AV_PIX_FMT_BGR0;
+    case SPA_VIDEO_FORMAT_BGRA:
+        return AV_PIX_FMT_BGRA;
+    case SPA_VIDEO_FORMAT_xBGR:
+        return AV_PIX_FMT_0BGR;
+    case SPA_VIDEO_FORMAT_ABGR:
+        return AV_PIX_FMT_ABGR;
+    case SPA_VIDEO_FORMAT_RGBx:
+        return AV_PIX_FMT_RGB0;
+    case SPA_VIDEO_FORMAT_RGBA:
+        return AV_PIX_FMT_RGBA;
+    case SPA_VIDEO_FORMAT_xRGB:
+        return AV_PIX_FMT_0RGB;
+    case SPA_VIDEO_FORMAT_ARGB:
+        return AV_PIX_FMT_ARGB;
+    case SPA_VIDEO_FORMAT_RGB:
         return AV_PIX_FMT_RGB24;
-    case QImage::Format_BGR888:
+    case SPA_VIDEO_FORMAT_BGR:
         return AV_PIX_FMT_BGR24;
-    case QImage::Format_RGBX8888:
-    case QImage::Format_RGBA8888_Premultiplied:
-        return AV_PIX_FMT_RGBA;
-    case QImage::Format_RGB32:
-    case QImage::Format_ARGB32:
-        return AV_PIX_FMT_RGB32;
+    case SPA_VIDEO_FORMAT_GRAY8:
+        return AV_PIX_FMT_GRAY8;
+    case SPA_VIDEO_FORMAT_I420:
+        return AV_PIX_FMT_YUV420P;
+    case SPA_VIDEO_FORMAT_NV12:
+        return AV_PIX_FMT_NV12;
+    case SPA_VIDEO_FORMAT_YUY2:
+        return AV_PIX_FMT_YUYV422;
     default:
-        qDebug() << "Unexpected pixel format" << format;
-        return AV_PIX_FMT_RGB32;
+        return AV_PIX_FMT_NONE;
     }
 }
 
+static void releaseFrameCleanup(void *opaque, std::uint8_t *data)
+{
+    Q_UNUSED(data)
+    PipeWireFrameCleanupFunction::unref(opaque);
+}
+
 static int percentageToFrameQuality(quint8 quality)
 {
     return std::max(1, int(FF_LAMBDA_MAX - (quality / 100.0) * FF_LAMBDA_MAX));
@@ -63,11 +89,21 @@ static int percentageToFrameQuality(quint8 quality)
 Encoder::Encoder(PipeWireProduce *produce)
     : QObject(nullptr)
     , m_produce(produce)
+    , m_inputFrame(av_frame_alloc())
+    , m_filteredFrame(av_frame_alloc())
+    , m_packet(av_packet_alloc())
 {
+    if (!m_inputFrame || !m_filteredFrame || !m_packet) {
+        qFatal("Failed to allocate memory");
+    }
 }
 
 Encoder::~Encoder()
 {
+    av_frame_free(&m_inputFrame);
+    av_frame_free(&m_filteredFrame);
+    av_packet_free(&m_packet);
+
     if (m_avFilterGraph) {
         avfilter_graph_free(&m_avFilterGraph);
     }
@@ -79,54 +115,70 @@ Encoder::~Encoder()
 
 std::pair<int, int> Encoder::encodeFrame(int maximumFrames)
 {
-    auto frame = av_frame_alloc();
-    if (!frame) {
-        qFatal("Failed to allocate memory");
-    }
+    auto frame = m_filteredFrame;
 
     int filtered = 0;
     int queued = 0;
 
     for (;;) {
+        // Filters run when their output is asked for, so this is where a frame is converted
+        const auto filterStart = std::chrono::steady_clock::now();
         if (auto result = av_buffersink_get_frame(m_outputFilter, frame); result < 0) {
             if (result != AVERROR_EOF && result != AVERROR(EAGAIN)) {
                 qCWarning(PIPEWIRERECORD_LOGGING) << "Failed receiving filtered frame:" << av_err2str(result);
             }
             break;
         }
+        const auto filterTime = std::chrono::steady_clock::now() - filterStart;
 
         filtered++;
 
-        if (queued + 1 < maximumFrames) {
+        // Frames are only let in to the filter graph while the encoder has room
+        // for them, see PipeWireProduce::processFrame(), so this is a safety net
+        if (queued < maximumFrames) {
+            const bool forceKeyFrame = m_produce->m_keyFrameRequested.exchange(false);
+            if (forceKeyFrame) {
+                // All of our encoders turn a frame forced to I into a key frame,
+                // libx264 needs forced-idr for it to be an IDR frame as well
+                frame->pict_type = AV_PICTURE_TYPE_I;
+                frame->flags |= AV_FRAME_FLAG_KEY;
+            }
+            const auto pts = frame->pts;
             auto ret = -1;
             {
                 std::lock_guard guard(m_avCodecMutex);
+                const auto start = std::chrono::steady_clock::now();
                 ret = avcodec_send_frame(m_avCodecContext, frame);
+                m_produce->m_statistics.codecBusy(std::chrono::steady_clock::now() - start);
             }
             if (ret < 0) {
                 if (ret != AVERROR_EOF && ret != AVERROR(EAGAIN)) {
                     qCWarning(PIPEWIRERECORD_LOGGING) << "Error sending a frame for encoding:" << av_err2str(ret);
                 }
+                if (forceKeyFrame) {
+                    // Leave the request for the next frame that makes it in
+                    m_produce->m_keyFrameRequested = true;
+                }
+                m_produce->m_statistics.frameFiltered(pts, false, filterTime);
                 break;
             }
+            m_produce->m_statistics.frameFiltered(pts, true, filterTime);
             queued++;
         } else {
             qCWarning(PIPEWIRERECORD_LOGGING) << "Encode queue is full, discarding filtered frame" << frame->pts;
+            m_produce->m_statistics.frameFiltered(frame->pts, false, filterTime);
         }
         av_frame_unref(frame);
     }
 
-    av_frame_free(&frame);
+    av_frame_unref(frame);
 
     return std::make_pair(filtered, queued);
 }
 
 int Encoder::receivePacket()
 {
-    auto packet = av_packet_alloc();
-    if (!packet) {
-        qFatal("Failed to allocate memory");
-    }
+    auto packet = m_packet;
 
     int received = 0;
 
@@ -134,7 +186,9 @@ int Encoder::receivePacket()
         auto ret = -1;
         {
             std::lock_guard guard(m_avCodecMutex);
+            const auto start = std::chrono::steady_clock::now();
             ret = avcodec_receive_packet(m_avCodecContext, packet);
+            m_produce->m_statistics.codecBusy(std::chrono::steady_clock::now() - start);
         }
         if (ret < 0) {
             if (ret != AVERROR_EOF && ret != AVERROR(EAGAIN)) {
@@ -146,12 +200,11 @@ int Encoder::receivePacket()
 
         received++;
 
+        m_produce->m_statistics.packetReceived(packet->pts, packet->size);
         m_produce->processPacket(packet);
         av_packet_unref(packet);
     }
 
-    av_packet_free(&packet);
-
     return received;
 }
 
@@ -161,6 +214,10 @@ void Encoder::finish()
     avcodec_send_frame(m_avCodecContext, nullptr);
 }
 
+void Encoder::forgetBuffers()
+{
+}
+
 AVCodecContext *Encoder::avCodecContext() const
 {
     return m_avCodecContext;
@@ -176,6 +233,66 @@ void Encoder::setQuality(std::optional<quint8> quality)
     m_quality = quality;
 }
 
+bool Encoder::setRuntimeQuality(quint8 quality)
+{
+    Q_UNUSED(quality);
+    return false;
+}
+
+void Encoder::setRateControl(const RateControl &rateControl)
+{
+    m_rateControl = rateControl;
+}
+
+bool Encoder::setRuntimeRateControl(const RateControl &rateControl)
+{
+    Q_UNUSED(rateControl);
+    return false;
+}
+
+void Encoder::applyFrameTiming()
+{
+    m_avCodecContext->time_base = FrameTimeBase;
+
+    const auto framerate = m_produce->maxFramerate();
+    if (framerate.numerator > 0 && framerate.denominator > 0) {
+        m_avCodecContext->framerate = AVRational{int(framerate.numerator), int(framerate.denominator)};
+    }
+}
+
+bool Encoder::applyRateControl()
+{
+    if (!m_rateControl.targetBitrate) {
+        return false;
+    }
+
+    const auto target = *m_rateControl.targetBitrate;
+    m_avCodecContext->bit_rate = target;
+    m_avCodecContext->rc_min_rate = 0;
+    m_avCodecContext->rc_max_rate = 0;
+    m_avCodecContext->rc_buffer_size = 0;
+
+    if (m_rateControl.maxBitrate) {
+        const auto maximum = std::max(target, *m_rateControl.maxBitrate);
+        m_avCodecContext->rc_max_rate = maximum;
+        // The peak can only be enforced with a buffer, default to one second of it
+        m_avCodecContext->rc_buffer_size = std::min<qint64>(m_rateControl.bufferSize.value_or(maximum), std::numeric_limits<int>::max());
+        if (isConstantBitrate()) {
+            // libvpx and VA-API pick constant bitrate when all of them match
+            m_avCodecContext->rc_min_rate = target;
+        }
+    } else if (m_rateControl.bufferSize) {
+        m_avCodecContext->rc_buffer_size = std::min<qint64>(*m_rateControl.bufferSize, std::numeric_limits<int>::max());
+    }
+
+    return true;
+}
+
+bool Encoder::isConstantBitrate() const
+{
+    return m_rateControl.targetBitrate && m_rateControl.maxBitrate && *m_rateControl.maxBitrate <= *m_rateControl.targetBitrate;
+}
+
 bool Encoder::supportsHardwareEncoding()
 {
     return !VaapiUtils::instance()->devicePath().isEmpty();
@@ -191,6 +308,11 @@ void Encoder::setColorRange(PipeWireBaseEncodedStream::ColorRange colorRange)
     m_colorRange = colorRange;
 }
 
+void Encoder::setConversionThreads(int threads)
+{
+    m_conversionThreads = threads;
+}
+
 AVDictionary *Encoder::buildEncodingOptions()
 {
     AVDictionary *options = NULL;
@@ -210,63 +332,216 @@ void Encoder::maybeLogOptions(AVDictionary *options)
     }
 }
 
+QSize Encoder::sourceSize(const QSize &encodeSize) const
+{
+    const auto stream = m_produce->sourceStream();
+    return stream ? stream->size() : encodeSize;
+}
+
 SoftwareEncoder::SoftwareEncoder(PipeWireProduce *produce)
     : Encoder(produce)
 {
+    // Picks up frames being read back when no new frame comes to do it
+    m_downloadTimer.setSingleShot(true);
+    m_downloadTimer.setTimerType(Qt::PreciseTimer);
+    m_downloadTimer.setInterval(2);
+    connect(&m_downloadTimer, &QTimer::timeout, this, [this] {
+        takeDownloads(false);
+    });
 }
 
 bool SoftwareEncoder::filterFrame(const PipeWireFrame &frame)
 {
-    auto size = m_produce->m_stream->size();
+    // Pass on what was read back in the meantime. Frames that are not read
+    // back wait for the ones that are, to keep their order.
+    takeDownloads(frame.dataFrame || !frame.dmabuf);
+
+    auto size = m_produce->sourceStream()->size();
 
-    QImage image;
-    if (frame.dmabuf) {
-        image = QImage(m_produce->m_stream->size(), QImage::Format_RGBA8888_Premultiplied);
-        if (!m_dmaBufHandler.downloadFrame(image, frame)) {
-            m_produce->m_stream->renegotiateModifierFailed(frame.format, frame.dmabuf->modifier);
+    AVFrame *avFrame = m_inputFrame;
+    avFrame->width = size.width();
+    avFrame->height = size.height();
+
+    // A DMA-BUF may have been downloaded already to be shared between simulcast layers
+    if (frame.dataFrame && m_convertFrames && YuvConversion::supports(frame.dataFrame->format)) {
+        convertFrame(avFrame, static_cast<const uint8_t *>(frame.dataFrame->data), frame.dataFrame->stride, frame.dataFrame->format, size);
+    } else if (frame.dataFrame) {
+        // libav can take the frame's pixels as they are, without going through a QImage
+        const auto format = convertSpaFormatToAVPixelFormat(frame.dataFrame->format);
+        if (format == AV_PIX_FMT_NONE) {
+            qCWarning(PIPEWIRERECORD_LOGGING) << "Unsupported frame format" << frame.dataFrame->format;
+            av_frame_unref(avFrame);
             return false;
         }
-    } else if (frame.dataFrame) {
-        image = frame.dataFrame->toImage();
+        avFrame->format = format;
+
+        const std::uint8_t *buffers[4] = {};
+        int strides[4] = {};
+        const auto planes = frame.dataFrame->planes();
+        for (int i = 0; i < std::min<int>(planes.size(), 4); ++i) {
+            buffers[i] = static_cast<const std::uint8_t *>(planes[i].data);
+            strides[i] = planes[i].stride;
+        }
+
+        // Let libav read the pixels in place where we can make sure they stay around for as long as it needs them
+        if (auto cleanup = frame.dataFrame->cleanup; cleanup && frame.dataFrame->outlivesBuffer()) {
+            cleanup->ref();
+            avFrame->buf[0] = av_buffer_create(const_cast<std::uint8_t *>(buffers[0]),
+                                               strides[0] * size.height(),
+                                               &releaseFrameCleanup,
+                                               cleanup,
+                                               AV_BUFFER_FLAG_READONLY);
+            if (!avFrame->buf[0]) {
+                PipeWireFrameCleanupFunction::unref(cleanup);
+            }
+        }
+
+        if (avFrame->buf[0]) {
+            for (int i = 0; i < 4; ++i) {
+                avFrame->data[i] = const_cast<std::uint8_t *>(buffers[i]);
+                avFrame->linesize[i] = strides[i];
+            }
+            m_produce->m_wrappedFrames++;
+        } else {
+            if (!m_framePool.allocateVideo(avFrame)) {
+                qFatal("Failed to allocate memory");
+            }
+            av_image_copy(avFrame->data, avFrame->linesize, buffers, strides, format, size.width(), size.height());
+            m_produce->m_copiedFrames++;
+        }
+    } else if (frame.dmabuf) {
+        // Read back without waiting for the GPU, so the frame before is on its
+        // way while this one is imported. Frames go on to libav once they
+        // arrived, in takeDownloads().
+        if (m_download.isFull()) {
+            takeDownload();
+        }
+        // The damage is relative to the last frame passed to us, see PipeWireProduce::processFrame()
+        if (!m_download.queue(frame, frame.damage)) {
+            m_produce->sourceStream()->renegotiateModifierFailed(frame.format, frame.dmabuf->modifier);
+            return false;
+        }
+        m_downloadTimestamps.push_back(frame.presentationTimestamp ? m_produce->framePts(frame.presentationTimestamp) : AV_NOPTS_VALUE);
+        // The GPU reads the DMA-BUF after we return, the compositor must not render into it meanwhile
+        m_downloadBuffers.push_back(m_produce->sourceStream()->holdCurrentBuffer());
+        m_downloadTimer.start();
+        return true;
     } else {
+        av_frame_unref(avFrame);
         return false;
     }
 
-    AVFrame *avFrame = av_frame_alloc();
-    if (!avFrame) {
-        qFatal("Failed to allocate memory");
-    }
-    avFrame->format = convertQImageFormatToAVPixelFormat(image.format());
-    avFrame->width = size.width();
-    avFrame->height = size.height();
+    submitFrame(avFrame, frame.presentationTimestamp ? m_produce->framePts(frame.presentationTimestamp) : AV_NOPTS_VALUE);
+    return true;
+}
+
+void SoftwareEncoder::submitFrame(AVFrame *avFrame, int64_t pts)
+{
     if (m_quality) {
         avFrame->quality = percentageToFrameQuality(m_quality.value());
     }
 
-    av_frame_get_buffer(avFrame, 32);
-
-    const std::uint8_t *buffers[] = {image.constBits(), nullptr};
-    const int strides[] = {static_cast<int>(image.bytesPerLine()), 0, 0, 0};
-
-    av_image_copy(avFrame->data, avFrame->linesize, buffers, strides, static_cast<AVPixelFormat>(avFrame->format), size.width(), size.height());
-
-    if (frame.presentationTimestamp) {
-        avFrame->pts = m_produce->framePts(frame.presentationTimestamp);
+    if (pts != AV_NOPTS_VALUE) {
+        avFrame->pts = pts;
     }
 
     if (auto result = av_buffersrc_add_frame(m_inputFilter, avFrame); result < 0) {
         qCWarning(PIPEWIRERECORD_LOGGING) << "Failed to submit frame for filtering";
     }
+    // The filter graph took over the frame's buffers, leave the shell blank for the next one
+    av_frame_unref(avFrame);
+}
+
+void SoftwareEncoder::forgetBuffers()
+{
+    m_download.forgetBuffers();
+}
 
+bool SoftwareEncoder::takeDownload()
+{
+    const auto pts = m_downloadTimestamps.front();
+    m_downloadTimestamps.pop_front();
+    // Given back once the download arrived, at the end of this
+    const auto buffer = std::move(m_downloadBuffers.front());
+    m_downloadBuffers.pop_front();
+
+    AVFrame *avFrame = m_inputFrame;
+    av_frame_unref(avFrame);
+    if (!m_download.take(avFrame)) {
+        // It was counted when it was queued
+        m_produce->m_pendingFilterFrames--;
+        m_produce->m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::FilterFailed);
+        return false;
+    }
+
+    // Read back as RGBA when the GPU cannot convert it. The download stays
+    // around in m_download, which builds the next one on it.
+    if (m_convertFrames && avFrame->format == AV_PIX_FMT_RGBA) {
+        const uint8_t *data = avFrame->data[0];
+        const int stride = avFrame->linesize[0];
+        const QSize size(avFrame->width, avFrame->height);
+        av_frame_unref(avFrame);
+        convertFrame(avFrame, data, stride, SPA_VIDEO_FORMAT_RGBA, size);
+    }
+    submitFrame(avFrame, pts);
     return true;
 }
 
+void SoftwareEncoder::takeDownloads(bool wait)
+{
+    bool submitted = false;
+    while (m_download.queued() > 0 && (wait || m_download.isReady())) {
+        submitted = takeDownload() || submitted;
+    }
+
+    if (submitted) {
+        m_produce->m_passthroughSignal.notify();
+    }
+    if (m_download.queued() > 0) {
+        m_downloadTimer.start();
+    } else {
+        m_downloadTimer.stop();
+    }
+}
+
+int SoftwareEncoder::filterThreads(const QSize &size) const
+{
+    if (m_conversionThreads > 0) {
+        return m_conversionThreads;
+    }
+    // Slices of about a megapixel each, leaving at least half of the cores to the codec
+    const qint64 megapixels = (qint64(size.width()) * size.height() + 999'999) / 1'000'000;
+    return int(std::clamp<qint64>(megapixels, 1, std::max(1, QThread::idealThreadCount() / 2)));
+}
+
+void SoftwareEncoder::convertFrame(AVFrame *avFrame, const uint8_t *data, qint32 stride, spa_video_format format, const QSize &size)
+{
+    const bool fullRange = *m_yuvColorRange == PipeWireBaseEncodedStream::ColorRange::Full;
+    avFrame->format = AV_PIX_FMT_YUV420P;
+    avFrame->color_range = fullRange ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+    avFrame->width = size.width();
+    avFrame->height = size.height();
+    if (!m_framePool.allocateVideo(avFrame)) {
+        qFatal("Failed to allocate memory");
+    }
+    YuvConversion::convert(data, stride, format, size, fullRange, avFrame->data, avFrame->linesize);
+    m_produce->m_convertedFrames++;
+}
+
 bool SoftwareEncoder::createFilterGraph(const QSize &size)
 {
     m_avFilterGraph = avfilter_graph_alloc();
     if (!m_avFilterGraph) {
         qFatal("Failed to allocate memory");
     }
+    // Filters take on the graph's threads when they are added. A graph that
+    // gets YUV420P frames has nothing to convert, the threads would only idle.
+    const auto stream = m_produce->sourceStream();
+    const auto inputSize = sourceSize(size);
+    m_convertFrames = m_yuvColorRange && stream && inputSize == size && (stream->usingDmaBuf() || YuvConversion::supports(stream->format()));
+    m_avFilterGraph->thread_type = AVFILTER_THREAD_SLICE;
+    m_avFilterGraph->nb_threads = m_convertFrames ? 1 : filterThreads(inputSize);
+    qCDebug(PIPEWIRERECORD_LOGGING) << "Filtering with" << m_avFilterGraph->nb_threads << "threads";
 
     int ret = avfilter_graph_create_filter(&m_inputFilter,
                                            avfilter_get_by_name("buffer"),
@@ -284,10 +559,34 @@ bool SoftwareEncoder::createFilterGraph(const QSize &size)
         qFatal("Failed to allocate memory");
     }
 
-    parameters->format = AV_PIX_FMT_RGBA;
-    parameters->width = size.width();
-    parameters->height = size.height();
-    parameters->time_base = {1, 1000};
+    // Frames in memory are passed on in the negotiated format, DMA-BUFs are downloaded as RGBA
+    const auto streamFormat = stream && !stream->usingDmaBuf() ? convertSpaFormatToAVPixelFormat(stream->format()) : AV_PIX_FMT_NONE;
+    parameters->format = streamFormat != AV_PIX_FMT_NONE ? streamFormat : AV_PIX_FMT_RGBA;
+
+    // or converted on the GPU, which reads back half as much and leaves the
+    // filter graph nothing to convert. Simulcast layers share an RGBA download
+    // of every frame instead, see PipeWireProduce::shareFrame().
+    const bool sharedDownloads = m_produce->m_source || !m_produce->m_layerSettings.isEmpty();
+    if (stream && stream->usingDmaBuf() && m_yuvColorRange && !sharedDownloads) {
+        const auto range = *m_yuvColorRange == PipeWireBaseEncodedStream::ColorRange::Full ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+        if (m_download.setFormat(AV_PIX_FMT_YUV420P, range)) {
+            // The frames carry their range for the scale filter
+            parameters->format = AV_PIX_FMT_YUV420P;
+        } else {
+            qCDebug(PIPEWIRERECORD_LOGGING) << "Cannot convert frames on the GPU, reading them back as RGBA";
+        }
+    }
+
+    // RGB frames in memory and RGBA downloads are converted by YuvConversion,
+    // which leaves the filter graph nothing to convert either. Frames that get
+    // scaled still go through swscale, which converts them in the same pass.
+    if (m_convertFrames) {
+        qCDebug(PIPEWIRERECORD_LOGGING) << "Converting frames to YUV420P with" << YuvConversion::implementation();
+        parameters->format = AV_PIX_FMT_YUV420P;
+    }
+    parameters->width = inputSize.width();
+    parameters->height = inputSize.height();
+    parameters->time_base = FrameTimeBase;
 
     av_buffersrc_parameters_set(m_inputFilter, parameters);
     av_free(parameters);
@@ -317,7 +616,13 @@ bool SoftwareEncoder::createFilterGraph(const QSize &size)
     outputs->pad_idx = 0;
     outputs->next = nullptr;
 
-    ret = avfilter_graph_parse(m_avFilterGraph, m_filterGraphToParse.toUtf8().data(), outputs, inputs, NULL);
+    // Scaling first lets swscale convert the format in the same pass
+    auto filterGraph = m_filterGraphToParse;
+    if (inputSize != size) {
+        filterGraph.prepend(QStringLiteral("scale=%1:%2,").arg(size.width()).arg(size.height()));
+    }
+
+    ret = avfilter_graph_parse(m_avFilterGraph, filterGraph.toUtf8().data(), outputs, inputs, NULL);
     if (ret < 0) {
         qCWarning(PIPEWIRERECORD_LOGGING) << "Failed creating filter graph";
         return false;
@@ -351,7 +656,7 @@ HardwareEncoder::~HardwareEncoder()
 void HardwareEncoder::setQuality(std::optional<quint8> quality)
 {
     Encoder::setQuality(quality);
-    if (m_avCodecContext) {
+    if (m_avCodecContext && !m_rateControl.targetBitrate) {
         // For now we assume all hardware encoders are FFmpeg VA-API encoders.
         m_avCodecContext->global_quality = percentageToAbsoluteQuality(quality);
     }
@@ -365,10 +670,7 @@ bool HardwareEncoder::filterFrame(const PipeWireFrame &frame)
 
     auto attribs = frame.dmabuf.value();
 
-    auto drmFrame = av_frame_alloc();
-    if (!drmFrame) {
-        qFatal("Failed to allocate memory");
-    }
+    auto drmFrame = m_inputFrame;
     drmFrame->format = AV_PIX_FMT_DRM_PRIME;
     drmFrame->width = attribs.width;
     drmFrame->height = attribs.height;
@@ -376,7 +678,10 @@ bool HardwareEncoder::filterFrame(const PipeWireFrame &frame)
         drmFrame->quality = percentageToFrameQuality(m_quality.value());
     }
 
-    AVDRMFrameDescriptor *frameDesc = (AVDRMFrameDescriptor *)av_mallocz(sizeof(AVDRMFrameDescriptor));
+    if (!m_framePool.allocateZeroed(drmFrame, sizeof(AVDRMFrameDescriptor))) {
+        qFatal("Failed to allocate memory");
+    }
+    auto frameDesc = reinterpret_cast<AVDRMFrameDescriptor *>(drmFrame->buf[0]->data);
     frameDesc->nb_layers = 1;
     frameDesc->layers[0].nb_planes = attribs.planes.count();
     frameDesc->layers[0].format = attribs.format;
@@ -392,7 +697,6 @@ bool HardwareEncoder::filterFrame(const PipeWireFrame &frame)
     frameDesc->objects[0].size = attribs.width * attribs.height * 4;
 
     drmFrame->data[0] = reinterpret_cast<uint8_t *>(frameDesc);
-    drmFrame->buf[0] = av_buffer_create(reinterpret_cast<uint8_t *>(frameDesc), sizeof(*frameDesc), av_buffer_default_free, nullptr, 0);
     if (frame.presentationTimestamp) {
         drmFrame->pts = m_produce->framePts(frame.presentationTimestamp);
     }
@@ -403,7 +707,7 @@ bool HardwareEncoder::filterFrame(const PipeWireFrame &frame)
         return false;
     }
 
-    av_frame_free(&drmFrame);
+    av_frame_unref(drmFrame);
     return true;
 }
 
@@ -430,9 +734,9 @@ QByteArray HardwareEncoder::checkVaapi(const QSize &size)
     return utils->devicePath();
 }
 
-bool HardwareEncoder::createDrmContext(const QSize &size)
+bool HardwareEncoder::createDrmContext(const QSize &encodeSize)
 {
-    auto path = checkVaapi(size);
+    auto path = checkVaapi(encodeSize);
     if (path.isEmpty()) {
         return false;
     }
@@ -452,6 +756,7 @@ bool HardwareEncoder::createDrmContext(const QSize &size)
     auto framesContext = reinterpret_cast<AVHWFramesContext *>(m_drmFramesContext->data);
     framesContext->format = AV_PIX_FMT_DRM_PRIME;
     framesContext->sw_format = AV_PIX_FMT_0BGR;
+    const auto size = sourceSize(encodeSize);
     framesContext->width = size.width();
     framesContext->height = size.height();
 
@@ -8,11 +8,15 @@
 
 #pragma once
 
+#include <deque>
+#include <memory>
 #include <mutex>
 
 #include <QObject>
+#include <QTimer>
 
-#include "dmabufhandler.h"
+#include "framedownload_p.h"
+#include "framepool_p.h"
 #include "pipewireproduce_p.h"
 
 extern "C" {
@@ -24,6 +28,13 @@ extern "C" {
 // The one provided by libav fails to compile on GCC due to passing data from the function scope outside
 char *av_err2str(int errnum);
 
+/**
+ * The time base of the frame timestamps, from PipeWireProduce::framePts()
+ * through the filter graphs to the encoders. Fine enough to keep high refresh
+ * rate frames apart and in order.
+ */
+constexpr AVRational FrameTimeBase = {1, 1000000};
+
 struct PipeWireFrame;
 class PipeWireProduce;
 
@@ -83,6 +94,11 @@ public:
      * End encoding and perform any necessary cleanup.
      */
     virtual void finish();
+    /**
+     * The stream's buffers were removed or renegotiated, drop anything kept
+     * for them. Does nothing by default.
+     */
+    virtual void forgetBuffers();
 
     /**
      * Return the AVCodecContext for this encoder.
@@ -104,15 +120,67 @@ public:
      */
     virtual void setQuality(std::optional<quint8> quality);
 
+    /**
+     * Change the quality while encoding, for adaptive quality.
+     *
+     * Unlike setQuality() this applies to an encoder that is already initialized,
+     * starting with the next frame sent to it. Can be called from any thread.
+     *
+     * @return false if the encoder does not support it, the default.
+     */
+    virtual bool setRuntimeQuality(quint8 quality);
+
+    /**
+     * Set the bitrate based rate control to use, instead of the quality when
+     * it has a target bitrate.
+     *
+     * Like setQuality() this needs to be called before initialize().
+     */
+    void setRateControl(const RateControl &rateControl);
+
+    /**
+     * Change the rate control while encoding.
+     *
+     * Only the bitrates and buffer size can change, an encoder that started
+     * out with quality based rate control stays with it.
+     *
+     * @return false if the encoder does not support it, the default.
+     */
+    virtual bool setRuntimeRateControl(const RateControl &rateControl);
+
     static bool supportsHardwareEncoding();
 
     void setEncodingPreference(PipeWireBaseEncodedStream::EncodingPreference preference);
 
     void setColorRange(PipeWireBaseEncodedStream::ColorRange colorRange);
 
+    /**
+     * The threads of the filter graph, 0 for a count that suits the frame size.
+     */
+    void setConversionThreads(int threads);
+
 protected:
     virtual AVDictionary *buildEncodingOptions();
     void maybeLogOptions(AVDictionary *options);
+    /**
+     * Set the bitrate fields of the codec context from m_rateControl.
+     *
+     * @return true if bitrate based rate control is used, false if the quality should be used instead.
+     */
+    bool applyRateControl();
+    /**
+     * Set the time base of the codec context to FrameTimeBase, and its
+     * framerate to the maximum one, which encoders that can't tell it from
+     * the time base use for rate control.
+     */
+    void applyFrameTiming();
+    // Whether the target and maximum bitrate are the same
+    bool isConstantBitrate() const;
+    /**
+     * The size of the frames coming in, which is larger than the size passed
+     * to initialize() for a downscaled simulcast layer.
+     */
+    QSize sourceSize(const QSize &encodeSize) const;
 
     PipeWireProduce *m_produce;
 
@@ -123,9 +191,20 @@ protected:
     AVFilterContext *m_inputFilter = nullptr;
     AVFilterContext *m_outputFilter = nullptr;
 
+    // Reused for every frame, each of them is only touched by the thread
+    // running the method it belongs to: filterFrame(), encodeFrame() and
+    // receivePacket() respectively.
+    AVFrame *m_inputFrame = nullptr;
+    AVFrame *m_filteredFrame = nullptr;
+    AVPacket *m_packet = nullptr;
+    // Data buffers for the frames passed to filterFrame()
+    FramePool m_framePool;
+
     std::optional<quint8> m_quality;
+    RateControl m_rateControl;
     PipeWireBaseEncodedStream::EncodingPreference m_encodingPreference;
     PipeWireBaseEncodedStream::ColorRange m_colorRange = PipeWireBaseEncodedStream::ColorRange::Limited;
+    int m_conversionThreads = 0;
 };
 
 /**
@@ -137,10 +216,12 @@ public:
     SoftwareEncoder(PipeWireProduce *produce);
 
     bool filterFrame(const PipeWireFrame &frame) override;
+    void forgetBuffers() override;
 
 protected:
     /**
-     * Create a default filter graph that converts from RGBA to YUV420P.
+     * Create a default filter graph that converts from RGBA, or the YUV format
+     * negotiated by the stream, to YUV420P.
      *
      * @param size The size of the stream to encode.
      */
@@ -155,7 +236,37 @@ protected:
      * Make sure that the output format of the filter graph is yuv420p.
      */
     QString m_filterGraphToParse = QStringLiteral("format=pix_fmts=yuv420p");
-    DmaBufHandler m_dmaBufHandler;
+
+    /**
+     * The range frames are converted to YUV420P in before they reach the
+     * filter graph: on the GPU for DMA-BUFs, with YuvConversion for RGB frames
+     * in memory and DMA-BUFs the GPU cannot convert.
+     *
+     * Set it before calling createFilterGraph(), for filter graphs that only
+     * convert to yuv420p in that range.
+     */
+    std::optional<PipeWireBaseEncodedStream::ColorRange> m_yuvColorRange;
+
+private:
+    // Pass on a frame that arrived at the filter graph
+    void submitFrame(AVFrame *avFrame, int64_t pts);
+    // Pass on the oldest frame being read back, waiting for it if needed
+    bool takeDownload();
+    // Pass on the frames that were read back, all of them when @p wait is true
+    void takeDownloads(bool wait);
+    // The threads of the filter graph for frames of @p size, see setConversionThreads()
+    int filterThreads(const QSize &size) const;
+    // Make @p avFrame a YUV420P frame of @p size converted from the pixels at @p data
+    void convertFrame(AVFrame *avFrame, const uint8_t *data, qint32 stride, spa_video_format format, const QSize &size);
+
+    FrameDownload m_download;
+    // Whether RGB frames are converted to YUV420P before the filter graph, see m_yuvColorRange
+    bool m_convertFrames = false;
+    // The timestamps of the frames being read back
+    std::deque<int64_t> m_downloadTimestamps;
+    // Keep the buffers of the frames being read back from going back to the compositor
+    std::deque<std::shared_ptr<void>> m_downloadBuffers;
+    QTimer m_downloadTimer;
 };
 
 /**
@@ -188,11 +299,11 @@ protected:
      * These contexts are used when doing import of dma-buf based frames.
      *
      * @param path The path to a device node where the frames are.
-     * @param size The size of the frames.
+     * @param encodeSize The size of the frames after scaling.
      *
      * @return true if the contexts were successfully created, false if not.
      */
-    bool createDrmContext(const QSize &size);
+    bool createDrmContext(const QSize &encodeSize);
     /**
      * @param quality The quality level for the encoder (0-100).
      * 
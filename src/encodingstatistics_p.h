@@ -0,0 +1,223 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+
+#include "latencyhistogram_p.h"
+#include "pipewirebaseencodedstream.h"
+
+/**
+ * Collects the frame processing statistics of a PipeWireProduce.
+ *
+ * Frames are followed through the pipeline by their pts: the produce thread
+ * reports frames going into the filter graph, the passthrough thread frames
+ * coming out of it and going into the codec, and the output thread the
+ * packets coming out of the codec. All of them may be called concurrently.
+ *
+ * Besides the latencies, which include the time frames wait in queues, the
+ * time actually spent converting each frame is collected on its way through.
+ */
+class EncodingStatisticsCollector
+{
+public:
+    enum class DropReason {
+        OutOfOrder,
+        FramerateLimit,
+        FilterQueueFull,
+        FilterFailed,
+        EncodeQueueFull,
+    };
+
+    void frameCaptured()
+    {
+        m_captured++;
+    }
+
+    void frameDropped(DropReason reason)
+    {
+        m_dropped[int(reason)]++;
+    }
+
+    /**
+     * A frame was not encoded because it is the same as the previous one.
+     */
+    void frameUnchanged()
+    {
+        m_unchanged++;
+    }
+
+    /**
+     * A frame was submitted to the filter graph.
+     *
+     * @param pts The pts the frame was given.
+     * @param presentationTimestamp The frame's presentation time on CLOCK_MONOTONIC, if known.
+     * @param conversionTime The time spent importing or converting the frame for the filter graph.
+     */
+    void frameSubmitted(int64_t pts, std::optional<std::chrono::nanoseconds> presentationTimestamp, std::chrono::nanoseconds conversionTime = {})
+    {
+        const auto now = Clock::now();
+        std::lock_guard guard(m_mutex);
+        track(m_inFilter, pts, {now, presentationTimestamp, conversionTime});
+    }
+
+    /**
+     * A frame came out of the filter graph.
+     *
+     * @param queued Whether it was sent on to the codec or discarded.
+     * @param filterTime The time the filter graph spent on the frame.
+     */
+    void frameFiltered(int64_t pts, bool queued, std::chrono::nanoseconds filterTime = {})
+    {
+        const auto now = Clock::now();
+        m_filtered++;
+        if (!queued) {
+            frameDropped(DropReason::EncodeQueueFull);
+        }
+
+        std::lock_guard guard(m_mutex);
+        auto it = m_inFilter.find(pts);
+        if (it == m_inFilter.end()) {
+            return;
+        }
+        m_filterLatency.record(now - it->second.since);
+        m_conversionTime.record(it->second.conversionTime + filterTime);
+        if (queued) {
+            track(m_inEncoder, pts, {now, it->second.presentationTimestamp});
+        }
+        m_inFilter.erase(it);
+    }
+
+    /**
+     * An encoded packet came out of the codec.
+     */
+    void packetReceived(int64_t pts, int size)
+    {
+        const auto now = Clock::now();
+        m_encoded++;
+        m_bytes += size;
+
+        std::lock_guard guard(m_mutex);
+        auto it = m_inEncoder.find(pts);
+        if (it == m_inEncoder.end()) {
+            return;
+        }
+        m_encodeLatency.record(now - it->second.since);
+        if (it->second.presentationTimestamp) {
+            m_totalLatency.record(now.time_since_epoch() - *it->second.presentationTimestamp);
+        }
+        m_inEncoder.erase(it);
+    }
+
+    /**
+     * Time was spent inside the codec, sending frames or receiving packets.
+     */
+    void codecBusy(std::chrono::nanoseconds duration)
+    {
+        m_codecBusy += duration.count();
+    }
+
+    /**
+     * Take the current statistics and start a new interval for latencies and bitrate.
+     */
+    PipeWireEncodingStatistics takeSnapshot(int pendingFilterFrames, int pendingEncodeFrames)
+    {
+        PipeWireEncodingStatistics statistics;
+        statistics.capturedFrames = m_captured;
+        statistics.filteredFrames = m_filtered;
+        statistics.encodedFrames = m_encoded;
+        statistics.droppedOutOfOrder = m_dropped[int(DropReason::OutOfOrder)];
+        statistics.droppedFramerateLimit = m_dropped[int(DropReason::FramerateLimit)];
+        statistics.droppedFilterQueueFull = m_dropped[int(DropReason::FilterQueueFull)];
+        statistics.droppedFilterFailed = m_dropped[int(DropReason::FilterFailed)];
+        statistics.droppedEncodeQueueFull = m_dropped[int(DropReason::EncodeQueueFull)];
+        statistics.unchangedFrames = m_unchanged;
+        statistics.pendingFilterFrames = pendingFilterFrames;
+        statistics.pendingEncodeFrames = pendingEncodeFrames;
+
+        const auto now = Clock::now();
+        const auto bytes = m_bytes.exchange(0);
+        const auto interval = std::chrono::duration<double>(now - m_intervalStart).count();
+        statistics.bitrate = interval > 0 ? qint64(bytes * 8 / interval) : 0;
+        const auto busy = std::chrono::duration<double>(std::chrono::nanoseconds(m_codecBusy.exchange(0))).count();
+        statistics.encoderLoad = interval > 0 ? std::min(100, int(busy * 100 / interval)) : 0;
+        m_intervalStart = now;
+
+        std::lock_guard guard(m_mutex);
+        statistics.filterLatencyP50 = m_filterLatency.percentile(0.5).count();
+        statistics.filterLatencyP99 = m_filterLatency.percentile(0.99).count();
+        statistics.encodeLatencyP50 = m_encodeLatency.percentile(0.5).count();
+        statistics.encodeLatencyP99 = m_encodeLatency.percentile(0.99).count();
+        statistics.totalLatencyP50 = m_totalLatency.percentile(0.5).count();
+        statistics.totalLatencyP99 = m_totalLatency.percentile(0.99).count();
+        statistics.conversionTimeP50 = m_conversionTime.percentile(0.5).count();
+        statistics.conversionTimeP99 = m_conversionTime.percentile(0.99).count();
+        m_filterLatency.reset();
+        m_encodeLatency.reset();
+        m_totalLatency.reset();
+        m_conversionTime.reset();
+
+        return statistics;
+    }
+
+    /**
+     * Forget the frames in flight, when the encoder they were in goes away.
+     */
+    void discardPending()
+    {
+        std::lock_guard guard(m_mutex);
+        m_inFilter.clear();
+        m_inEncoder.clear();
+    }
+
+private:
+    // CLOCK_MONOTONIC, the clock of the frames' presentation timestamps
+    using Clock = std::chrono::steady_clock;
+
+    struct InFlight {
+        Clock::time_point since;
+        std::optional<std::chrono::nanoseconds> presentationTimestamp;
+        std::chrono::nanoseconds conversionTime{};
+    };
+
+    static void track(std::map<int64_t, InFlight> &frames, int64_t pts, const InFlight &frame)
+    {
+        // Frames the encoder swallows without a packet, like the ones a codec
+        // merges, are never erased. Keep only the most recent ones around.
+        if (frames.size() >= MaximumTracked) {
+            frames.erase(frames.begin());
+        }
+        frames.insert_or_assign(pts, frame);
+    }
+
+    static constexpr std::size_t MaximumTracked = 256;
+
+    std::atomic<quint64> m_captured = 0;
+    std::atomic<quint64> m_filtered = 0;
+    std::atomic<quint64> m_encoded = 0;
+    std::array<std::atomic<quint64>, 5> m_dropped = {};
+    std::atomic<quint64> m_unchanged = 0;
+    std::atomic<quint64> m_bytes = 0;
+    std::atomic<int64_t> m_codecBusy = 0;
+    // Only touched by takeSnapshot()
+    Clock::time_point m_intervalStart = Clock::now();
+
+    std::mutex m_mutex;
+    std::map<int64_t, InFlight> m_inFilter;
+    std::map<int64_t, InFlight> m_inEncoder;
+    LatencyHistogram m_filterLatency;
+    LatencyHistogram m_encodeLatency{std::chrono::milliseconds(5)};
+    LatencyHistogram m_totalLatency{std::chrono::milliseconds(5)};
+    LatencyHistogram m_conversionTime;
+};
@@ -0,0 +1,96 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <QtGlobal>
+
+#include <algorithm>
+
+#include "pipewirebaseencodedstream.h"
+
+/**
+ * Decides which frames go on to the filter graph when the encoder cannot keep
+ * up, before any time is spent converting them.
+ *
+ * The filter graph and the encoder share one budget of frames in flight, so a
+ * frame that is let in always has room in the encoder once it is converted.
+ * What happens to the frames that do not fit is up to the policy, see
+ * PipeWireBaseEncodedStream::OverloadPolicy.
+ */
+class FrameAdmission
+{
+public:
+    using Policy = PipeWireBaseEncodedStream::OverloadPolicy;
+
+    enum class Decision {
+        // Filter and encode the frame now
+        Admit,
+        // Keep the frame until there is room, in place of the one kept before
+        Hold,
+        Drop,
+    };
+
+    /**
+     * @param keepInterval For KeepEveryNth, every how many frames one is kept.
+     */
+    void setPolicy(Policy policy, int keepInterval = 2)
+    {
+        m_policy = policy;
+        m_keepInterval = std::max(1, keepInterval);
+        m_skipped = 0;
+    }
+
+    Policy policy() const
+    {
+        return m_policy;
+    }
+
+    /**
+     * Decide what to do with a new frame.
+     *
+     * @param inFlight The frames in the filter graph and the encoder.
+     * @param budget How many frames they may hold together.
+     */
+    Decision admit(int inFlight, int budget)
+    {
+        const bool full = inFlight + 1 > budget;
+        switch (m_policy) {
+        case Policy::DropNewest:
+            return full ? Decision::Drop : Decision::Admit;
+        case Policy::DropOldest:
+            return full ? Decision::Hold : Decision::Admit;
+        case Policy::KeepEveryNth:
+            // Thin out the frames evenly once the queues fill up, instead of
+            // letting them run full and dropping everything in a burst
+            if (inFlight * 2 < budget) {
+                m_skipped = 0;
+                return Decision::Admit;
+            }
+            if (full || m_skipped + 1 < m_keepInterval) {
+                m_skipped++;
+                return Decision::Drop;
+            }
+            m_skipped = 0;
+            return Decision::Admit;
+        }
+        return Decision::Admit;
+    }
+
+    /**
+     * Whether a held frame fits now.
+     */
+    static bool hasRoom(int inFlight, int budget)
+    {
+        return inFlight + 1 <= budget;
+    }
+
+private:
+    Policy m_policy = Policy::DropNewest;
+    int m_keepInterval = 2;
+    // Frames dropped since the last one kept, for KeepEveryNth
+    int m_skipped = 0;
+};
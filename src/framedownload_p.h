@@ -0,0 +1,255 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <QImage>
+#include <QRegion>
+
+#include <deque>
+#include <optional>
+
+#include "dmabufhandler.h"
+#include "framepool_p.h"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+/**
+ * Downloads DMA-BUF frames into RGBA frames, reading back only what changed.
+ * Queued frames can be converted to YUV420P on the GPU instead, see setFormat().
+ *
+ * The last download is kept to build the next one on: given the damage since
+ * the previous frame, only the damaged parts are read back from the GPU and
+ * the rest carries over. While libav still holds on to the last download, it
+ * is copied into a new buffer first instead of being written to.
+ *
+ * Frames are either downloaded right away with download(), or queued with
+ * queue() and taken with take() once the GPU is done, not both.
+ *
+ * Like FramePool, it must always be used from the same thread.
+ */
+class FrameDownload
+{
+public:
+    FrameDownload()
+        : m_frame(av_frame_alloc())
+        , m_copy(av_frame_alloc())
+    {
+        if (!m_frame || !m_copy) {
+            qFatal("Failed to allocate memory");
+        }
+    }
+    ~FrameDownload()
+    {
+        av_frame_free(&m_frame);
+        av_frame_free(&m_copy);
+    }
+
+    FrameDownload(const FrameDownload &) = delete;
+    FrameDownload &operator=(const FrameDownload &) = delete;
+
+    /**
+     * Have queued frames converted to @p format, AV_PIX_FMT_RGBA or
+     * AV_PIX_FMT_YUV420P in @p range. download() always gives RGBA.
+     *
+     * Call it before queueing frames.
+     *
+     * @return false if the GPU cannot convert frames, they stay RGBA then.
+     */
+    bool setFormat(AVPixelFormat format, AVColorRange range = AVCOL_RANGE_UNSPECIFIED)
+    {
+        Q_ASSERT(m_queued.empty());
+        Q_ASSERT(format == AV_PIX_FMT_RGBA || format == AV_PIX_FMT_YUV420P);
+        const auto downloadFormat = format == AV_PIX_FMT_RGBA ? DmaBufHandler::DownloadFormat::RGBA
+            : range == AVCOL_RANGE_JPEG                       ? DmaBufHandler::DownloadFormat::YUV420PFull
+                                                              : DmaBufHandler::DownloadFormat::YUV420PLimited;
+        if (!m_handler.supportsDownloadFormat(downloadFormat)) {
+            return false;
+        }
+        if (downloadFormat != m_downloadFormat) {
+            lose();
+        }
+        m_downloadFormat = downloadFormat;
+        m_pixelFormat = format;
+        m_range = format == AV_PIX_FMT_RGBA ? AVCOL_RANGE_UNSPECIFIED : range;
+        return true;
+    }
+
+    /**
+     * Download @p frame and make @p avFrame, which must be blank, a reference to it.
+     *
+     * @param damage What changed since the frame passed to the previous call,
+     * everything is read back without it. Rows are packed to 4 bytes, which is
+     * exactly one RGBA pixel.
+     *
+     * @return false when the DMA-BUF could not be read, @p avFrame stays blank then.
+     */
+    bool download(AVFrame *avFrame, const PipeWireFrame &frame, const std::optional<QRegion> &damage)
+    {
+        Q_ASSERT(frame.dmabuf);
+        const QSize size(frame.dmabuf->width, frame.dmabuf->height);
+        const bool follows = this->follows(frame);
+        const bool complete = !damage || !m_frame->buf[0] || !follows;
+        prepare(size, complete, AV_PIX_FMT_RGBA);
+
+        QImage image(m_frame->data[0], size.width(), size.height(), m_frame->linesize[0], QImage::Format_RGBA8888_Premultiplied);
+        if (!m_handler.downloadFrame(image, frame, complete ? QRect(QPoint(0, 0), size) : *damage)) {
+            lose();
+            return false;
+        }
+
+        if (av_frame_ref(avFrame, m_frame) < 0) {
+            qFatal("Failed to allocate memory");
+        }
+        return true;
+    }
+
+    /**
+     * Start downloading @p frame without waiting for the GPU.
+     *
+     * @param damage What changed since the frame queued before, everything is
+     * read back without it.
+     *
+     * @return false when the DMA-BUF could not be read, nothing is queued then.
+     */
+    bool queue(const PipeWireFrame &frame, const std::optional<QRegion> &damage)
+    {
+        Q_ASSERT(frame.dmabuf);
+        Q_ASSERT(!isFull());
+        const QSize size(frame.dmabuf->width, frame.dmabuf->height);
+        const bool follows = this->follows(frame);
+        const bool complete = !damage || !follows;
+        if (!m_handler.queueDownload(frame, complete ? QRect(QPoint(0, 0), size) : *damage, m_downloadFormat)) {
+            lose();
+            return false;
+        }
+        m_queued.push_back({size, complete});
+        return true;
+    }
+
+    int queued() const
+    {
+        return m_queued.size();
+    }
+
+    bool isFull() const
+    {
+        return queued() == DmaBufHandler::DownloadRingSize;
+    }
+
+    /**
+     * Drop what was imported to read frames, see DmaBufHandler::forgetBuffers().
+     */
+    void forgetBuffers()
+    {
+        m_handler.forgetBuffers();
+    }
+
+    /**
+     * Whether the oldest queued frame arrived, never waits for the GPU.
+     */
+    bool isReady() const
+    {
+        return m_handler.isDownloadReady();
+    }
+
+    /**
+     * Take the oldest queued frame, waiting for the GPU if needed, and make
+     * @p avFrame, which must be blank, a reference to it.
+     *
+     * @return false when reading back failed, @p avFrame stays blank then.
+     */
+    bool take(AVFrame *avFrame)
+    {
+        Q_ASSERT(!m_queued.empty());
+        const auto queued = m_queued.front();
+        m_queued.pop_front();
+
+        // The frame it builds on was lost, drop it until a complete one comes
+        if (!queued.complete && !m_frame->buf[0]) {
+            m_handler.takeDownload(nullptr, nullptr);
+            return false;
+        }
+
+        prepare(queued.size, queued.complete, m_pixelFormat);
+        if (!m_handler.takeDownload(m_frame->data, m_frame->linesize)) {
+            lose();
+            return false;
+        }
+
+        if (av_frame_ref(avFrame, m_frame) < 0) {
+            qFatal("Failed to allocate memory");
+        }
+        return true;
+    }
+
+private:
+    // Whether the damage of @p frame is relative to the frame before, and remember it for the next one
+    bool follows(const PipeWireFrame &frame)
+    {
+        const QSize size(frame.dmabuf->width, frame.dmabuf->height);
+        const bool follows = size == m_size && frame.format == m_format;
+        m_size = size;
+        m_format = frame.format;
+        return follows;
+    }
+
+    // Forget the last download, the next frame is read back completely
+    void lose()
+    {
+        av_frame_unref(m_frame);
+        m_size = {};
+    }
+
+    // Make m_frame a writable frame of @p size, keeping the pixels of the last download unless @p complete
+    void prepare(const QSize &size, bool complete, AVPixelFormat format)
+    {
+        if (complete || !m_frame->buf[0] || m_frame->width != size.width() || m_frame->height != size.height() || m_frame->format != format) {
+            av_frame_unref(m_frame);
+            m_frame->format = format;
+            m_frame->color_range = format == AV_PIX_FMT_RGBA ? AVCOL_RANGE_UNSPECIFIED : m_range;
+            m_frame->width = size.width();
+            m_frame->height = size.height();
+            if (!m_pool.allocateVideo(m_frame, 4)) {
+                qFatal("Failed to allocate memory");
+            }
+        } else if (!av_frame_is_writable(m_frame)) {
+            m_copy->format = m_frame->format;
+            m_copy->color_range = m_frame->color_range;
+            m_copy->width = m_frame->width;
+            m_copy->height = m_frame->height;
+            if (!m_pool.allocateVideo(m_copy, 4)) {
+                qFatal("Failed to allocate memory");
+            }
+            if (av_frame_copy(m_copy, m_frame) < 0) {
+                qFatal("Failed to allocate memory");
+            }
+            av_frame_unref(m_frame);
+            av_frame_move_ref(m_frame, m_copy);
+        }
+    }
+
+    struct Queued {
+        QSize size;
+        bool complete;
+    };
+
+    DmaBufHandler m_handler;
+    FramePool m_pool;
+    // The last download, which the next one starts from
+    AVFrame *m_frame = nullptr;
+    AVFrame *m_copy = nullptr;
+    // The size and format of the frame the next damage is relative to
+    QSize m_size;
+    spa_video_format m_format = SPA_VIDEO_FORMAT_UNKNOWN;
+    std::deque<Queued> m_queued;
+    // What queued frames are converted to
+    DmaBufHandler::DownloadFormat m_downloadFormat = DmaBufHandler::DownloadFormat::RGBA;
+    AVPixelFormat m_pixelFormat = AV_PIX_FMT_RGBA;
+    AVColorRange m_range = AVCOL_RANGE_UNSPECIFIED;
+};
@@ -0,0 +1,147 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+extern "C" {
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/samplefmt.h>
+}
+
+/**
+ * Hands out frame data buffers from an AVBufferPool.
+ *
+ * A buffer goes back to the pool when libav drops its last reference to it,
+ * so a stream of equally sized frames only allocates as many buffers as are
+ * in flight at the same time. The pool only grows: asking for a bigger buffer
+ * replaces it, smaller requests are served from the buffers it has.
+ *
+ * Buffers can be released from any thread, but allocateVideo() and
+ * allocateAudio() must always be called from the same one.
+ */
+class FramePool
+{
+public:
+    FramePool() = default;
+    ~FramePool()
+    {
+        // Buffers still held by libav are freed once they come back
+        av_buffer_pool_uninit(&m_pool);
+    }
+
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    /**
+     * Attach a pooled buffer to a video frame, like av_frame_get_buffer().
+     *
+     * The frame's format, width and height must be set. Rows are padded to
+     * @p alignment bytes.
+     */
+    bool allocateVideo(AVFrame *frame, int alignment = 32)
+    {
+        const auto format = AVPixelFormat(frame->format);
+        const int size = av_image_get_buffer_size(format, frame->width, frame->height, alignment);
+        if (size < 0) {
+            return false;
+        }
+
+        frame->buf[0] = get(size);
+        if (!frame->buf[0]) {
+            return false;
+        }
+
+        if (av_image_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, format, frame->width, frame->height, alignment) < 0) {
+            av_buffer_unref(&frame->buf[0]);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Attach a pooled buffer to an audio frame, like av_frame_get_buffer().
+     *
+     * The frame's format, nb_samples and ch_layout must be set. Only packed
+     * sample formats are supported.
+     */
+    bool allocateAudio(AVFrame *frame)
+    {
+        const auto format = AVSampleFormat(frame->format);
+        const int channels = frame->ch_layout.nb_channels;
+        if (av_sample_fmt_is_planar(format)) {
+            return false;
+        }
+
+        const int size = av_samples_get_buffer_size(nullptr, channels, frame->nb_samples, format, 0);
+        if (size < 0) {
+            return false;
+        }
+
+        frame->buf[0] = get(size);
+        if (!frame->buf[0]) {
+            return false;
+        }
+
+        if (av_samples_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, channels, frame->nb_samples, format, 0) < 0) {
+            av_buffer_unref(&frame->buf[0]);
+            return false;
+        }
+        frame->extended_data = frame->data;
+        return true;
+    }
+
+    /**
+     * Attach a pooled, zeroed buffer of @p size bytes to a frame.
+     */
+    bool allocateZeroed(AVFrame *frame, std::size_t size)
+    {
+        frame->buf[0] = get(size);
+        if (!frame->buf[0]) {
+            return false;
+        }
+        std::fill_n(frame->buf[0]->data, size, 0);
+        return true;
+    }
+
+    /**
+     * The number of buffers the pool has allocated so far.
+     */
+    int allocations() const
+    {
+        return m_allocations;
+    }
+
+private:
+    AVBufferRef *get(std::size_t size)
+    {
+        if (!m_pool || size > m_size) {
+            av_buffer_pool_uninit(&m_pool);
+            m_pool = av_buffer_pool_init2(size, this, &FramePool::allocate, nullptr);
+            m_size = size;
+            if (!m_pool) {
+                return nullptr;
+            }
+        }
+        return av_buffer_pool_get(m_pool);
+    }
+
+    // Called with the pool's lock held, from whichever thread asks for a buffer
+    static AVBufferRef *allocate(void *opaque, std::size_t size)
+    {
+        static_cast<FramePool *>(opaque)->m_allocations++;
+        return av_buffer_alloc(size);
+    }
+
+    AVBufferPool *m_pool = nullptr;
+    std::size_t m_size = 0;
+    std::atomic_int m_allocations = 0;
+};
@@ -56,7 +56,7 @@ bool GifEncoder::initialize(const QSize &size)
     m_avCodecContext->width = size.width();
     m_avCodecContext->height = size.height();
     m_avCodecContext->pix_fmt = AV_PIX_FMT_PAL8;
-    m_avCodecContext->time_base = AVRational{1, 1000};
+    applyFrameTiming();
 
     AVDictionary *options = nullptr;
     if (int result = avcodec_open2(m_avCodecContext, codec, &options); result < 0) {
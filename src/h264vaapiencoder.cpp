@@ -57,10 +57,11 @@ bool H264VAAPIEncoder::initialize(const QSize &size)
         qFatal("Failed to allocate memory");
     }
 
+    const auto inputSize = sourceSize(size);
     parameters->format = AV_PIX_FMT_DRM_PRIME;
-    parameters->width = size.width();
-    parameters->height = size.height();
-    parameters->time_base = {1, 1000};
+    parameters->width = inputSize.width();
+    parameters->height = inputSize.height();
+    parameters->time_base = FrameTimeBase;
     parameters->hw_frames_ctx = m_drmFramesContext;
 
     av_buffersrc_parameters_set(m_inputFilter, parameters);
@@ -98,7 +99,10 @@ bool H264VAAPIEncoder::initialize(const QSize &size)
     outputs->next = nullptr;
 
     const auto colorRange = m_colorRange == PipeWireBaseEncodedStream::ColorRange::Full ? "full"s : "limited"s;
-    const auto filterGraph = std::format("hwmap=mode=direct:derive_device=vaapi,scale_vaapi=format=nv12:mode=fast:out_range={}", colorRange);
+    const auto filterGraph = std::format("hwmap=mode=direct:derive_device=vaapi,scale_vaapi=w={}:h={}:format=nv12:mode=fast:out_range={}",
+                                         size.width(),
+                                         size.height(),
+                                         colorRange);
 
     ret = avfilter_graph_parse(m_avFilterGraph, filterGraph.data(), outputs, inputs, NULL);
     if (ret < 0) {
@@ -134,9 +138,12 @@ bool H264VAAPIEncoder::initialize(const QSize &size)
     m_avCodecContext->max_b_frames = 0;
     m_avCodecContext->gop_size = 100;
     m_avCodecContext->pix_fmt = AV_PIX_FMT_VAAPI;
-    m_avCodecContext->time_base = AVRational{1, 1000};
+    applyFrameTiming();
 
-    if (m_quality) {
+    if (applyRateControl()) {
+        // Otherwise libavcodec prefers a quality based mode over the bitrate
+        m_avCodecContext->global_quality = 0;
+    } else if (m_quality) {
         m_avCodecContext->global_quality = percentageToAbsoluteQuality(m_quality);
     } else {
         m_avCodecContext->global_quality = 35;
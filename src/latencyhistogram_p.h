@@ -0,0 +1,100 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <QString>
+#include <QStringList>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+/**
+ * Collects latencies into fixed-width buckets, so the distribution and its
+ * percentiles can be reported without keeping every sample around.
+ *
+ * Latencies beyond the last bucket are all counted in an overflow bucket.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr std::chrono::microseconds BucketWidth{250};
+    static constexpr int BucketCount = 80;
+
+    /**
+     * @param bucketWidth The width of each bucket, the default covers 20ms.
+     */
+    explicit LatencyHistogram(std::chrono::microseconds bucketWidth = BucketWidth)
+        : m_bucketWidth(bucketWidth)
+    {
+    }
+
+    void record(std::chrono::nanoseconds latency)
+    {
+        const auto bucket = std::chrono::duration_cast<std::chrono::microseconds>(std::max(latency, std::chrono::nanoseconds::zero())) / m_bucketWidth;
+        m_buckets[std::min<qint64>(bucket, BucketCount)]++;
+        m_count++;
+    }
+
+    quint64 count() const
+    {
+        return m_count;
+    }
+
+    /**
+     * The upper bound of the bucket the @p fraction percentile (0 to 1) falls in.
+     * Returns zero while no latencies have been recorded.
+     */
+    std::chrono::microseconds percentile(double fraction) const
+    {
+        if (m_count == 0) {
+            return std::chrono::microseconds::zero();
+        }
+        const quint64 rank = std::max<quint64>(1, std::clamp(fraction, 0.0, 1.0) * m_count);
+        quint64 seen = 0;
+        for (int i = 0; i <= BucketCount; ++i) {
+            seen += m_buckets[i];
+            if (seen >= rank) {
+                return m_bucketWidth * (i + 1);
+            }
+        }
+        return m_bucketWidth * (BucketCount + 1);
+    }
+
+    void reset()
+    {
+        m_buckets.fill(0);
+        m_count = 0;
+    }
+
+    // A compact description of the non-empty buckets, e.g. for debug output.
+    QString toString() const
+    {
+        QStringList buckets;
+        for (int i = 0; i <= BucketCount; ++i) {
+            if (m_buckets[i] == 0) {
+                continue;
+            }
+            const auto from = (m_bucketWidth * i).count();
+            if (i == BucketCount) {
+                buckets << QStringLiteral(">=%1us: %2").arg(from).arg(m_buckets[i]);
+            } else {
+                buckets << QStringLiteral("%1-%2us: %3").arg(from).arg((m_bucketWidth * (i + 1)).count()).arg(m_buckets[i]);
+            }
+        }
+        return QStringLiteral("p50 <%1us, p99 <%2us, max <%3us [%4]")
+            .arg(percentile(0.5).count())
+            .arg(percentile(0.99).count())
+            .arg(percentile(1.0).count())
+            .arg(buckets.join(QStringLiteral(", ")));
+    }
+
+private:
+    std::chrono::microseconds m_bucketWidth;
+    std::array<quint64, BucketCount + 1> m_buckets = {};
+    quint64 m_count = 0;
+};
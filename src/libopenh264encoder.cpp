@@ -33,12 +33,14 @@ LibOpenH264Encoder::LibOpenH264Encoder(H264Profile profile, PipeWireProduce *pro
     : SoftwareEncoder(produce)
     , m_profile(profile)
 {
-    auto colorRange = m_colorRange == PipeWireBaseEncodedStream::ColorRange::Full ? u"full"_s : u"limited"_s;
-    m_filterGraphToParse = u"format=yuv420p,scale=out_range=%1"_s.arg(colorRange);
 }
 
 bool LibOpenH264Encoder::initialize(const QSize &size)
 {
+    // The color range is only known once it was set
+    auto colorRange = m_colorRange == PipeWireBaseEncodedStream::ColorRange::Full ? u"full"_s : u"limited"_s;
+    m_filterGraphToParse = u"format=yuv420p,scale=out_range=%1"_s.arg(colorRange);
+    m_yuvColorRange = m_colorRange;
     createFilterGraph(size);
 
     auto codec = avcodec_find_encoder_by_name("libopenh264");
@@ -59,9 +61,12 @@ bool LibOpenH264Encoder::initialize(const QSize &size)
     m_avCodecContext->max_b_frames = 0;
     m_avCodecContext->gop_size = 100;
     m_avCodecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-    m_avCodecContext->time_base = AVRational{1, 1000};
+    applyFrameTiming();
 
-    setQuality(m_quality);
+    // libopenh264 has no buffer size, it only takes the target and maximum bitrate
+    if (!applyRateControl()) {
+        setQuality(m_quality);
+    }
 
     switch (m_profile) {
     case H264Profile::Baseline:
@@ -95,7 +100,7 @@ bool LibOpenH264Encoder::initialize(const QSize &size)
 void LibOpenH264Encoder::setQuality(std::optional<quint8> quality)
 {
     SoftwareEncoder::setQuality(quality);
-    if (!m_avCodecContext) {
+    if (!m_avCodecContext || m_rateControl.targetBitrate) {
         return;
     }
     // "q" here stands for "quantization", but that effectively impacts quality.
@@ -27,6 +27,8 @@ LibVpxEncoder::LibVpxEncoder(PipeWireProduce *produce)
 
 bool LibVpxEncoder::initialize(const QSize &size)
 {
+    // Limited, like swscale converts to, libvpx is not told about the range
+    m_yuvColorRange = PipeWireBaseEncodedStream::ColorRange::Limited;
     createFilterGraph(size);
 
     auto codec = avcodec_find_encoder_by_name("libvpx");
@@ -40,7 +42,10 @@ bool LibVpxEncoder::initialize(const QSize &size)
         qCWarning(PIPEWIRERECORD_LOGGING) << "Could not allocate video codec context";
         return false;
     }
-    m_avCodecContext->bit_rate = size.width() * size.height() * 2;
+    if (!applyRateControl()) {
+        // Caps the bitrate of the constrained quality mode
+        m_avCodecContext->bit_rate = size.width() * size.height() * 2;
+    }
 
     Q_ASSERT(!size.isEmpty());
     m_avCodecContext->width = size.width();
@@ -48,7 +53,7 @@ bool LibVpxEncoder::initialize(const QSize &size)
     m_avCodecContext->max_b_frames = 0;
     m_avCodecContext->gop_size = 100;
     m_avCodecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-    m_avCodecContext->time_base = AVRational{1, 1000};
+    applyFrameTiming();
 
     AVDictionary *options = buildEncodingOptions();
     maybeLogOptions(options);
@@ -74,7 +79,9 @@ AVDictionary *LibVpxEncoder::buildEncodingOptions()
     av_dict_set(&options, "flags", "+mv4", 0);
     // Disable in-loop filtering
     av_dict_set(&options, "-flags", "+loop", 0);
-    av_dict_set(&options, "crf", "45", 0);
+    if (!m_rateControl.targetBitrate) {
+        av_dict_set(&options, "crf", "45", 0);
+    }
 
     return options;
 }
@@ -31,6 +31,8 @@ LibVpxVp9Encoder::LibVpxVp9Encoder(PipeWireProduce *produce)
 
 bool LibVpxVp9Encoder::initialize(const QSize &size)
 {
+    // Limited, like swscale converts to, libvpx is not told about the range
+    m_yuvColorRange = PipeWireBaseEncodedStream::ColorRange::Limited;
     createFilterGraph(size);
 
     auto codec = avcodec_find_encoder_by_name("libvpx-vp9");
@@ -49,18 +51,20 @@ bool LibVpxVp9Encoder::initialize(const QSize &size)
     m_avCodecContext->width = size.width();
     m_avCodecContext->height = size.height();
     m_avCodecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-    m_avCodecContext->time_base = AVRational{1, 1000};
+    applyFrameTiming();
 
     AVDictionary *options = buildEncodingOptions();
     maybeLogOptions(options);
 
-    // m_avCodecContext->framerate is not set, so we use m_produce->maxFramerate() instead.
+    // The framerate set by applyFrameTiming() is the maximum one as well
     const auto maxFramerate = m_produce->maxFramerate();
     const auto fps = qreal(maxFramerate.numerator) / std::max(quint32(1), maxFramerate.denominator);
 
     m_avCodecContext->gop_size = fps * 2;
 
-    setQuality(m_quality);
+    if (!applyRateControl()) {
+        setQuality(m_quality);
+    }
 
     if (int result = avcodec_open2(m_avCodecContext, codec, &options); result < 0) {
         qCWarning(PIPEWIRERECORD_LOGGING) << "Could not open codec" << av_err2str(result);
@@ -79,7 +83,7 @@ void LibVpxVp9Encoder::setQuality(std::optional<quint8> quality)
     // a private data object directly to set options seems like a bad idea.
     // However, you can still set the options by setting options on the
     // AVCodecContext object with the AV_OPT_SEARCH_CHILDREN search flag.
-    if (!m_avCodecContext) {
+    if (!m_avCodecContext || m_rateControl.targetBitrate) {
         return;
     }
     // Lower crf is higher quality. Max 0, min 63. libvpx-vp9 doesn't use global_quality.
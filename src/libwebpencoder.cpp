@@ -53,7 +53,7 @@ bool LibWebPEncoder::initialize(const QSize &size)
     m_avCodecContext->width = size.width();
     m_avCodecContext->height = size.height();
     m_avCodecContext->pix_fmt = AV_PIX_FMT_YUVA420P;
-    m_avCodecContext->time_base = AVRational{1, 1000};
+    applyFrameTiming();
 
     setQuality(m_quality);
     AVDictionary *options = buildEncodingOptions();
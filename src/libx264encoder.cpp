@@ -33,16 +33,18 @@ LibX264Encoder::LibX264Encoder(H264Profile profile, PipeWireProduce *produce)
     : SoftwareEncoder(produce)
     , m_profile(profile)
 {
+}
+
+bool LibX264Encoder::initialize(const QSize &size)
+{
+    // The color range is only known once it was set
     auto colorRange = m_colorRange == PipeWireBaseEncodedStream::ColorRange::Full ? u"full"_s : u"limited"_s;
 
     // Adjust the filter graph to ensure we are using an even frame size using a
     // pad filter. Otherwise the size adjustment below will insert a row/column
     // of garbage instead of black.
     m_filterGraphToParse = u"format=yuv420p,pad=ceil(iw/2)*2:ceil(ih/2)*2,scale=out_range=%1"_s.arg(colorRange);
-}
-
-bool LibX264Encoder::initialize(const QSize &size)
-{
+    m_yuvColorRange = m_colorRange;
     createFilterGraph(size);
 
     auto codec = avcodec_find_encoder_by_name("libx264");
@@ -67,7 +69,7 @@ bool LibX264Encoder::initialize(const QSize &size)
     m_avCodecContext->max_b_frames = 0;
     m_avCodecContext->gop_size = 100;
     m_avCodecContext->pix_fmt = AV_PIX_FMT_YUV420P;
-    m_avCodecContext->time_base = AVRational{1, 1000};
+    applyFrameTiming();
 
     switch (m_profile) {
     case H264Profile::Baseline:
@@ -81,7 +83,9 @@ bool LibX264Encoder::initialize(const QSize &size)
         break;
     }
 
-    setQuality(m_quality);
+    if (!applyRateControl()) {
+        setQuality(m_quality);
+    }
     AVDictionary *options = buildEncodingOptions();
     maybeLogOptions(options);
 
@@ -96,7 +100,7 @@ bool LibX264Encoder::initialize(const QSize &size)
 void LibX264Encoder::setQuality(std::optional<quint8> quality)
 {
     SoftwareEncoder::setQuality(quality);
-    if (!m_avCodecContext) {
+    if (!m_avCodecContext || m_rateControl.targetBitrate) {
         return;
     }
     // libx264 ignores the AVCodecContext global_quality / qscale fields and
@@ -107,6 +111,33 @@ void LibX264Encoder::setQuality(std::optional<quint8> quality)
     av_opt_set_double(m_avCodecContext, "crf", crf, AV_OPT_SEARCH_CHILDREN);
 }
 
+bool LibX264Encoder::setRuntimeQuality(quint8 quality)
+{
+    if (m_rateControl.targetBitrate) {
+        return false;
+    }
+
+    // libavcodec hands a changed crf on to x264 with the next frame
+    std::lock_guard guard(m_avCodecMutex);
+    setQuality(quality);
+    return true;
+}
+
+bool LibX264Encoder::setRuntimeRateControl(const RateControl &rateControl)
+{
+    // x264 can't switch between quality and bitrate based rate control, nor
+    // turn VBV on or off while encoding
+    if (!m_rateControl.targetBitrate || !rateControl.targetBitrate || m_rateControl.maxBitrate.has_value() != rateControl.maxBitrate.has_value()) {
+        return false;
+    }
+
+    // Like the crf, libavcodec hands changed bitrates on to x264 with the next frame
+    std::lock_guard guard(m_avCodecMutex);
+    m_rateControl = rateControl;
+    applyRateControl();
+    return true;
+}
+
 AVDictionary *LibX264Encoder::buildEncodingOptions()
 {
     AVDictionary *options = SoftwareEncoder::buildEncodingOptions();
@@ -134,6 +165,12 @@ AVDictionary *LibX264Encoder::buildEncodingOptions()
     av_dict_set(&options, "flags", "+mv4", 0);
     // Disable in-loop filtering
     av_dict_set(&options, "-flags", "+loop", 0);
+    // Make frames forced to be key frames by requestKeyFrame() IDR frames, so decoders can start from them
+    av_dict_set(&options, "forced-idr", "1", 0);
+    if (isConstantBitrate()) {
+        // Pad the stream to the bitrate so it is constant for real
+        av_dict_set(&options, "nal-hrd", "cbr", 0);
+    }
 
     return options;
 }
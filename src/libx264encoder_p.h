@@ -21,6 +21,8 @@ public:
     bool initialize(const QSize &size) override;
 
     void setQuality(std::optional<quint8> quality) override;
+    bool setRuntimeQuality(quint8 quality) override;
+    bool setRuntimeRateControl(const RateControl &rateControl) override;
 
 protected:
     AVDictionary *buildEncodingOptions() override;
@@ -19,26 +19,23 @@ extern "C" {
 
 #include <QThread>
 
+#include "pipewirebaseencodedstream_p.h"
 #include "pipewireproduce_p.h"
 #include "vaapiutils_p.h"
 
-struct PipeWireEncodedStreamPrivate {
-    uint m_nodeId = 0;
-    quint64 m_objectSerial = quint64(-1);
-    std::optional<uint> m_fd;
-    Fraction m_maxFramerate;
-    QSize m_requestedSize;
-    int m_maxPendingFrames = 50;
-    bool m_active = false;
-    PipeWireBaseEncodedStream::Encoder m_encoder = PipeWireBaseEncodedStream::NoEncoder;
-    std::optional<quint8> m_quality;
-    PipeWireBaseEncodedStream::EncodingPreference m_encodingPreference;
-    PipeWireBaseEncodedStream::State m_state = PipeWireBaseEncodedStream::Idle;
-    PipeWireBaseEncodedStream::ColorRange m_colorRange = PipeWireBaseEncodedStream::ColorRange::Limited;
-
-    std::unique_ptr<QThread> m_produceThread;
-    std::unique_ptr<PipeWireProduce> m_produce;
-};
+static void updateRateControl(PipeWireEncodedStreamPrivate *d)
+{
+    if (!d->m_produce) {
+        return;
+    }
+    // produce runs in another thread
+    QMetaObject::invokeMethod(
+        d->m_produce.get(),
+        [produce = d->m_produce.get(), rateControl = d->m_rateControl]() {
+            produce->setRateControl(rateControl);
+        },
+        Qt::QueuedConnection);
+}
 
 PipeWireBaseEncodedStream::State PipeWireBaseEncodedStream::state() const
 {
@@ -202,9 +199,13 @@ void PipeWireBaseEncodedStream::start()
     d->m_produceThread->setObjectName("PipeWireProduce::input");
     d->m_produce = makeProduce();
     d->m_produce->setQuality(d->m_quality);
+    d->m_produce->setMinimumQuality(d->m_minimumQuality);
+    d->m_produce->setRateControl(d->m_rateControl);
     d->m_produce->setMaxPendingFrames(d->m_maxPendingFrames);
     d->m_produce->setEncodingPreference(d->m_encodingPreference);
     d->m_produce->setColorRange(d->m_colorRange);
+    d->m_produce->setConversionThreads(d->m_conversionThreads);
+    d->m_produce->setOverloadPolicy(d->m_overloadPolicy, d->m_overloadKeepInterval);
     d->m_produce->moveToThread(d->m_produceThread.get());
     d->m_produceThread->start();
     QMetaObject::invokeMethod(d->m_produce.get(), &PipeWireProduce::initialize, Qt::QueuedConnection);
@@ -227,6 +228,12 @@ void PipeWireBaseEncodedStream::start()
         Q_EMIT errorFound(message);
     });
 
+    d->m_statistics = {};
+    connect(d->m_produce.get(), &PipeWireProduce::statisticsUpdated, this, [this](const PipeWireEncodingStatistics &statistics) {
+        d->m_statistics = statistics;
+        Q_EMIT statisticsUpdated();
+    });
+
     connect(d->m_produceThread.get(), &QThread::finished, this, [this]() {
         d->m_produce.reset();
         d->m_produceThread.reset();
@@ -299,6 +306,60 @@ void PipeWireBaseEncodedStream::setQuality(quint8 quality)
     }
 }
 
+std::optional<quint8> PipeWireBaseEncodedStream::minimumQuality() const
+{
+    return d->m_minimumQuality;
+}
+
+void PipeWireBaseEncodedStream::setMinimumQuality(quint8 minimumQuality)
+{
+    d->m_minimumQuality = minimumQuality;
+
+    if (!d->m_produce) {
+        return;
+    }
+    // produce runs in another thread
+    QMetaObject::invokeMethod(
+        d->m_produce.get(),
+        [produce = d->m_produce.get(), minimumQuality]() {
+            produce->setMinimumQuality(minimumQuality);
+        },
+        Qt::QueuedConnection);
+}
+
+std::optional<qint64> PipeWireBaseEncodedStream::targetBitrate() const
+{
+    return d->m_rateControl.targetBitrate;
+}
+
+void PipeWireBaseEncodedStream::setTargetBitrate(qint64 bitrate)
+{
+    d->m_rateControl.targetBitrate = bitrate > 0 ? std::optional(bitrate) : std::nullopt;
+    updateRateControl(d.data());
+}
+
+std::optional<qint64> PipeWireBaseEncodedStream::maxBitrate() const
+{
+    return d->m_rateControl.maxBitrate;
+}
+
+void PipeWireBaseEncodedStream::setMaxBitrate(qint64 bitrate)
+{
+    d->m_rateControl.maxBitrate = bitrate > 0 ? std::optional(bitrate) : std::nullopt;
+    updateRateControl(d.data());
+}
+
+std::optional<qint64> PipeWireBaseEncodedStream::bufferSize() const
+{
+    return d->m_rateControl.bufferSize;
+}
+
+void PipeWireBaseEncodedStream::setBufferSize(qint64 bits)
+{
+    d->m_rateControl.bufferSize = bits > 0 ? std::optional(bits) : std::nullopt;
+    updateRateControl(d.data());
+}
+
 void PipeWireBaseEncodedStream::setEncoder(Encoder encoder)
 {
     if (d->m_encoder == encoder || !suggestedEncoders().contains(encoder)) {
@@ -370,11 +431,64 @@ void PipeWireBaseEncodedStream::setColorRange(ColorRange colorRange)
     }
 }
 
+void PipeWireBaseEncodedStream::setConversionThreads(int threads)
+{
+    d->m_conversionThreads = qMax(0, threads);
+
+    if (!d->m_produce) {
+        return;
+    }
+    // produce runs in another thread
+    QMetaObject::invokeMethod(
+        d->m_produce.get(),
+        [produce = d->m_produce.get(), threads = d->m_conversionThreads]() {
+            produce->setConversionThreads(threads);
+        },
+        Qt::QueuedConnection);
+}
+
+int PipeWireBaseEncodedStream::conversionThreads() const
+{
+    return d->m_conversionThreads;
+}
+
+void PipeWireBaseEncodedStream::setOverloadPolicy(OverloadPolicy policy, int keepInterval)
+{
+    d->m_overloadPolicy = policy;
+    d->m_overloadKeepInterval = qMax(1, keepInterval);
+
+    if (!d->m_produce) {
+        return;
+    }
+    // produce runs in another thread
+    QMetaObject::invokeMethod(
+        d->m_produce.get(),
+        [produce = d->m_produce.get(), policy = d->m_overloadPolicy, keepInterval = d->m_overloadKeepInterval]() {
+            produce->setOverloadPolicy(policy, keepInterval);
+        },
+        Qt::QueuedConnection);
+}
+
+PipeWireBaseEncodedStream::OverloadPolicy PipeWireBaseEncodedStream::overloadPolicy() const
+{
+    return d->m_overloadPolicy;
+}
+
+PipeWireEncodingStatistics PipeWireBaseEncodedStream::statistics() const
+{
+    return d->m_statistics;
+}
+
 PipeWireBaseEncodedStream::EncodingPreference PipeWireBaseEncodedStream::encodingPreference()
 {
     return d->m_encodingPreference;
 }
 
+PipeWireProduce *PipeWireBaseEncodedStream::produce() const
+{
+    return d->m_produce.get();
+}
+
 bool PipeWireBaseEncodedStream::isActive() const
 {
     return d->m_active;
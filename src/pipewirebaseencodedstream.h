@@ -7,6 +7,7 @@
 #pragma once
 
 #include <QObject>
+#include <qqmlintegration.h>
 
 #include <kpipewire_export.h>
 
@@ -14,6 +15,95 @@ struct Fraction;
 struct PipeWireEncodedStreamPrivate;
 class PipeWireProduce;
 
+/**
+ * Frame processing statistics of a PipeWireBaseEncodedStream.
+ *
+ * Frame counts are totals since the stream started. Queue depths are taken
+ * at the time of the update, latencies and the bitrate cover the time since
+ * the previous update. Latencies are in microseconds, rounded up to the
+ * granularity they are collected with.
+ */
+struct KPIPEWIRE_EXPORT PipeWireEncodingStatistics {
+    Q_GADGET
+    QML_VALUE_TYPE(encodingStatistics)
+    QML_UNCREATABLE("Statistics are only provided by encoded streams")
+    /// Frames received from PipeWire
+    Q_PROPERTY(quint64 capturedFrames MEMBER capturedFrames)
+    /// Frames that made it through the filter graph
+    Q_PROPERTY(quint64 filteredFrames MEMBER filteredFrames)
+    /// Frames that came out of the encoder as a packet
+    Q_PROPERTY(quint64 encodedFrames MEMBER encodedFrames)
+    /// All dropped frames, the sum of the per reason counts below
+    Q_PROPERTY(quint64 droppedFrames READ droppedFrames)
+    /// Frames older than or as old as the previous one
+    Q_PROPERTY(quint64 droppedOutOfOrder MEMBER droppedOutOfOrder)
+    /// Frames arriving faster than the maximum framerate
+    Q_PROPERTY(quint64 droppedFramerateLimit MEMBER droppedFramerateLimit)
+    /// Frames not let in to the filter graph because the queues were full, see OverloadPolicy
+    Q_PROPERTY(quint64 droppedFilterQueueFull MEMBER droppedFilterQueueFull)
+    /// Frames that could not be imported or converted
+    Q_PROPERTY(quint64 droppedFilterFailed MEMBER droppedFilterFailed)
+    /// Filtered frames discarded because the encode queue was full
+    Q_PROPERTY(quint64 droppedEncodeQueueFull MEMBER droppedEncodeQueueFull)
+    /// Frames not encoded because nothing changed since the previous one, not counted as dropped
+    Q_PROPERTY(quint64 unchangedFrames MEMBER unchangedFrames)
+    /// Frames the stream skipped for newer ones before they were captured, see PipeWireSourceStream::setAlwaysLatest()
+    Q_PROPERTY(quint64 skippedFrames MEMBER skippedFrames)
+    Q_PROPERTY(int pendingFilterFrames MEMBER pendingFilterFrames)
+    Q_PROPERTY(int pendingEncodeFrames MEMBER pendingEncodeFrames)
+    /// From submitting a frame to the filter graph until it comes out of it
+    Q_PROPERTY(qint64 filterLatencyP50 MEMBER filterLatencyP50)
+    Q_PROPERTY(qint64 filterLatencyP99 MEMBER filterLatencyP99)
+    /// From sending a filtered frame to the encoder until its packet comes out
+    Q_PROPERTY(qint64 encodeLatencyP50 MEMBER encodeLatencyP50)
+    Q_PROPERTY(qint64 encodeLatencyP99 MEMBER encodeLatencyP99)
+    /// From the frame's presentation timestamp until its packet comes out
+    Q_PROPERTY(qint64 totalLatencyP50 MEMBER totalLatencyP50)
+    Q_PROPERTY(qint64 totalLatencyP99 MEMBER totalLatencyP99)
+    /// Time spent converting a frame for the encoder, without the time it waited in between
+    Q_PROPERTY(qint64 conversionTimeP50 MEMBER conversionTimeP50)
+    Q_PROPERTY(qint64 conversionTimeP99 MEMBER conversionTimeP99)
+    /// Encoded output, in bits per second
+    Q_PROPERTY(qint64 bitrate MEMBER bitrate)
+    /// Share of the time the encoder was busy, in percent
+    Q_PROPERTY(int encoderLoad MEMBER encoderLoad)
+    /// The quality adaptive quality settled on, -1 when it is not in use
+    Q_PROPERTY(int adaptiveQuality MEMBER adaptiveQuality)
+    /// How often adaptive quality changed the quality
+    Q_PROPERTY(quint64 qualityAdjustments MEMBER qualityAdjustments)
+
+public:
+    quint64 droppedFrames() const
+    {
+        return droppedOutOfOrder + droppedFramerateLimit + droppedFilterQueueFull + droppedFilterFailed + droppedEncodeQueueFull;
+    }
+
+    quint64 capturedFrames = 0;
+    quint64 filteredFrames = 0;
+    quint64 encodedFrames = 0;
+    quint64 droppedOutOfOrder = 0;
+    quint64 droppedFramerateLimit = 0;
+    quint64 droppedFilterQueueFull = 0;
+    quint64 droppedFilterFailed = 0;
+    quint64 droppedEncodeQueueFull = 0;
+    quint64 unchangedFrames = 0;
+    quint64 skippedFrames = 0;
+    int pendingFilterFrames = 0;
+    int pendingEncodeFrames = 0;
+    qint64 filterLatencyP50 = 0;
+    qint64 filterLatencyP99 = 0;
+    qint64 encodeLatencyP50 = 0;
+    qint64 encodeLatencyP99 = 0;
+    qint64 totalLatencyP50 = 0;
+    qint64 totalLatencyP99 = 0;
+    qint64 conversionTimeP50 = 0;
+    qint64 conversionTimeP99 = 0;
+    qint64 bitrate = 0;
+    int encoderLoad = 0;
+    int adaptiveQuality = -1;
+    quint64 qualityAdjustments = 0;
+};
+
 class KPIPEWIRE_EXPORT PipeWireBaseEncodedStream : public QObject
 {
     Q_OBJECT
@@ -31,6 +121,8 @@ class KPIPEWIRE_EXPORT PipeWireBaseEncodedStream : public QObject
     Q_PROPERTY(bool active READ isActive NOTIFY activeChanged)
     Q_PROPERTY(State state READ state NOTIFY stateChanged)
     Q_PROPERTY(Encoder encoder READ encoder WRITE setEncoder NOTIFY encoderChanged)
+    /// Frame processing statistics, updated every second while the stream is active
+    Q_PROPERTY(PipeWireEncodingStatistics statistics READ statistics NOTIFY statisticsUpdated)
 
 public:
     enum Encoder {
@@ -67,8 +159,9 @@ public:
     void setRequestedSize(const QSize &size);
 
     /**
-     * Defines how many frames are kept in the encoding buffer.
-     * New frames after the buffer is full will be dropped.
+     * Defines how many frames are kept in the filter graph and the encoding
+     * buffer together. New frames after the buffer is full are dropped, or
+     * held back, before they are converted, see setOverloadPolicy().
      *
      * This needs to be high enough for intra-frame analysis.
      * The default value is 50.
@@ -146,6 +239,74 @@ public:
      */
     void setQuality(quint8 quality);
 
+    /**
+     * The lowest quality adaptive quality may drop to, if enabled.
+     */
+    std::optional<quint8> minimumQuality() const;
+    /**
+     * Enable adaptive quality.
+     *
+     * When the encoder cannot keep up with the source, the quality is lowered
+     * step by step, down to @p minimumQuality, instead of dropping frames. It
+     * goes back up to the quality set with setQuality() once the encoder has
+     * room again. The current value is reported in statistics().
+     *
+     * This requires setQuality() to be called as well and an encoder that can
+     * change its quality while encoding, currently libx264. Can be changed
+     * while the stream is active.
+     *
+     * @param minimumQuality The lowest quality to use, in the same range as setQuality().
+     */
+    void setMinimumQuality(quint8 minimumQuality);
+
+    /**
+     * The average bitrate to aim for, in bits per second.
+     */
+    std::optional<qint64> targetBitrate() const;
+    /**
+     * Use bitrate based rate control instead of the quality.
+     *
+     * Without a maximum bitrate the encoder aims for @p bitrate on average,
+     * see setMaxBitrate() to limit the peaks, e.g. to stay within the uplink of
+     * a live stream.
+     *
+     * The bitrates and the buffer size can be changed while the stream is
+     * active, with encoders that support it (libx264) they apply to the next
+     * frame, with the others once the encoder is rebuilt. Switching between
+     * quality and bitrate based rate control only applies to the next stream.
+     *
+     * @param bitrate The bitrate in bits per second, 0 to go back to quality based rate control.
+     */
+    void setTargetBitrate(qint64 bitrate);
+
+    /**
+     * The peak bitrate, in bits per second.
+     */
+    std::optional<qint64> maxBitrate() const;
+    /**
+     * Limit the bitrate to @p bitrate bits per second, measured over the buffer size.
+     *
+     * Only has an effect together with setTargetBitrate(). A maximum equal to
+     * the target gives a constant bitrate, a higher one a variable bitrate.
+     *
+     * @param bitrate The bitrate in bits per second, 0 for no limit.
+     */
+    void setMaxBitrate(qint64 bitrate);
+
+    /**
+     * The size of the rate control buffer, in bits.
+     */
+    std::optional<qint64> bufferSize() const;
+    /**
+     * Set the size of the rate control (VBV) buffer.
+     *
+     * It is the window the maximum bitrate is enforced over. Defaults to one
+     * second worth of the maximum bitrate. Not supported by libopenh264.
+     *
+     * @param bits The size in bits, 0 for the default.
+     */
+    void setBufferSize(qint64 bits);
+
     enum State {
         Idle, //< ready to get started
         Recording, //< actively recording
@@ -183,6 +344,49 @@ public:
     Q_ENUM(ColorRange)
     void setColorRange(ColorRange colorRange);
 
+    /**
+     * How many threads the filter graphs of software encoders use to convert
+     * and scale frames, next to the encoder's own threads.
+     *
+     * The default of 0 picks about one thread per megapixel, using at most
+     * half of the CPU cores. It needs to be set before the stream starts.
+     */
+    void setConversionThreads(int threads);
+    int conversionThreads() const;
+
+    /**
+     * What happens to new frames while the encoder cannot keep up.
+     *
+     * Frames are let in before they are converted, as long as the filter and
+     * encode queues together hold fewer than the maximum pending frames, see
+     * setMaxPendingFrames(). The frames that are not let in are dropped
+     * without spending any time on them.
+     *
+     * DropOldest only keeps frames that don't need their PipeWire buffer to be
+     * encoded, others are dropped as with DropNewest. DMA-BUF frames are only kept
+     * when a software encoder has them read back already, memory frames when they
+     * are leased or copied, see PipeWireSourceStream::setMaxLeasedFrames().
+     */
+    enum class OverloadPolicy {
+        DropNewest, ///< Drop the frames arriving while the queues are full, the default
+        DropOldest, ///< Keep the latest frame until there is room for it, dropping the one kept before
+        KeepEveryNth, ///< Once the queues are half full, only let in every Nth frame
+    };
+    Q_ENUM(OverloadPolicy)
+    /**
+     * @param keepInterval For KeepEveryNth, every how many frames one is let in.
+     */
+    void setOverloadPolicy(OverloadPolicy policy, int keepInterval = 2);
+    OverloadPolicy overloadPolicy() const;
+
+    /**
+     * The latest frame processing statistics.
+     *
+     * They are updated every second while the stream is active, and keep
+     * their last values after it stopped.
+     */
+    PipeWireEncodingStatistics statistics() const;
+
 Q_SIGNALS:
     void activeChanged(bool active);
     void nodeIdChanged(uint nodeId);
@@ -193,10 +397,13 @@ Q_SIGNALS:
     void stateChanged();
     void encoderChanged();
     void objectSerialChanged();
+    void statisticsUpdated();
 
 protected:
     virtual std::unique_ptr<PipeWireProduce> makeProduce() = 0;
     EncodingPreference encodingPreference();
+    /// The producer of the running stream, if any
+    PipeWireProduce *produce() const;
 
     QScopedPointer<PipeWireEncodedStreamPrivate> d;
 };
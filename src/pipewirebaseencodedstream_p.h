@@ -0,0 +1,41 @@
+/*
+    SPDX-FileCopyrightText: 2022-2023 Aleix Pol Gonzalez <aleixpol@kde.org>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <QThread>
+
+#include <memory>
+#include <optional>
+
+#include "pipewirebaseencodedstream.h"
+#include "pipewireproduce_p.h"
+
+struct PipeWireEncodedStreamPrivate {
+    uint m_nodeId = 0;
+    quint64 m_objectSerial = quint64(-1);
+    std::optional<uint> m_fd;
+    Fraction m_maxFramerate;
+    QSize m_requestedSize;
+    int m_maxPendingFrames = 50;
+    bool m_active = false;
+    PipeWireBaseEncodedStream::Encoder m_encoder = PipeWireBaseEncodedStream::NoEncoder;
+    std::optional<quint8> m_quality;
+    std::optional<quint8> m_minimumQuality;
+    RateControl m_rateControl;
+    PipeWireBaseEncodedStream::EncodingPreference m_encodingPreference;
+    PipeWireBaseEncodedStream::State m_state = PipeWireBaseEncodedStream::Idle;
+    PipeWireBaseEncodedStream::ColorRange m_colorRange = PipeWireBaseEncodedStream::ColorRange::Limited;
+    int m_conversionThreads = 0;
+    PipeWireBaseEncodedStream::OverloadPolicy m_overloadPolicy = PipeWireBaseEncodedStream::OverloadPolicy::DropNewest;
+    int m_overloadKeepInterval = 2;
+    PipeWireEncodingStatistics m_statistics;
+    // Only used by PipeWireEncodedStream
+    QList<SimulcastLayer> m_layers;
+
+    std::unique_ptr<QThread> m_produceThread;
+    std::unique_ptr<PipeWireProduce> m_produce;
+};
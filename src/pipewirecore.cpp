@@ -8,16 +8,22 @@
 #include "pipewirecore_p.h"
 
 #include <KLocalizedString>
+#include <QMutex>
 #include <QSocketNotifier>
 #include <QThread>
 #include <QThreadStorage>
+#include <cstring>
 #include <mutex>
+#include <pthread.h>
 #include <spa/utils/result.h>
 
 #include "logging.h"
 
 using namespace Qt::StringLiterals;
 
+// Below PipeWire's own data threads, we only want to be ahead of the desktop
+static constexpr int s_realtimePriority = 10;
+
 pw_core_events PipeWireCore::s_pwCoreEvents = {
     .version = PW_VERSION_CORE_EVENTS,
     .info = &PipeWireCore::onCoreInfo,
@@ -65,7 +71,9 @@ void PipeWireCore::onCoreInfo(void *data, const struct pw_core_info *info)
 
 PipeWireCore::~PipeWireCore()
 {
-    if (m_pwMainLoop) {
+    if (m_threadLoop) {
+        pw_thread_loop_stop(m_threadLoop);
+    } else if (m_pwMainLoop) {
         pw_loop_leave(m_pwMainLoop);
     }
 
@@ -77,7 +85,10 @@ PipeWireCore::~PipeWireCore()
         pw_context_destroy(m_pwContext);
     }
 
-    if (m_pwMainLoop) {
+    if (m_threadLoop) {
+        // Owns m_pwMainLoop
+        pw_thread_loop_destroy(m_threadLoop);
+    } else if (m_pwMainLoop) {
         pw_loop_destroy(m_pwMainLoop);
     }
 }
@@ -113,6 +124,76 @@ bool PipeWireCore::init(int fd)
     return init_core();
 }
 
+bool PipeWireCore::initThreaded(int fd, bool realtime)
+{
+    m_threadLoop = pw_thread_loop_new("kpipewire", nullptr);
+    if (!m_threadLoop) {
+        const KLocalizedString error =
+            ki18n("Invalid PipeWire installation. See https://gitlab.freedesktop.org/pipewire/pipewire/-/issues/3296 for more details.");
+        qCWarning(PIPEWIRE_LOGGING) << error.untranslatedText();
+        m_error = error.toString();
+        return false;
+    }
+    m_pwMainLoop = pw_thread_loop_get_loop(m_threadLoop);
+
+    m_pwContext = pw_context_new(m_pwMainLoop, nullptr, 0);
+    if (!m_pwContext) {
+        qCWarning(PIPEWIRE_LOGGING) << "Failed to create PipeWire context";
+        m_error = i18n("Failed to create PipeWire context");
+        return false;
+    }
+
+    m_fd = fd;
+
+    // The thread isn't running yet, so nothing to lock against
+    if (!init_core()) {
+        return false;
+    }
+
+    if (pw_thread_loop_start(m_threadLoop) < 0) {
+        qCWarning(PIPEWIRE_LOGGING) << "Failed to start PipeWire thread";
+        m_error = i18n("Failed to start main PipeWire loop");
+        return false;
+    }
+
+    if (realtime) {
+        pw_loop_invoke(m_pwMainLoop, &PipeWireCore::acquireRealtime, 0, nullptr, 0, true, this);
+    }
+    return true;
+}
+
+int PipeWireCore::acquireRealtime(spa_loop *loop, bool async, uint32_t seq, const void *data, size_t size, void *userData)
+{
+    Q_UNUSED(loop)
+    Q_UNUSED(async)
+    Q_UNUSED(seq)
+    Q_UNUSED(data)
+    Q_UNUSED(size)
+    Q_UNUSED(userData)
+
+    sched_param param{};
+    param.sched_priority = s_realtimePriority;
+    const int result = pthread_setschedparam(pthread_self(), SCHED_FIFO | SCHED_RESET_ON_FORK, &param);
+    if (result != 0) {
+        qCWarning(PIPEWIRE_LOGGING) << "Could not make the PipeWire thread realtime, using normal scheduling:" << strerror(result);
+    }
+    return 0;
+}
+
+void PipeWireCore::lock()
+{
+    if (m_threadLoop) {
+        pw_thread_loop_lock(m_threadLoop);
+    }
+}
+
+void PipeWireCore::unlock()
+{
+    if (m_threadLoop) {
+        pw_thread_loop_unlock(m_threadLoop);
+    }
+}
+
 bool PipeWireCore::init_core()
 {
     if (m_fd > 0) {
@@ -126,7 +207,8 @@ bool PipeWireCore::init_core()
         return false;
     }
 
-    if (pw_loop_iterate(m_pwMainLoop, 0) < 0) {
+    // A thread loop iterates on its own
+    if (!m_threadLoop && pw_loop_iterate(m_pwMainLoop, 0) < 0) {
         qCWarning(PIPEWIRE_LOGGING) << "Failed to start main PipeWire loop";
         m_error = i18n("Failed to start main PipeWire loop");
         return false;
@@ -149,6 +231,23 @@ QSharedPointer<PipeWireCore> PipeWireCore::fetch(int fd)
     return ret;
 }
 
+QSharedPointer<PipeWireCore> PipeWireCore::fetchThreaded(int fd, bool realtime)
+{
+    // Not tied to the calling thread, so they can be shared by the whole process
+    static QMutex mutex;
+    static QHash<std::pair<int, bool>, QWeakPointer<PipeWireCore>> global;
+
+    QMutexLocker locker(&mutex);
+    QSharedPointer<PipeWireCore> ret = global.value({fd, realtime}).toStrongRef();
+    if (!ret) {
+        ret.reset(new PipeWireCore);
+        if (ret->initThreaded(fd, realtime)) {
+            global.insert({fd, realtime}, ret);
+        }
+    }
+    return ret;
+}
+
 QString PipeWireCore::error() const
 {
     return m_error;
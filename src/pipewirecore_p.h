@@ -25,6 +25,15 @@ public:
     ~PipeWireCore();
 
     bool init(int fd);
+    /**
+     * Like init(), but runs the loop on a dedicated thread instead of the
+     * calling thread's event loop. Stream callbacks then run on that thread,
+     * so any access to PipeWire objects from elsewhere needs to lock() the core.
+     *
+     * With @p realtime the loop thread asks for SCHED_FIFO scheduling, which
+     * falls back to normal scheduling if the process isn't allowed to.
+     */
+    bool initThreaded(int fd, bool realtime);
     bool init_core();
     QString error() const;
     QVersionNumber serverVersion() const
@@ -42,9 +51,23 @@ public:
         return m_pwCore;
     };
     static QSharedPointer<PipeWireCore> fetch(int fd);
+    static QSharedPointer<PipeWireCore> fetchThreaded(int fd, bool realtime);
+
+    bool isThreaded() const
+    {
+        return m_threadLoop;
+    }
+
+    // Locks the loop thread out, if there is one. Can be nested and may be
+    // called from within callbacks running on the loop thread.
+    void lock();
+    void unlock();
 
 private:
+    static int acquireRealtime(spa_loop *loop, bool async, uint32_t seq, const void *data, size_t size, void *userData);
+
     int m_fd = 0;
+    pw_thread_loop *m_threadLoop = nullptr;
     pw_core *m_pwCore = nullptr;
     pw_context *m_pwContext = nullptr;
     pw_loop *m_pwMainLoop = nullptr;
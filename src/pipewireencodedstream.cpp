@@ -5,6 +5,7 @@
 */
 
 #include "pipewireencodedstream.h"
+#include "pipewirebaseencodedstream_p.h"
 #include "pipewireencodedstream_p.h"
 #include "pipewireproduce_p.h"
 #include <QDebug>
@@ -61,6 +62,11 @@ void PipeWireEncodeProduce::processPacket(AVPacket *packet)
     Q_EMIT newPacket(PipeWireEncodedStream::Packet(packet->flags & AV_PKT_FLAG_KEY, QByteArray(reinterpret_cast<char *>(packet->data), packet->size)));
 }
 
+std::unique_ptr<PipeWireProduce> PipeWireEncodeProduce::makeLayer(int index)
+{
+    return std::make_unique<PipeWireEncodeLayerProduce>(index, this);
+}
+
 void PipeWireEncodeProduce::processFrame(const PipeWireFrame &frame)
 {
     if (m_size != m_stream->size()) {
@@ -75,6 +81,24 @@ void PipeWireEncodeProduce::processFrame(const PipeWireFrame &frame)
     }
 }
 
+PipeWireEncodeLayerProduce::PipeWireEncodeLayerProduce(int index, PipeWireEncodeProduce *produce)
+    : PipeWireProduce(produce->m_encoderType, produce->m_nodeId, produce->m_objectSerial, 0, produce->m_frameRate)
+    , m_index(index)
+    , m_produce(produce)
+{
+}
+
+void PipeWireEncodeLayerProduce::processPacket(AVPacket *packet)
+{
+    if (!packet) {
+        return;
+    }
+
+    Q_EMIT m_produce->newLayerPacket(m_index,
+                                     PipeWireEncodedStream::Packet(packet->flags & AV_PKT_FLAG_KEY,
+                                                                   QByteArray(reinterpret_cast<char *>(packet->data), packet->size)));
+}
+
 PipeWireEncodedStream::PipeWireEncodedStream(QObject *parent)
     : PipeWireBaseEncodedStream(parent)
 {
@@ -82,10 +106,39 @@ PipeWireEncodedStream::PipeWireEncodedStream(QObject *parent)
 
 PipeWireEncodedStream::~PipeWireEncodedStream() = default;
 
+void PipeWireEncodedStream::requestKeyFrame()
+{
+    if (auto produce = this->produce()) {
+        produce->requestKeyFrame();
+    }
+}
+
+int PipeWireEncodedStream::addLayer(const QSize &maxSize, const Fraction &maxFramerate, qint64 targetBitrate)
+{
+    d->m_layers.append({
+        .maxSize = maxSize,
+        .maxFramerate = maxFramerate,
+        .targetBitrate = targetBitrate > 0 ? std::optional(targetBitrate) : std::nullopt,
+    });
+    return d->m_layers.size() - 1;
+}
+
+void PipeWireEncodedStream::clearLayers()
+{
+    d->m_layers.clear();
+}
+
+int PipeWireEncodedStream::layerCount() const
+{
+    return d->m_layers.size();
+}
+
 std::unique_ptr<PipeWireProduce> PipeWireEncodedStream::makeProduce()
 {
     auto produce = new PipeWireEncodeProduce(encoder(), nodeId(), objectSerial(), fd(), maxFramerate(), this);
+    produce->m_layerSettings = d->m_layers;
     connect(produce, &PipeWireEncodeProduce::newPacket, this, &PipeWireEncodedStream::newPacket);
+    connect(produce, &PipeWireEncodeProduce::newLayerPacket, this, &PipeWireEncodedStream::newLayerPacket);
     connect(this, &PipeWireEncodedStream::maxFramerateChanged, produce, [this, produce]() {
         produce->setMaxFramerate(maxFramerate());
     });
@@ -33,11 +33,47 @@ public:
         std::shared_ptr<PipeWirePacketPrivate> d;
     };
 
+    /**
+     * Make the next encoded frame a key frame.
+     *
+     * Useful when a new consumer joins or packets were lost, as decoding can
+     * only start from a key frame. The request applies to the next frame that
+     * reaches the encoder, which means it only takes effect once the source
+     * provides a new frame. Several requests before then result in a single
+     * key frame.
+     *
+     * Applies to all simulcast layers as well.
+     */
+    Q_INVOKABLE void requestKeyFrame();
+
+    /**
+     * Add a simulcast layer.
+     *
+     * Every layer is encoded from the same capture as the main stream, with an
+     * encoder of its own, and its packets are emitted with newLayerPacket().
+     * It uses the encoder and the other settings of this stream. Layers only
+     * take effect when the stream is started, add them before setActive().
+     *
+     * @param maxSize The frames are scaled down to fit this size, keeping the aspect ratio. They are not scaled up.
+     * @param maxFramerate The highest framerate of the layer, an invalid one uses the stream's maxFramerate().
+     * @param targetBitrate The average bitrate in bits per second, 0 uses the rate control of the stream.
+     *
+     * @return The index of the layer.
+     */
+    int addLayer(const QSize &maxSize, const Fraction &maxFramerate, qint64 targetBitrate = 0);
+    /**
+     * Remove all simulcast layers, takes effect when the stream is started.
+     */
+    void clearLayers();
+    int layerCount() const;
+
 Q_SIGNALS:
     /// will be emitted when the stream initializes as well as when the value changes
     void sizeChanged(const QSize &size);
     void cursorChanged(const PipeWireCursor &cursor);
     void newPacket(const Packet &packet);
+    /// A packet of the simulcast layer with index @p layer, see addLayer()
+    void newLayerPacket(int layer, const Packet &packet);
 
 protected:
     std::unique_ptr<PipeWireProduce> makeProduce() override;
@@ -28,12 +28,44 @@ public:
     {
         return true;
     }
+    // Remote desktop and the like would rather skip stale frames than lag behind
+    bool prefersLatestFrame() const override
+    {
+        return true;
+    }
+
+protected:
+    std::unique_ptr<PipeWireProduce> makeLayer(int index) override;
 
 Q_SIGNALS:
     void newPacket(const PipeWireEncodedStream::Packet &packetData);
+    void newLayerPacket(int layer, const PipeWireEncodedStream::Packet &packetData);
 
 private:
     PipeWireEncodedStream *const m_encodedStream;
     QSize m_size;
     PipeWireCursor m_cursor;
 };
+
+/**
+ * A simulcast layer of a PipeWireEncodeProduce.
+ *
+ * It has no stream of its own, the frames are handed to it by the producer it
+ * belongs to.
+ */
+class PipeWireEncodeLayerProduce : public PipeWireProduce
+{
+    Q_OBJECT
+public:
+    PipeWireEncodeLayerProduce(int index, PipeWireEncodeProduce *produce);
+
+    void processPacket(AVPacket *packet) override;
+    bool supportsResize() const override
+    {
+        return true;
+    }
+
+private:
+    const int m_index;
+    PipeWireEncodeProduce *const m_produce;
+};
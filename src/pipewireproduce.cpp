@@ -18,9 +18,11 @@
 #include <limits>
 #include <memory>
 #include <qstringliteral.h>
+#include <utility>
 
 #include "audioconstants_p.h"
 #include "audioencoder_p.h"
+#include "framedownload_p.h"
 #include "gifencoder_p.h"
 #include "h264vaapiencoder_p.h"
 #include "libopenh264encoder_p.h"
@@ -29,6 +31,7 @@
 #include "libwebpencoder_p.h"
 #include "libx264encoder_p.h"
 #include "pipewireaudiosourcestream_p.h"
+#include "pwhelpers.h"
 
 #include "logging_frame_statistics.h"
 #if defined(Q_OS_OPENBSD)
@@ -38,9 +41,7 @@
 
 extern "C" {
 #include <fcntl.h>
-#include <libavutil/channel_layout.h>
 #include <libavutil/frame.h>
-#include <libavutil/samplefmt.h>
 }
 
 Q_DECLARE_METATYPE(std::optional<int>);
@@ -85,6 +86,8 @@ PipeWireProduce::PipeWireProduce(PipeWireBaseEncodedStream::Encoder encoderType,
 
 PipeWireProduce::~PipeWireProduce()
 {
+    stopLayers();
+    av_frame_free(&m_downloadFrame);
 }
 
 void PipeWireProduce::initialize()
@@ -92,6 +95,15 @@ void PipeWireProduce::initialize()
     m_stream.reset(new PipeWireSourceStream(nullptr));
     m_stream->setMaxFramerate(m_frameRate);
     m_stream->setRequestedSize(m_requestedSize);
+    // Lets processFrame() tell frames that are the same as the previous one apart,
+    // also for sources that don't report damage. Hashing a frame costs far less
+    // than converting and encoding it.
+    m_stream->setDamageEnabled(true);
+    m_stream->setDamageDetectionEnabled(true);
+    // Frames are queued to this thread and m_lastFrame is kept around for the
+    // repeat timer, lease their buffers so the data stays valid without a copy.
+    m_stream->setMaxLeasedFrames(2);
+    m_stream->setAlwaysLatest(prefersLatestFrame());
 
     // The check in supportsHardwareEncoding() is insufficient to fully
     // determine if we actually support hardware encoding the current stream,
@@ -115,18 +127,43 @@ void PipeWireProduce::initialize()
         return;
     }
     connect(m_stream.get(), &PipeWireSourceStream::streamParametersChanged, this, &PipeWireProduce::handleStreamParametersChanged);
+    // Renegotiating keeps the imports of the old buffers around if the layout stays the same
+    connect(m_stream.get(), &PipeWireSourceStream::streamParametersChanged, this, &PipeWireProduce::forgetBuffers);
+    connect(m_stream.get(), &PipeWireSourceStream::bufferRemoved, this, &PipeWireProduce::forgetBuffers);
+
+    m_frameStatisticsTimer = std::make_unique<QTimer>();
+    m_frameStatisticsTimer->setInterval(std::chrono::seconds(1));
+    connect(m_frameStatisticsTimer.get(), &QTimer::timeout, this, [this]() {
+        auto statistics = m_statistics.takeSnapshot(m_pendingFilterFrames, m_pendingEncodeFrames);
+        statistics.skippedFrames = m_stream ? m_stream->skippedFrames() : 0;
+        adaptQuality(statistics);
+        if (PIPEWIRERECORDFRAMESTATS_LOGGING().isDebugEnabled()) {
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << "Captured" << statistics.capturedFrames << "filtered" << statistics.filteredFrames << "encoded"
+                                                      << statistics.encodedFrames << "dropped" << statistics.droppedFrames() << "unchanged"
+                                                      << statistics.unchangedFrames << "skipped by the stream" << statistics.skippedFrames << "frames so far.";
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << statistics.pendingFilterFrames << "frames pending for filter.";
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << statistics.pendingEncodeFrames << "frames pending for encode.";
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << "Latency p50/p99 in us: filter" << statistics.filterLatencyP50 << statistics.filterLatencyP99 << "encode"
+                                                      << statistics.encodeLatencyP50 << statistics.encodeLatencyP99 << "total" << statistics.totalLatencyP50
+                                                      << statistics.totalLatencyP99;
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << "Conversion time p50/p99 in us:" << statistics.conversionTimeP50 << statistics.conversionTimeP99;
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << "Output bitrate" << statistics.bitrate << "bits/s.";
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << "Encoder load" << statistics.encoderLoad << "%, adaptive quality" << statistics.adaptiveQuality
+                                                      << "after" << statistics.qualityAdjustments << "adjustments.";
+            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << m_wrappedFrames << "frames passed to libav in place," << m_copiedFrames << "copied,"
+                                                      << m_convertedFrames << "converted.";
+        }
+        m_wrappedFrames = 0;
+        m_copiedFrames = 0;
+        m_convertedFrames = 0;
+        Q_EMIT statisticsUpdated(statistics);
+    });
 
-    if (PIPEWIRERECORDFRAMESTATS_LOGGING().isDebugEnabled()) {
-        m_frameStatisticsTimer = std::make_unique<QTimer>();
-        m_frameStatisticsTimer->setInterval(std::chrono::seconds(1));
-        connect(m_frameStatisticsTimer.get(), &QTimer::timeout, this, [this]() {
-            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << "Processed" << m_processedFrames << "frames in the last second.";
-            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << m_pendingFilterFrames << "frames pending for filter.";
-            qCDebug(PIPEWIRERECORDFRAMESTATS_LOGGING) << m_pendingEncodeFrames << "frames pending for encode.";
-            m_processedFrames = 0;
-        });
-    }
+    createFrameRepeatTimer();
+}
 
+void PipeWireProduce::createFrameRepeatTimer()
+{
     /**
      * Kwin only sends a new frame when there's damage on screen
      * The encoder does not flush all frames whilst a stream is active
@@ -142,15 +179,31 @@ void PipeWireProduce::initialize()
         if (!m_encoder) {
             return;
         }
-        auto f = m_lastFrame;
+        if (m_heldFrame || !FrameAdmission::hasRoom(m_pendingFilterFrames + m_pendingEncodeFrames, m_maxPendingFrames)) {
+            // The encoder is busy with newer frames, try again later
+            m_frameRepeatTimer->start();
+            return;
+        }
+        // The last frame's buffer went back to PipeWire after it was handled. That
+        // is fine for what the encoder has seen already, but content the encoder
+        // never got can only come from a frame that keeps its own data.
+        const bool newContent = !m_filterDamage || !m_filterDamage->isEmpty();
+        const auto kept = newContent ? keepableFrame(m_lastFrame) : std::optional(m_lastFrame);
         m_lastFrame = {};
+        if (!kept) {
+            qCDebug(PIPEWIRERECORD_LOGGING) << "Not repeating a frame whose buffer is gone, waiting for the next one";
+            return;
+        }
+        auto f = *kept;
+        f.damage = m_filterDamage;
         aboutToEncode(f);
         if (!m_encoder->filterFrame(f)) {
             return;
         }
 
+        m_filterDamage = QRegion();
         m_pendingFilterFrames++;
-        m_passthroughCondition.notify_all();
+        m_passthroughSignal.notify();
     });
 }
 
@@ -249,16 +302,15 @@ void PipeWireProduce::setupStream()
     connect(m_stream.data(), &PipeWireSourceStream::frameReceived, this, &PipeWireProduce::processFrame);
 
     startThreads();
+    startLayers();
 
-    if (m_frameStatisticsTimer) {
-        m_frameStatisticsTimer->start();
-    }
+    m_frameStatisticsTimer->start();
     Q_EMIT started();
 }
 
 void PipeWireProduce::reconfigureStream()
 {
-    const auto newSize = m_stream->size();
+    const auto newSize = sourceStream()->size();
     qCDebug(PIPEWIRERECORD_LOGGING) << "Source size changed from" << m_encoderSize << "to" << newSize << "- rebuilding encoder";
 
     // Stop the worker threads so nothing touches the encoder while we swap it.
@@ -279,6 +331,10 @@ void PipeWireProduce::reconfigureStream()
     // rebuilt; the output format is left untouched. This is gated to consumers
     // that opt in via supportsResize() and do not write a fixed container.
     startThreads();
+
+    for (const auto &layer : m_layers) {
+        layer->reconfigureStream();
+    }
 }
 
 void PipeWireProduce::discardFrameState()
@@ -292,18 +348,23 @@ void PipeWireProduce::discardFrameState()
         m_frameRepeatTimer->stop();
     }
     m_lastFrame = {};
+    m_heldFrame.reset();
     m_pendingFilterFrames = 0;
     m_pendingEncodeFrames = 0;
+    m_statistics.discardPending();
 }
 
 void PipeWireProduce::startThreads()
 {
+    // Set before the threads exist so a stopThreads() right after can't be missed
+    m_passthroughRunning = true;
     m_passthroughThread = std::thread([this]() {
-        m_passthroughRunning = true;
-        while (m_passthroughRunning) {
-            std::unique_lock<std::mutex> lock(m_passthroughMutex);
-            m_passthroughCondition.wait(lock);
-
+        for (;;) {
+            // Taken before looking at the filter graph, so frames pushed while
+            // we're busy wake us up again instead of waiting for the next one.
+            // The running flag is checked after it, so a stopThreads() in between
+            // can't have its wakeup swallowed before we park.
+            const auto seen = m_passthroughSignal.generation();
             if (!m_passthroughRunning) {
                 break;
             }
@@ -312,7 +373,15 @@ void PipeWireProduce::startThreads()
             m_pendingFilterFrames -= filtered;
             m_pendingEncodeFrames += queued;
 
-            m_outputCondition.notify_all();
+            if (queued > 0) {
+                m_outputSignal.notify();
+            }
+            if (filtered > queued) {
+                // Frames were dropped on the way to the encoder, which a flush may be waiting on
+                QMetaObject::invokeMethod(this, &PipeWireProduce::handleEncodedFramesChanged, Qt::QueuedConnection);
+            }
+
+            m_passthroughSignal.wait(seen);
         }
     });
 #if defined(Q_OS_OPENBSD)
@@ -321,19 +390,16 @@ void PipeWireProduce::startThreads()
     pthread_setname_np(m_passthroughThread.native_handle(), "PipeWireProduce::passthrough");
 #endif
 
+    m_outputRunning = true;
     m_outputThread = std::thread([this]() {
-        m_outputRunning = true;
-        while (m_outputRunning) {
-            std::unique_lock<std::mutex> lock(m_outputMutex);
-            m_outputCondition.wait(lock);
-
+        for (;;) {
+            const auto seen = m_outputSignal.generation();
             if (!m_outputRunning) {
                 break;
             }
 
             auto received = m_encoder->receivePacket();
             m_pendingEncodeFrames -= received;
-            m_processedFrames += received;
             if (received > 0) {
                 m_anyFrameEncoded = true;
             }
@@ -343,10 +409,14 @@ void PipeWireProduce::startThreads()
                 m_audioEncoder->receivePacket();
             }
 
-            // Notify the produce thread that the count of processed frames has
-            // changed and it can do cleanup if needed, making sure that that
-            // handling is done on the right thread.
-            QMetaObject::invokeMethod(this, &PipeWireProduce::handleEncodedFramesChanged, Qt::QueuedConnection);
+            if (received > 0) {
+                // Notify the produce thread that the count of processed frames has
+                // changed and it can do cleanup if needed, making sure that that
+                // handling is done on the right thread.
+                QMetaObject::invokeMethod(this, &PipeWireProduce::handleEncodedFramesChanged, Qt::QueuedConnection);
+            }
+
+            m_outputSignal.wait(seen);
         }
     });
 #if defined(Q_OS_OPENBSD)
@@ -360,17 +430,194 @@ void PipeWireProduce::stopThreads()
 {
     if (m_passthroughThread.joinable()) {
         m_passthroughRunning = false;
-        m_passthroughCondition.notify_all();
+        m_passthroughSignal.notify();
         m_passthroughThread.join();
     }
 
     if (m_outputThread.joinable()) {
         m_outputRunning = false;
-        m_outputCondition.notify_all();
+        m_outputSignal.notify();
         m_outputThread.join();
     }
 }
 
+void PipeWireProduce::startLayers()
+{
+    m_shareDownloads = dynamic_cast<SoftwareEncoder *>(m_encoder.get());
+
+    for (int i = 0; i < m_layerSettings.size(); ++i) {
+        auto layer = makeLayer(i);
+        if (!layer) {
+            qCWarning(PIPEWIRERECORD_LOGGING) << "Simulcast is not supported by this stream";
+            return;
+        }
+
+        const auto &settings = m_layerSettings.at(i);
+        layer->m_source = this;
+        layer->m_maxEncodeSize = settings.maxSize;
+        layer->m_maxFramerate = settings.maxFramerate ? settings.maxFramerate : m_maxFramerate;
+        layer->m_maxPendingFrames = int(m_maxPendingFrames);
+        layer->m_quality = m_quality;
+        layer->m_encodingPreference = m_encodingPreference;
+        layer->m_colorRange = m_colorRange;
+        layer->m_conversionThreads = m_conversionThreads;
+        layer->m_admission = m_admission;
+        layer->m_rateControl = settings.targetBitrate ? RateControl{.targetBitrate = settings.targetBitrate} : m_rateControl;
+        if (!layer->startLayer()) {
+            qCWarning(PIPEWIRERECORD_LOGGING) << "Could not create an encoder for simulcast layer" << i << "at" << layer->encodeSize();
+            continue;
+        }
+
+        m_shareDownloads = m_shareDownloads || dynamic_cast<SoftwareEncoder *>(layer->m_encoder.get());
+        m_layers.push_back(std::move(layer));
+    }
+}
+
+bool PipeWireProduce::startLayer()
+{
+    m_encoder = makeEncoder();
+    if (!m_encoder) {
+        return false;
+    }
+    m_encoderSize = sourceStream()->size();
+
+    createFrameRepeatTimer();
+    startThreads();
+    return true;
+}
+
+void PipeWireProduce::stopLayers()
+{
+    for (const auto &layer : m_layers) {
+        layer->m_frameRepeatTimer->stop();
+        layer->stopThreads();
+    }
+    m_layers.clear();
+}
+
+void PipeWireProduce::flushLayers()
+{
+    for (const auto &layer : m_layers) {
+        layer->m_frameRepeatTimer->stop();
+        layer->stopThreads();
+
+        // With the worker threads joined, drain the layer single-threaded the way
+        // the main encoder is drained by them: alternate between encoding and
+        // receiving until the filter graph is empty, then flush the codec.
+        for (;;) {
+            auto [filtered, queued] = layer->m_encoder->encodeFrame(layer->m_maxPendingFrames - layer->m_pendingEncodeFrames);
+            layer->m_pendingFilterFrames -= filtered;
+            layer->m_pendingEncodeFrames += queued;
+            auto received = layer->m_encoder->receivePacket();
+            layer->m_pendingEncodeFrames -= received;
+            if (filtered == 0 && queued == 0 && received == 0) {
+                break;
+            }
+        }
+        layer->m_encoder->finish();
+        while (layer->m_encoder->receivePacket() > 0) { }
+    }
+}
+
+PipeWireFrame PipeWireProduce::shareFrame(const PipeWireFrame &frame)
+{
+    if (!m_shareDownloads || !frame.dmabuf || frame.dataFrame) {
+        return frame;
+    }
+
+    if (!m_download) {
+        m_download = std::make_unique<FrameDownload>();
+        m_downloadFrame = av_frame_alloc();
+        if (!m_downloadFrame) {
+            qFatal("Failed to allocate memory");
+        }
+    }
+
+    // Every frame with an image comes through here, so its damage is relative to the last download
+    const QSize size(frame.dmabuf->width, frame.dmabuf->height);
+    auto shared = frame;
+    if (!m_download->download(m_downloadFrame, frame, frame.damage)) {
+        sourceStream()->renegotiateModifierFailed(frame.format, frame.dmabuf->modifier);
+        // Nothing to encode for the software encoders
+        shared.dmabuf.reset();
+        return shared;
+    }
+
+    auto buffer = av_buffer_ref(m_downloadFrame->buf[0]);
+    if (!buffer) {
+        qFatal("Failed to allocate memory");
+    }
+    const auto data = m_downloadFrame->data[0];
+    const auto stride = m_downloadFrame->linesize[0];
+    av_frame_unref(m_downloadFrame);
+
+    auto cleanup = new PipeWireFrameCleanupFunction([buffer]() mutable {
+        av_buffer_unref(&buffer);
+    });
+    shared.dataFrame = std::make_shared<PipeWireFrameData>(SPA_VIDEO_FORMAT_RGBA, data, size, stride, cleanup);
+    shared.dataFrame->setOutlivesBuffer(true);
+    return shared;
+}
+
+void PipeWireProduce::forgetBuffers()
+{
+    if (m_encoder) {
+        m_encoder->forgetBuffers();
+    }
+    if (m_download) {
+        m_download->forgetBuffers();
+    }
+    for (const auto &layer : m_layers) {
+        layer->forgetBuffers();
+    }
+}
+
+std::optional<PipeWireFrame> PipeWireProduce::keepableFrame(const PipeWireFrame &frame) const
+{
+    if (!frame.dmabuf && !frame.dataFrame) {
+        return frame;
+    }
+
+    // Leased, copied and downloaded frame data stays around with the frame
+    const auto &data = frame.dataFrame;
+    if (!data || !data->outlivesBuffer()) {
+        return std::nullopt;
+    }
+    if (!frame.dmabuf) {
+        return frame;
+    }
+    // A DMA-BUF that was downloaded in shareFrame(), only software encoders use the download
+    if (!dynamic_cast<SoftwareEncoder *>(m_encoder.get())) {
+        return std::nullopt;
+    }
+    auto kept = frame;
+    kept.dmabuf.reset();
+    return kept;
+}
+
+PipeWireSourceStream *PipeWireProduce::sourceStream() const
+{
+    return m_source ? m_source->sourceStream() : m_stream.data();
+}
+
+QSize PipeWireProduce::encodeSize() const
+{
+    const auto stream = sourceStream();
+    const auto size = stream ? stream->size() : QSize();
+    return m_maxEncodeSize.isValid() ? fitLayerSize(size, m_maxEncodeSize) : size;
+}
+
+QSize PipeWireProduce::fitLayerSize(const QSize &source, const QSize &maxSize)
+{
+    if (source.isEmpty() || (source.width() <= maxSize.width() && source.height() <= maxSize.height())) {
+        return source;
+    }
+
+    // Most encoders need even dimensions, and none is smaller than 2 pixels
+    const auto scaled = source.scaled(maxSize, Qt::KeepAspectRatio);
+    return QSize(std::max(2, scaled.width() & ~1), std::max(2, scaled.height() & ~1));
+}
+
 void PipeWireProduce::initializeAudioStreams()
 {
     std::vector<PipeWireAudioSourceStream::Source> sources;
@@ -440,7 +687,7 @@ void PipeWireProduce::handleAudioStreamStopped(int input)
     state.ended = true;
     // Close the encoder input so amix does not wait for data on it
     m_audioEncoder->endInput(input);
-    m_outputCondition.notify_all();
+    m_outputSignal.notify();
 }
 
 std::chrono::steady_clock::time_point PipeWireProduce::recordEpoch()
@@ -506,28 +753,20 @@ void PipeWireProduce::processAudioFrame(int input, const PipeWireAudioFrame &fra
         }
     }
 
-    auto avFrame = av_frame_alloc();
+    auto avFrame = m_audioEncoder->inputFrame(sampleCount, frame.channels, frame.rate);
     if (!avFrame) {
-        qFatal("Failed to allocate memory");
-    }
-    avFrame->format = AV_SAMPLE_FMT_FLT;
-    avFrame->sample_rate = frame.rate;
-    avFrame->nb_samples = sampleCount;
-    av_channel_layout_default(&avFrame->ch_layout, frame.channels);
-    avFrame->pts = state.sampleCount;
-    if (av_frame_get_buffer(avFrame, 0) < 0) {
-        av_frame_free(&avFrame);
         return;
     }
+    avFrame->pts = state.sampleCount;
     // The frame data is only valid for the duration of the signal emission
     std::memcpy(avFrame->data[0], data, sampleCount * frame.channels * sizeof(float));
 
     if (m_audioEncoder->filterFrame(input, avFrame)) {
         state.sampleCount += sampleCount;
     }
-    av_frame_free(&avFrame);
+    av_frame_unref(avFrame);
 
-    m_outputCondition.notify_all();
+    m_outputSignal.notify();
 }
 
 void PipeWireProduce::pushSilence(int input, int64_t sampleCount, quint32 channels, quint32 rate)
@@ -536,32 +775,23 @@ void PipeWireProduce::pushSilence(int input, int64_t sampleCount, quint32 channe
 
     // Push the silence in chunks of at most one second, the gap can be
     // arbitrarily long and a single frame of that size would mean a huge
-    // allocation and overflowing AVFrame's int sample count.
+    // buffer and overflowing AVFrame's int sample count.
     while (sampleCount > 0) {
         const int chunk = int(std::min<int64_t>(sampleCount, rate));
 
-        auto avFrame = av_frame_alloc();
+        auto avFrame = m_audioEncoder->silenceFrame(chunk, channels, rate);
         if (!avFrame) {
-            qFatal("Failed to allocate memory");
-        }
-        avFrame->format = AV_SAMPLE_FMT_FLT;
-        avFrame->sample_rate = rate;
-        avFrame->nb_samples = chunk;
-        av_channel_layout_default(&avFrame->ch_layout, channels);
-        avFrame->pts = state.sampleCount;
-        if (av_frame_get_buffer(avFrame, 0) < 0) {
-            av_frame_free(&avFrame);
             return;
         }
-        av_samples_set_silence(avFrame->data, 0, chunk, channels, AV_SAMPLE_FMT_FLT);
+        avFrame->pts = state.sampleCount;
 
-        if (!m_audioEncoder->filterFrame(input, avFrame)) {
-            av_frame_free(&avFrame);
+        const bool filtered = m_audioEncoder->filterFrame(input, avFrame);
+        av_frame_unref(avFrame);
+        if (!filtered) {
             return;
         }
         state.sampleCount += chunk;
         sampleCount -= chunk;
-        av_frame_free(&avFrame);
     }
 }
 
@@ -585,7 +815,7 @@ void PipeWireProduce::padAudioInputToTarget(int input, std::chrono::steady_clock
     }
     state.anchored = true;
     pushSilence(input, deficit, channels, rate);
-    m_outputCondition.notify_all();
+    m_outputSignal.notify();
 }
 
 void PipeWireProduce::deactivate()
@@ -650,6 +880,13 @@ void PipeWireProduce::destroy()
     m_frameStatisticsTimer = nullptr;
 
     stopThreads();
+    flushLayers();
+    stopLayers();
+
+    // Everything the encoder produced has been counted now
+    auto statistics = m_statistics.takeSnapshot(m_pendingFilterFrames, m_pendingEncodeFrames);
+    statistics.skippedFrames = m_stream ? m_stream->skippedFrames() : 0;
+    Q_EMIT statisticsUpdated(statistics);
 
     if (m_audioEncoder) {
         if (m_audioPadTimer) {
@@ -706,6 +943,58 @@ void PipeWireProduce::setQuality(const std::optional<quint8> &quality)
     }
 }
 
+void PipeWireProduce::setMinimumQuality(const std::optional<quint8> &minimumQuality)
+{
+    m_minimumQuality = minimumQuality;
+    if (m_minimumQuality) {
+        // The controller moves into the new bounds with its next update
+        return;
+    }
+
+    if (m_encoder && m_quality && m_qualityController.quality() && m_qualityController.quality() != m_quality) {
+        // Go back to the configured quality
+        m_encoder->setRuntimeQuality(*m_quality);
+    }
+    m_qualityController.reset();
+}
+
+void PipeWireProduce::adaptQuality(PipeWireEncodingStatistics &statistics)
+{
+    if (!m_encoder || !m_minimumQuality || !m_quality) {
+        return;
+    }
+
+    const AdaptiveQualityController::Load load{
+        .pendingFrames = statistics.pendingFilterFrames + statistics.pendingEncodeFrames,
+        .maxPendingFrames = m_maxPendingFrames,
+        .droppedFrames = statistics.droppedFilterQueueFull + statistics.droppedEncodeQueueFull,
+        .encoderLoad = statistics.encoderLoad,
+    };
+    const auto previous = m_qualityController.quality();
+    const auto quality = m_qualityController.update(load, *m_minimumQuality, *m_quality);
+    if (quality != previous.value_or(*m_quality)) {
+        qCDebug(PIPEWIRERECORD_LOGGING) << "Adapting quality to" << quality << "at an encoder load of" << statistics.encoderLoad << "% and"
+                                        << load.pendingFrames << "pending frames";
+        if (!m_encoder->setRuntimeQuality(quality)) {
+            qCDebug(PIPEWIRERECORD_LOGGING) << "The encoder can not change its quality while encoding, disabling adaptive quality";
+            m_minimumQuality.reset();
+            m_qualityController.reset();
+            return;
+        }
+    }
+
+    statistics.adaptiveQuality = quality;
+    statistics.qualityAdjustments = m_qualityController.adjustments();
+}
+
+void PipeWireProduce::setRateControl(const RateControl &rateControl)
+{
+    m_rateControl = rateControl;
+    if (m_encoder && !m_encoder->setRuntimeRateControl(rateControl)) {
+        qCDebug(PIPEWIRERECORD_LOGGING) << "The encoder can not change its rate control while encoding, it is used once the encoder is rebuilt";
+    }
+}
+
 void PipeWireProduce::setEncodingPreference(const PipeWireBaseEncodedStream::EncodingPreference &encodingPreference)
 {
     m_encodingPreference = encodingPreference;
@@ -723,19 +1012,55 @@ void PipeWireProduce::setColorRange(PipeWireBaseEncodedStream::ColorRange colorR
     }
 }
 
-void PipeWireProduce::processFrame(const PipeWireFrame &frame)
+void PipeWireProduce::setConversionThreads(int threads)
+{
+    m_conversionThreads = threads;
+    if (m_encoder) {
+        qCWarning(PIPEWIRERECORD_LOGGING) << "Changing the conversion threads after encoding has started is not supported";
+    }
+}
+
+void PipeWireProduce::setOverloadPolicy(PipeWireBaseEncodedStream::OverloadPolicy policy, int keepInterval)
+{
+    m_admission.setPolicy(policy, keepInterval);
+    for (const auto &layer : m_layers) {
+        layer->setOverloadPolicy(policy, keepInterval);
+    }
+}
+
+void PipeWireProduce::requestKeyFrame()
+{
+    m_keyFrameRequested = true;
+    m_layerKeyFrameRequested = true;
+}
+
+void PipeWireProduce::processFrame(const PipeWireFrame &sourceFrame)
 {
     if (!m_encoder) {
         return;
     }
 
-    auto f = frame;
-
-    m_lastFrame = frame;
-    if (m_enableFrameRepeat) {
-        m_frameRepeatTimer->start();
+    const auto frame = m_layers.empty() ? sourceFrame : shareFrame(sourceFrame);
+    if (!m_layers.empty()) {
+        const bool keyFrame = m_layerKeyFrameRequested.exchange(false);
+        for (const auto &layer : m_layers) {
+            if (keyFrame) {
+                layer->requestKeyFrame();
+            }
+            layer->processFrame(frame);
+        }
     }
 
+    m_statistics.frameCaptured();
+
+    const bool hasImage = frame.dmabuf || frame.dataFrame;
+    // Frames may still be dropped below, their damage goes to the next one that is encoded
+    if (hasImage && m_filterDamage && frame.damage) {
+        *m_filterDamage += *frame.damage;
+    } else if (hasImage) {
+        m_filterDamage.reset();
+    }
+    const bool cursorChanged = frame.cursor && (frame.cursor->position != m_cursor.position || !frame.cursor->texture.isNull());
     if (frame.cursor) {
         m_cursor.position = frame.cursor->position;
         m_cursor.hotspot = frame.cursor->hotspot;
@@ -745,40 +1070,103 @@ void PipeWireProduce::processFrame(const PipeWireFrame &frame)
         }
     }
 
+    // Skip frames that look the same as the last one: no image at all, only
+    // cursor metadata, or no damage reported. Neither m_lastFrame nor the
+    // repeat timer are touched, so the last frame that was encoded is still
+    // pushed once to flush the encoder, and the next change is encoded with
+    // its own timestamp. The first frame and a frame that should become a
+    // requested key frame are always encoded.
+    const bool unchanged = !hasImage || (frame.damage && frame.damage->isEmpty());
+    if (unchanged && m_previousPts >= 0 && !(hasImage && m_keyFrameRequested) && (!m_cursorInFrames || (hasImage && !cursorChanged))) {
+        m_statistics.frameUnchanged();
+        return;
+    }
+
+    m_lastFrame = frame;
+    if (m_enableFrameRepeat) {
+        m_frameRepeatTimer->start();
+    }
+
     auto pts = framePts(frame.presentationTimestamp);
     // Always accept the first frame: it carries the initial screen content
     // and, for a static screen, may be the only frame ever delivered.
     if (m_previousPts >= 0) {
         if (pts <= m_previousPts) {
+            m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::OutOfOrder);
             return;
         }
 
-        auto frameTime = 1000.0 / (m_maxFramerate.numerator / m_maxFramerate.denominator);
-        if ((pts - m_previousPts) < frameTime) {
+        // Compared as fractions, so framerates like 60000/1001 are limited
+        // exactly. One unit of slack makes up for the truncated timestamps.
+        const int64_t elapsed = pts - m_previousPts + 1;
+        if (m_maxFramerate.numerator > 0 && elapsed * m_maxFramerate.numerator < int64_t(FrameTimeBase.den) * m_maxFramerate.denominator) {
+            m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::FramerateLimit);
             return;
         }
     }
 
-    if (m_pendingFilterFrames + 1 > m_maxPendingFrames) {
-        qCWarning(PIPEWIRERECORD_LOGGING) << "Filter queue is full, dropping frame" << pts;
+    // Decide before converting the frame, so no time is spent on frames the
+    // encoder has no room for. The filter graph and the encoder share the budget.
+    const int inFlight = m_pendingFilterFrames + m_pendingEncodeFrames;
+    const auto decision = m_admission.admit(inFlight, m_maxPendingFrames);
+    if (!FrameAdmission::hasRoom(inFlight, m_maxPendingFrames)) {
+        qCWarning(PIPEWIRERECORD_LOGGING) << "Encoder is falling behind," << (decision == FrameAdmission::Decision::Hold ? "holding" : "dropping") << "frame"
+                                          << pts;
         // Frames have backed up to the limit without the encoder ever producing a
         // single packet: it is not draining (e.g. a hardware encoder that cannot map
         // its frames). Report it so consumers can fall back instead of showing nothing.
         if (!m_anyFrameEncoded && !m_encodingErrorEmitted.exchange(true)) {
             Q_EMIT encodingError(QStringLiteral("Encoder produced no output; the filter queue saturated"));
         }
+    }
+
+    switch (decision) {
+    case FrameAdmission::Decision::Drop:
+        m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::FilterQueueFull);
+        return;
+    case FrameAdmission::Decision::Hold:
+        // Only the latest frame is kept, it is let in by handleEncodedFramesChanged().
+        // Its buffer goes back to PipeWire in the meantime, frames that would
+        // still be read from it are dropped like with DropNewest.
+        if (auto kept = keepableFrame(frame)) {
+            if (m_heldFrame) {
+                m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::FilterQueueFull);
+            }
+            m_heldFrame = std::make_pair(std::move(*kept), pts);
+        } else {
+            m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::FilterQueueFull);
+        }
         return;
+    case FrameAdmission::Decision::Admit:
+        break;
+    }
+
+    if (m_heldFrame) {
+        // Older than this one, which has room anyway
+        m_heldFrame.reset();
+        m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::FilterQueueFull);
     }
+    submitFrame(frame, pts);
+}
 
-    aboutToEncode(f);
-    if (!m_encoder->filterFrame(f)) {
+void PipeWireProduce::submitFrame(PipeWireFrame frame, int64_t pts)
+{
+    const auto presentationTimestamp = frame.presentationTimestamp;
+    frame.damage = m_filterDamage;
+    aboutToEncode(frame);
+    const auto filterStart = std::chrono::steady_clock::now();
+    if (!m_encoder->filterFrame(frame)) {
+        m_statistics.frameDropped(EncodingStatisticsCollector::DropReason::FilterFailed);
         return;
     }
+    const auto conversionTime = std::chrono::steady_clock::now() - filterStart;
+    m_filterDamage = QRegion();
 
+    m_statistics.frameSubmitted(pts, presentationTimestamp, conversionTime);
     m_pendingFilterFrames++;
     m_previousPts = pts;
 
-    m_passthroughCondition.notify_all();
+    m_passthroughSignal.notify();
 }
 
 void PipeWireProduce::stateChanged(pw_stream_state state)
@@ -805,12 +1193,21 @@ void PipeWireProduce::stateChanged(pw_stream_state state)
         // If we have pending frames, wait with cleanup until all frames have been processed.
         qCDebug(PIPEWIRERECORD_LOGGING) << "Waiting for frame queues to empty, still pending filter" << m_pendingFilterFrames << "encode"
                                         << m_pendingEncodeFrames;
-        m_passthroughCondition.notify_all();
+        // Only frames reaching the codec wake us up again, so start flushing
+        // right away in case the ones left are already all in there. Queued
+        // as it may end up destroying the stream, see above.
+        QMetaObject::invokeMethod(this, &PipeWireProduce::handleEncodedFramesChanged, Qt::QueuedConnection);
     }
 }
 
 void PipeWireProduce::handleEncodedFramesChanged()
 {
+    if (m_heldFrame && !m_deactivated && FrameAdmission::hasRoom(m_pendingFilterFrames + m_pendingEncodeFrames, m_maxPendingFrames)) {
+        // The encoder made room for the frame held back by the DropOldest policy
+        const auto [frame, pts] = *std::exchange(m_heldFrame, std::nullopt);
+        submitFrame(frame, pts);
+    }
+
     if (!m_deactivated) {
         return;
     }
@@ -820,10 +1217,12 @@ void PipeWireProduce::handleEncodedFramesChanged()
     // need a different trigger to make the filtering thread process frames.
     // Triggering here means the filter thread runs as fast as the encode thread
     // can process the frames.
-    m_passthroughCondition.notify_all();
+    m_passthroughSignal.notify();
 
     if (m_pendingFilterFrames <= 0) {
         m_encoder->finish();
+        // The codec has been told to flush, have the output thread collect what it flushes
+        m_outputSignal.notify();
 
         if (m_pendingEncodeFrames <= 0) {
             destroy();
@@ -838,7 +1237,7 @@ std::unique_ptr<Encoder> PipeWireProduce::makeEncoder()
         qCWarning(PIPEWIRERECORD_LOGGING) << "Forcing encoder to" << forcedEncoder;
     }
 
-    auto size = m_stream->size();
+    auto size = encodeSize();
 
     switch (m_encoderType) {
     case PipeWireBaseEncodedStream::H264Baseline:
@@ -913,9 +1312,13 @@ std::unique_ptr<Encoder> PipeWireProduce::makeEncoder()
 
 bool PipeWireProduce::setupEncoder(Encoder *encoder, const QSize &size)
 {
-    encoder->setQuality(m_quality);
+    // A rebuilt encoder starts out at the quality adaptive quality settled on
+    const auto adaptedQuality = m_minimumQuality ? m_qualityController.quality() : std::nullopt;
+    encoder->setQuality(adaptedQuality ? adaptedQuality : m_quality);
+    encoder->setRateControl(m_rateControl);
     encoder->setEncodingPreference(m_encodingPreference);
     encoder->setColorRange(m_colorRange);
+    encoder->setConversionThreads(m_conversionThreads);
     return encoder->initialize(size);
 }
 
@@ -27,15 +27,19 @@ extern "C" {
 #include <QTimer>
 #include <QWaitCondition>
 
-#include <condition_variable>
 #include <functional>
 #include <mutex>
 #include <optional>
 #include <thread>
 #include <vector>
 
+#include "adaptivequality_p.h"
+#include "encodingstatistics_p.h"
+#include "frameadmission_p.h"
+#include "framepool_p.h"
 #include "pipewirebaseencodedstream.h"
 #include "pipewiresourcestream.h"
+#include "workersignal_p.h"
 
 struct AVCodec;
 struct AVCodecContext;
@@ -47,11 +51,37 @@ struct AVFilterGraph;
 
 class AudioEncoder;
 class CustomAVFrame;
+class FrameDownload;
 class Encoder;
 class PipeWireAudioSourceStream;
 struct PipeWireAudioFrame;
 class PipeWireReceiveEncodedThread;
 
+/**
+ * Bitrate based rate control. Used instead of the quality when a target
+ * bitrate is set.
+ */
+struct RateControl {
+    // The average bitrate to aim for, in bits per second
+    std::optional<qint64> targetBitrate;
+    // The peak bitrate, the same as the target one for a constant bitrate
+    std::optional<qint64> maxBitrate;
+    // The size of the rate control (VBV) buffer, in bits
+    std::optional<qint64> bufferSize;
+};
+
+/**
+ * An extra encoding of the frames of a stream, for simulcast.
+ */
+struct SimulcastLayer {
+    // The frames are scaled down to fit, keeping their aspect ratio
+    QSize maxSize;
+    // Invalid to use the framerate of the stream
+    Fraction maxFramerate;
+    // Unset to use the rate control of the stream
+    std::optional<qint64> targetBitrate;
+};
+
 enum class AudioSource {
     SystemAudio = 1 << 0,
     Microphone = 1 << 1,
@@ -82,9 +112,10 @@ public:
     QSize requestedSize() const;
     void setRequestedSize(const QSize &size);
 
+    // The pts of a frame, in microseconds as set by FrameTimeBase
     virtual int64_t framePts(const std::optional<std::chrono::nanoseconds> &presentationTimestamp)
     {
-        return std::chrono::duration_cast<std::chrono::milliseconds>(presentationTimestamp.value()).count();
+        return std::chrono::duration_cast<std::chrono::microseconds>(presentationTimestamp.value()).count();
     }
 
     virtual void processPacket(AVPacket *packet) = 0;
@@ -105,9 +136,30 @@ public:
     {
         return false;
     }
+    // Whether only the newest of the frames queued up in the source stream is
+    // encoded, see PipeWireSourceStream::setAlwaysLatest(). Live consumers
+    // override this to keep the latency down, recordings keep every frame.
+    virtual bool prefersLatestFrame() const
+    {
+        return false;
+    }
     virtual void cleanup()
     {
     }
+    // Creates the producer of a simulcast layer, which passes on its packets.
+    // Producers that don't support simulcast return nullptr, the default.
+    virtual std::unique_ptr<PipeWireProduce> makeLayer(int index)
+    {
+        Q_UNUSED(index);
+        return nullptr;
+    }
+
+    // The stream the frames come from, the one of the producer that feeds a layer
+    PipeWireSourceStream *sourceStream() const;
+    // The size the encoder encodes at, the source size scaled down for a layer
+    QSize encodeSize() const;
+    // Fits @p source into @p maxSize, keeping the aspect ratio and with even dimensions
+    static QSize fitLayerSize(const QSize &source, const QSize &maxSize);
 
     void stateChanged(pw_stream_state state);
     void setupStream();
@@ -127,8 +179,26 @@ public:
     // encoder. Split out so the encoder can be swapped safely on a resize.
     void startThreads();
     void stopThreads();
+    // Create the layers set in m_layerSettings, and tear them down again
+    void startLayers();
+    void stopLayers();
+    // Encode what the layers still have queued and collect their last packets
+    void flushLayers();
+    // Set up a layer's encoder, called on the layer by startLayers()
+    bool startLayer();
+    // Downloads a DMA-BUF frame once for all software encoders of this producer
+    // and its layers, adding it as the frame's data.
+    PipeWireFrame shareFrame(const PipeWireFrame &frame);
+    // Drop the DMA-BUF imports of this producer and its layers, the buffers they are of are gone
+    void forgetBuffers();
+    // The frame as it can still be encoded once its buffer is back with PipeWire,
+    // nullopt when the encoder would read from the buffer
+    std::optional<PipeWireFrame> keepableFrame(const PipeWireFrame &frame) const;
+    void createFrameRepeatTimer();
     void initializeAudioStreams();
     virtual void processFrame(const PipeWireFrame &frame);
+    // Passes a frame that was let in on to the filter graph
+    void submitFrame(PipeWireFrame frame, int64_t pts);
     void processAudioFrame(int input, const PipeWireAudioFrame &frame);
     void handleAudioStreamStopped(int input);
     void pushSilence(int input, int64_t sampleCount, quint32 channels, quint32 rate);
@@ -149,11 +219,20 @@ public:
     void destroy();
 
     void setQuality(const std::optional<quint8> &quality);
+    void setMinimumQuality(const std::optional<quint8> &minimumQuality);
+    void setRateControl(const RateControl &rateControl);
 
     void setEncodingPreference(const PipeWireBaseEncodedStream::EncodingPreference &encodingPreference);
 
     void setColorRange(PipeWireBaseEncodedStream::ColorRange colorRange);
 
+    void setConversionThreads(int threads);
+
+    void setOverloadPolicy(PipeWireBaseEncodedStream::OverloadPolicy policy, int keepInterval);
+
+    // Make the next frame sent to the encoder a key frame. Can be called from any thread.
+    void requestKeyFrame();
+
     void handleEncodedFramesChanged();
 
     const uint m_nodeId;
@@ -205,9 +284,15 @@ public:
     QSize m_requestedSize;
 
     std::optional<quint8> m_quality;
+    // Adaptive quality is enabled when set, only used on the produce thread
+    std::optional<quint8> m_minimumQuality;
+    AdaptiveQualityController m_qualityController;
+    RateControl m_rateControl;
 
     PipeWireBaseEncodedStream::EncodingPreference m_encodingPreference;
     PipeWireBaseEncodedStream::ColorRange m_colorRange = PipeWireBaseEncodedStream::ColorRange::Limited;
+    // 0 leaves it to the encoder, see PipeWireBaseEncodedStream::setConversionThreads()
+    int m_conversionThreads = 0;
 
     struct {
         QImage texture;
@@ -219,6 +304,11 @@ public:
     QScopedPointer<QTimer> m_frameRepeatTimer;
     bool m_enableFrameRepeat = true;
     PipeWireFrame m_lastFrame;
+    // What changed since the last frame passed to the encoder, nullopt when it
+    // is unknown. Lets encoders that download DMA-BUFs read back only that.
+    std::optional<QRegion> m_filterDamage;
+    // Whether the cursor is painted into the frames, so moving it changes them
+    bool m_cursorInFrames = false;
 
     std::thread m_passthroughThread;
     std::thread m_outputThread;
@@ -227,10 +317,10 @@ public:
     std::atomic_bool m_passthroughRunning = false;
     std::atomic_bool m_outputRunning = false;
 
-    std::condition_variable m_passthroughCondition;
-    std::mutex m_passthroughMutex;
-    std::condition_variable m_outputCondition;
-    std::mutex m_outputMutex;
+    // Wake the worker threads up when there is something new in the filter
+    // graph or the codec for them.
+    WorkerSignal m_passthroughSignal;
+    WorkerSignal m_outputSignal;
 
     std::atomic_bool m_deactivated = false;
 
@@ -238,18 +328,45 @@ public:
 
     std::atomic_int m_pendingFilterFrames = 0;
     std::atomic_int m_pendingEncodeFrames = 0;
-    std::atomic_int m_processedFrames = 0;
+    // Frames handed to libav in place, frames that had to be copied into a buffer
+    // of its own and frames converted to YUV420P on the way, see YuvConversion
+    std::atomic_int m_wrappedFrames = 0;
+    std::atomic_int m_copiedFrames = 0;
+    std::atomic_int m_convertedFrames = 0;
     // Whether the encoder has ever produced an encoded packet. Used to tell a broken
     // encoder (frames go in, nothing comes out) from one that is merely keeping up.
     std::atomic_bool m_anyFrameEncoded = false;
     // Guards encodingError so it fires at most once per stream.
     std::atomic_bool m_encodingErrorEmitted = false;
 
-    // Controls how many frames we can push into ffmpeg's encoding stream
+    // Set by requestKeyFrame(), taken by the passthrough thread with the next frame it encodes
+    std::atomic_bool m_keyFrameRequested = false;
+    // Set by requestKeyFrame() as well, taken by the produce thread to pass the request on to the layers
+    std::atomic_bool m_layerKeyFrameRequested = false;
+
+    // Simulcast, set before the stream is initialized. The layers are fed on
+    // the produce thread, each with an encoder and worker threads of its own.
+    QList<SimulcastLayer> m_layerSettings;
+    std::vector<std::unique_ptr<PipeWireProduce>> m_layers;
+    // For a layer, the producer feeding it and the size to fit the frames into
+    PipeWireProduce *m_source = nullptr;
+    QSize m_maxEncodeSize;
+    // Whether shareFrame() downloads DMA-BUFs for software encoders
+    bool m_shareDownloads = false;
+    std::unique_ptr<FrameDownload> m_download;
+    AVFrame *m_downloadFrame = nullptr;
+
+    // Controls how many frames we can push into ffmpeg's filter graph and
+    // encoding stream together
     std::atomic_int m_maxPendingFrames = 50;
+    // Decides which frames are let in to the filter graph, only used on the produce thread
+    FrameAdmission m_admission;
+    // The latest frame that did not fit with the DropOldest policy, and its pts
+    std::optional<std::pair<PipeWireFrame, int64_t>> m_heldFrame;
 
     Fraction m_maxFramerate = {60, 1};
 
+    EncodingStatisticsCollector m_statistics;
     std::unique_ptr<QTimer> m_frameStatisticsTimer;
 
 Q_SIGNALS:
@@ -259,11 +376,16 @@ Q_SIGNALS:
     // Emitted when the encoder fails to start or stops producing output. Forwarded by
     // PipeWireBaseEncodedStream as errorFound() so consumers can fall back gracefully.
     void encodingError(const QString &message);
+    // Emitted every second while streaming, and once more when finished.
+    void statisticsUpdated(const PipeWireEncodingStatistics &statistics);
 
 private:
     void initFiltersVaapi();
     void initFiltersSoftware();
 
+    // Let the quality controller react to the load of the last statistics interval
+    void adaptQuality(PipeWireEncodingStatistics &statistics);
+
     std::unique_ptr<Encoder> makeEncoder();
     bool setupEncoder(Encoder *encoder, const QSize &size);
 };
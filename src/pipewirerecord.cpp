@@ -15,6 +15,7 @@
 
 #include <QGuiApplication>
 #include <QImage>
+#include <QMetaMethod>
 #include <QPainter>
 
 #include <KShell>
@@ -110,6 +111,13 @@ void PipeWireRecord::setRecordMicrophone(bool recordMicrophone)
     Q_EMIT recordMicrophoneChanged(recordMicrophone);
 }
 
+void PipeWireRecord::requestKeyFrame()
+{
+    if (auto produce = this->produce()) {
+        produce->requestKeyFrame();
+    }
+}
+
 QString PipeWireRecord::extension() const
 {
     static QHash<PipeWireBaseEncodedStream::Encoder, QString> s_extensions = {
@@ -129,11 +137,14 @@ PipeWireRecordProduce::PipeWireRecordProduce(PipeWireBaseEncodedStream::Encoder
                                              uint fd,
                                              const Fraction &framerate,
                                              const QString &output,
-                                             AudioSources audioSources)
+                                             AudioSources audioSources,
+                                             PipeWireRecord *record)
     : PipeWireProduce(encoder, nodeId, objectSerial, fd, framerate)
     , m_output(output)
+    , m_record(record)
 {
     m_enableFrameRepeat = false;
+    m_cursorInFrames = true;
     m_audioSources = audioSources;
 }
 
@@ -258,6 +269,13 @@ void PipeWireRecordProduce::aboutToEncode(PipeWireFrame &frame)
 
 void PipeWireRecordProduce::processPacket(AVPacket *packet)
 {
+    // Tee the packet to live consumers before the muxer takes it
+    static const auto newPacketSignal = QMetaMethod::fromSignal(&PipeWireRecord::newPacket);
+    if (m_record->isSignalConnected(newPacketSignal)) {
+        Q_EMIT m_record->newPacket(
+            PipeWireEncodedStream::Packet(packet->flags & AV_PKT_FLAG_KEY, QByteArray(reinterpret_cast<char *>(packet->data), packet->size)));
+    }
+
     packet->stream_index = (*m_avFormatContext->streams)->index;
     av_packet_rescale_ts(packet, m_encoder->avCodecContext()->time_base, (*m_avFormatContext->streams)->time_base);
     log_packet(m_avFormatContext, packet);
@@ -283,7 +301,7 @@ std::unique_ptr<PipeWireProduce> PipeWireRecord::makeProduce()
     AudioSources audioSources;
     audioSources.setFlag(AudioSource::SystemAudio, d->m_recordSystemAudio);
     audioSources.setFlag(AudioSource::Microphone, d->m_recordMicrophone);
-    return std::make_unique<PipeWireRecordProduce>(encoder(), nodeId(), objectSerial(), fd(), maxFramerate(), d->m_output, audioSources);
+    return std::make_unique<PipeWireRecordProduce>(encoder(), nodeId(), objectSerial(), fd(), maxFramerate(), d->m_output, audioSources, this);
 }
 
 int64_t PipeWireRecordProduce::framePts(const std::optional<std::chrono::nanoseconds> &presentationTimestamp)
@@ -297,7 +315,7 @@ int64_t PipeWireRecordProduce::framePts(const std::optional<std::chrono::nanosec
     // delivers the current screen content as its first frame, timestamped
     // with when it was originally rendered) belongs at the very start.
     const auto pts =
-        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::time_point(*presentationTimestamp) - recordEpoch()).count();
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::time_point(*presentationTimestamp) - recordEpoch()).count();
     return std::max<int64_t>(pts, 0);
 }
 
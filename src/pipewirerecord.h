@@ -10,6 +10,7 @@
 #include <qqmlintegration.h>
 
 #include "pipewirebaseencodedstream.h"
+#include "pipewireencodedstream.h"
 #include <kpipewire_export.h>
 
 struct PipeWireRecordPrivate;
@@ -37,6 +38,14 @@ public:
     bool recordMicrophone() const;
     void setRecordMicrophone(bool recordMicrophone);
 
+    /**
+     * Make the next encoded frame a key frame, e.g. for a consumer of
+     * newPacket() that joins while recording.
+     *
+     * @see PipeWireEncodedStream::requestKeyFrame()
+     */
+    Q_INVOKABLE void requestKeyFrame();
+
     // Only for compatibility with 5.27
     KPIPEWIRE_DEPRECATED QString currentExtension() const
     {
@@ -47,6 +56,21 @@ Q_SIGNALS:
     void outputChanged(const QString &output);
     void recordSystemAudioChanged(bool recordSystemAudio);
     void recordMicrophoneChanged(bool recordMicrophone);
+    /**
+     * Every video packet written to the output, for streaming the recording
+     * live without encoding it a second time.
+     *
+     * The packets come from the encoder of the recording, so they use its
+     * encoder and settings, and have the cursor painted into them when the
+     * recording does. A consumer that needs anything else should use a
+     * PipeWireEncodedStream of its own. Packets are only copied for this
+     * while something is connected.
+     *
+     * It is emitted from the encoder's output thread, not the thread of the
+     * PipeWireRecord, and before the packet is written. Connect with a queued
+     * connection to handle packets in another thread.
+     */
+    void newPacket(const PipeWireEncodedStream::Packet &packet);
 
 private:
     std::unique_ptr<PipeWireProduce> makeProduce() override;
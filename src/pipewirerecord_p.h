@@ -12,6 +12,7 @@ struct gbm_device;
 struct AVFormatContext;
 struct AVStream;
 class PipeWireProduce;
+class PipeWireRecord;
 
 class PipeWireRecordProduce : public PipeWireProduce
 {
@@ -23,7 +24,8 @@ public:
                           uint fd,
                           const Fraction &framerate,
                           const QString &output,
-                          AudioSources audioSources);
+                          AudioSources audioSources,
+                          PipeWireRecord *record);
 
     void processFrame(const PipeWireFrame &frame) override;
     void processPacket(AVPacket *packet) override;
@@ -35,6 +37,7 @@ public:
 
 private:
     const QString m_output;
+    PipeWireRecord *const m_record;
     AVFormatContext *m_avFormatContext = nullptr;
     AVStream *m_audioStream = nullptr;
     PipeWireFrame m_frameWithoutMetadataCursor;
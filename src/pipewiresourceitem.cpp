@@ -13,12 +13,14 @@
 
 #include <QGuiApplication>
 #include <QOpenGLContext>
+#include <QOpenGLPixelTransferOptions>
 #include <QOpenGLTexture>
 #include <QPainter>
 #include <QQuickWindow>
 #include <QSGImageNode>
 #include <QSocketNotifier>
 #include <QThread>
+#include <array>
 #include <memory>
 #include <qpa/qplatformnativeinterface.h>
 
@@ -37,6 +39,7 @@ class PipeWireSourceItemPrivate
 {
 public:
     std::weak_ptr<QOpenGLTexture> m_sharedGlTex;
+    std::weak_ptr<QOpenGLTexture> m_uploadGlTex;
 
     uint m_nodeId = 0;
     quint64 m_objectSerial = quint64(-1);
@@ -146,6 +149,8 @@ void PipeWireSourceItem::refresh()
     } else {
         d->m_stream.reset(new PipeWireSourceStream(this));
         d->m_stream->setAllowDmaBuf(d->m_allowDmaBuf);
+        // Only the newest frame is shown, don't work through the ones that queued up before it
+        d->m_stream->setAlwaysLatest(true);
         Q_EMIT streamSizeChanged();
         connect(d->m_stream.get(), &PipeWireSourceStream::streamParametersChanged, this, &PipeWireSourceItem::streamSizeChanged);
         connect(d->m_stream.get(), &PipeWireSourceStream::streamParametersChanged, this, &PipeWireSourceItem::usingDmaBufChanged);
@@ -398,6 +403,74 @@ void PipeWireSourceItem::updateTextureDmaBuf(const DmaBufAttributes &attribs, sp
     setReady(true);
 }
 
+using SwizzleMask = std::array<QOpenGLTexture::SwizzleValue, 4>;
+
+// QImage has no format with these byte orders, so toImage() swaps them on the CPU.
+// Instead they are uploaded as RGBA bytes and put in order by the texture's swizzle.
+static std::optional<SwizzleMask> swizzleMaskForFormat(spa_video_format format)
+{
+    switch (format) {
+    case SPA_VIDEO_FORMAT_xBGR:
+        return SwizzleMask{QOpenGLTexture::AlphaValue, QOpenGLTexture::BlueValue, QOpenGLTexture::GreenValue, QOpenGLTexture::OneValue};
+    case SPA_VIDEO_FORMAT_ABGR:
+        return SwizzleMask{QOpenGLTexture::AlphaValue, QOpenGLTexture::BlueValue, QOpenGLTexture::GreenValue, QOpenGLTexture::RedValue};
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+    case SPA_VIDEO_FORMAT_BGRx:
+        return SwizzleMask{QOpenGLTexture::BlueValue, QOpenGLTexture::GreenValue, QOpenGLTexture::RedValue, QOpenGLTexture::OneValue};
+    case SPA_VIDEO_FORMAT_BGRA:
+        return SwizzleMask{QOpenGLTexture::BlueValue, QOpenGLTexture::GreenValue, QOpenGLTexture::RedValue, QOpenGLTexture::AlphaValue};
+#endif
+    default:
+        return std::nullopt;
+    }
+}
+
+QSGTexture *PipeWireSourceItem::createSwizzledTexture(const PipeWireFrameData &data)
+{
+    const auto swizzleMask = swizzleMaskForFormat(data.format);
+    if (!swizzleMask || data.stride % 4 != 0) {
+        return nullptr;
+    }
+
+    const auto openglContext = static_cast<QOpenGLContext *>(window()->rendererInterface()->getResource(window(), QSGRendererInterface::OpenGLContextResource));
+    if (!openglContext || !QOpenGLTexture::hasFeature(QOpenGLTexture::Swizzle)) {
+        return nullptr;
+    }
+
+    // As with DMA-BUFs, one raw QOpenGLTexture is used for all QSGTextures of the same size
+    auto uploadTex = d->m_uploadGlTex.lock();
+    if (!uploadTex || uploadTex->width() != data.size.width() || uploadTex->height() != data.size.height()) {
+        auto raw = std::make_shared<QOpenGLTexture>(QOpenGLTexture::Target2D);
+        raw->setFormat(QOpenGLTexture::RGBA8_UNorm);
+        raw->setSize(data.size.width(), data.size.height());
+        raw->setWrapMode(QOpenGLTexture::ClampToEdge);
+        raw->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+        raw->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8);
+        if (!raw->isStorageAllocated()) {
+            return nullptr;
+        }
+        uploadTex = raw;
+        d->m_uploadGlTex = uploadTex;
+    }
+
+    QOpenGLPixelTransferOptions options;
+    options.setAlignment(4);
+    options.setRowLength(data.stride / 4);
+    uploadTex->setSwizzleMask((*swizzleMask)[0], (*swizzleMask)[1], (*swizzleMask)[2], (*swizzleMask)[3]);
+    uploadTex->setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, data.data, &options);
+
+    QSGTexture *tex = QNativeInterface::QSGOpenGLTexture::fromNative(uploadTex->textureId(), window(), data.size, QQuickWindow::TextureIsOpaque);
+    QObject::connect(
+        tex,
+        &QObject::destroyed,
+        tex,
+        [uploadTex]() {
+            // uploadTex is captured so it gets destroyed with the last texture using it
+        },
+        Qt::DirectConnection);
+    return tex;
+}
+
 void PipeWireSourceItem::updateTextureImage(const std::shared_ptr<PipeWireFrameData> &data)
 {
     if (!window()) {
@@ -406,7 +479,18 @@ void PipeWireSourceItem::updateTextureImage(const std::shared_ptr<PipeWireFrameD
     }
 
     d->m_createNextTexture = [this, data] {
-        return window()->createTextureFromImage(data->toImage(), QQuickWindow::TextureIsOpaque);
+        if (auto tex = createSwizzledTexture(*data)) {
+            return tex;
+        }
+
+        // Without OpenGL the byte orders QImage lacks fall back to toImage() swapping them
+        QImage image = data->toImage();
+        // BGRx frames come as RGB32, which the scene graph would convert first. The texture is opaque
+        // anyway, so let it upload them as they are into a BGRA texture.
+        if (image.format() == QImage::Format_RGB32) {
+            image.reinterpretAsFormat(QImage::Format_ARGB32_Premultiplied);
+        }
+        return window()->createTextureFromImage(image, QQuickWindow::TextureIsOpaque);
     };
 
     setReady(true);
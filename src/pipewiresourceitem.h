@@ -131,6 +131,7 @@ private:
     void processFrame(const PipeWireFrame &frame);
     void updateTextureDmaBuf(const DmaBufAttributes &attribs, spa_video_format format);
     void updateTextureImage(const std::shared_ptr<PipeWireFrameData> &data);
+    QSGTexture *createSwizzledTexture(const PipeWireFrameData &data);
     void refresh();
     void setReady(bool ready);
     void setPaintedRect(const QRectF &rect);
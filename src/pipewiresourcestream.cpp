@@ -8,18 +8,21 @@
 
 #include "pipewiresourcestream.h"
 #include "glhelpers.h"
+#include "latencyhistogram_p.h"
 #include "logging.h"
 #include "pipewirecore_p.h"
 #include "pwhelpers.h"
 #include "rendernodecontext_p.h"
+#include "spscqueue_p.h"
+#include "tiledamage_p.h"
 #include "vaapiutils_p.h"
 
 #include <libdrm/drm_fourcc.h>
 #include <spa/utils/result.h>
 #include <sys/ioctl.h>
-#include <sys/mman.h>
 #include <unistd.h>
 
+#include <QMutex>
 #include <QOpenGLTexture>
 #include <QSocketNotifier>
 #include <QThread>
@@ -30,6 +33,10 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
+#include <array>
+#include <atomic>
+#include <mutex>
+
 #undef Status
 
 #define CURSOR_BPP 4
@@ -59,13 +66,122 @@ struct PipeWireSourceStreamPrivate
     spa_source *m_renegotiateEvent = nullptr;
 
     bool m_withDamage = false;
+    bool m_detectDamage = false;
+    // One per plane, only used on the thread running the PipeWire loop
+    std::array<TileDamage, 3> tileDamage;
     Fraction maxFramerate;
     QSize requestedSize;
 
     PipeWireSourceStream::UsageHint usageHint = PipeWireSourceStream::UsageHint::Render;
     bool createStream(uint nodeId, uint64_t objectSerial, int fd, PipeWireSourceStream *q);
+
+    // Buffers that stay dequeued while consumers reference their frame data,
+    // or until a frame handed over from a dedicated loop thread is emitted.
+    // Shared with the leases themselves, which can be released from any thread
+    // and possibly after the stream is gone.
+    struct Leases {
+        QMutex mutex;
+        pw_loop *loop = nullptr;
+        spa_source *releaseEvent = nullptr;
+        // The leased buffers, with a token for the lease that tells it apart
+        // from a later one on a buffer that got the same address
+        QHash<pw_buffer *, quint64> leased;
+        quint64 nextToken = 0;
+        QList<pw_buffer *> released;
+
+        // The mutex needs to be held for these two
+        quint64 lease(pw_buffer *buffer)
+        {
+            leased.insert(buffer, nextToken);
+            return nextToken++;
+        }
+        bool isLeased(pw_buffer *buffer, quint64 token) const
+        {
+            const auto it = leased.constFind(buffer);
+            return it != leased.cend() && *it == token;
+        }
+
+        // Hands the buffer back to PipeWire on the thread that drives its loop,
+        // unless it was removed in the meantime and may be leased anew
+        void release(pw_buffer *buffer, quint64 token)
+        {
+            QMutexLocker locker(&mutex);
+            if (!isLeased(buffer, token)) {
+                return;
+            }
+            leased.remove(buffer);
+            if (releaseEvent) {
+                released.append(buffer);
+                pw_loop_signal_event(loop, releaseEvent);
+            }
+        }
+    };
+    std::shared_ptr<Leases> leases = std::make_shared<Leases>();
+    int maxLeasedFrames = 0;
+
+    QList<PipeWireFramePlane> framePlanes(spa_buffer *spaBuffer, const QList<uint8_t *> &blocks) const;
+    std::shared_ptr<PipeWireFrameData> createFrameData(pw_buffer *buffer, const QList<PipeWireFramePlane> &planes, PipeWireFrameCleanupFunction *cleanup);
+
+    PipeWireSourceStream::LoopThread loopThread = PipeWireSourceStream::LoopThread::Shared;
+    // Frames handed over from a dedicated loop thread. Their buffer is leased
+    // until they are emitted, unless their frame data holds a lease already.
+    struct PendingFrame {
+        PipeWireFrame frame;
+        pw_buffer *buffer = nullptr;
+        quint64 token = 0;
+    };
+    SpscQueue<PendingFrame> pendingFrames{8};
+    // Whether frames with an image were skipped or dropped since the last one
+    // was handed on, and what they damaged, nullopt when unknown
+    bool droppedFrames = false;
+    std::optional<QRegion> droppedDamage;
+    // A cursor texture that came with a dropped frame, for the next frame with a cursor
+    QImage droppedCursorTexture;
+    // Only the newest of the buffers queued up is handled, see setAlwaysLatest()
+    std::atomic_bool alwaysLatest = false;
+    std::atomic<quint64> skippedFrames = 0;
+    std::atomic_bool deliveryScheduled = false;
+    // Time from the frame's presentation to it being emitted, to see how much
+    // delivery is delayed by whatever else runs in the same loop.
+    LatencyHistogram deliveryLatency;
+
+    // Keeps a dedicated loop thread from running while the stream is accessed from elsewhere
+    std::unique_lock<PipeWireCore> lockLoop() const
+    {
+        return pwCore ? std::unique_lock<PipeWireCore>(*pwCore) : std::unique_lock<PipeWireCore>();
+    }
+    // Runs @p function in the stream's thread, where its signals are emitted.
+    // Stream callbacks on a dedicated loop thread queue it, like frames.
+    template<typename Function>
+    void onStreamThread(PipeWireSourceStream *q, Function &&function)
+    {
+        if (pwCore && pwCore->isThreaded()) {
+            QMetaObject::invokeMethod(q, std::forward<Function>(function), Qt::QueuedConnection);
+        } else {
+            function();
+        }
+    }
+    void deliverFrame(const PipeWireFrame &frame, PipeWireSourceStream *q);
+    void deliverPendingFrames(PipeWireSourceStream *q);
+    // The buffer of the frame being emitted, see holdCurrentBuffer()
+    pw_buffer *currentBuffer = nullptr;
+    PendingFrame *currentPending = nullptr;
+    // Whether the buffer of a pending frame is still around to be read
+    bool isPendingValid(const PendingFrame &pending) const;
+    // Drops a pending frame, giving its buffer back unless its frame data holds the lease
+    void releasePending(PendingFrame &pending);
+    // Folds a pending frame that is skipped for a newer one into it, see setAlwaysLatest()
+    void skipPending(PendingFrame &older, PendingFrame &newer);
+    // Gives a buffer straight back, keeping what it damaged and its cursor for the next frame
+    void skipBuffer(pw_buffer *buffer);
+    // Remembers what a frame that is not delivered changed, @p damage already
+    // holding the damage of the frames dropped before it
+    void frameDropped(bool hasImage, const std::optional<QRegion> &damage, const std::optional<PipeWireCursor> &cursor);
 };
 
+// How many frames to collect before logging the delivery latencies
+static constexpr quint64 s_latencyReportInterval = 600;
+
 static const QVersionNumber pwClientVersion = QVersionNumber::fromString(QString::fromUtf8(pw_get_library_version()));
 static const QVersionNumber kDmaBufMinVersion = {0, 3, 24};
 static const QVersionNumber kDmaBufModifierMinVersion = {0, 3, 33};
@@ -219,27 +335,33 @@ void PipeWireSourceStream::onStreamStateChanged(void *data, pw_stream_state old,
 {
     PipeWireSourceStream *pw = static_cast<PipeWireSourceStream *>(data);
     qCDebug(PIPEWIRE_LOGGING) << "state changed" << pw_stream_state_as_string(old) << "->" << pw_stream_state_as_string(state) << error_message;
-    pw->d->m_state = state;
-    Q_EMIT pw->stateChanged(state, old);
-
-    switch (state) {
-    case PW_STREAM_STATE_ERROR:
+    if (state == PW_STREAM_STATE_ERROR) {
         qCWarning(PIPEWIRE_LOGGING) << "Stream error: " << error_message;
-        break;
-    case PW_STREAM_STATE_PAUSED:
-        Q_EMIT pw->streamReady();
-        break;
-    case PW_STREAM_STATE_STREAMING:
-        Q_EMIT pw->startStreaming();
-        break;
-    case PW_STREAM_STATE_CONNECTING:
-        break;
-    case PW_STREAM_STATE_UNCONNECTED:
-        if (!pw->d->m_stopped) {
-            Q_EMIT pw->stopStreaming();
-        }
-        break;
     }
+
+    // The state is only written in the stream's thread, so state() agrees with the signals
+    pw->d->onStreamThread(pw, [pw, old, state] {
+        pw->d->m_state = state;
+        Q_EMIT pw->stateChanged(state, old);
+
+        switch (state) {
+        case PW_STREAM_STATE_ERROR:
+            break;
+        case PW_STREAM_STATE_PAUSED:
+            Q_EMIT pw->streamReady();
+            break;
+        case PW_STREAM_STATE_STREAMING:
+            Q_EMIT pw->startStreaming();
+            break;
+        case PW_STREAM_STATE_CONNECTING:
+            break;
+        case PW_STREAM_STATE_UNCONNECTED:
+            if (!pw->d->m_stopped) {
+                Q_EMIT pw->stopStreaming();
+            }
+            break;
+        }
+    });
 }
 
 void PipeWireSourceStream::onRenegotiate(void *data, uint64_t)
@@ -253,6 +375,7 @@ void PipeWireSourceStream::onRenegotiate(void *data, uint64_t)
 
 void PipeWireSourceStream::renegotiateModifierFailed(spa_video_format format, quint64 modifier)
 {
+    auto locker = d->lockLoop();
     if (d->pwCore->serverVersion() >= kDropSingleModifierMinVersion) {
         const int removed = d->m_availableModifiers[format].removeAll(modifier);
         if (removed == 0) {
@@ -320,6 +443,47 @@ static spa_pod *buildFormat(spa_pod_builder *builder,
 
 static const int videoDamageRegionCount = 16;
 
+// The size of a pixel in the first plane of @p format
+static int bytesPerPixel(spa_video_format format)
+{
+    switch (format) {
+    case SPA_VIDEO_FORMAT_RGB:
+    case SPA_VIDEO_FORMAT_BGR:
+        return 3;
+    case SPA_VIDEO_FORMAT_YUY2:
+        return 2;
+    case SPA_VIDEO_FORMAT_GRAY8:
+    case SPA_VIDEO_FORMAT_I420:
+    case SPA_VIDEO_FORMAT_NV12:
+        return 1;
+    default:
+        return 4;
+    }
+}
+
+// Finds what changed in every plane of @p data, the damage of the subsampled
+// chroma planes scaled up to the first one
+static QRegion detectDamage(std::array<TileDamage, 3> &tileDamage, const PipeWireFrameData &data)
+{
+    const auto planes = data.planes();
+    QRegion damage = tileDamage[0].update(static_cast<const uint8_t *>(planes[0].data), planes[0].stride, data.size, bytesPerPixel(data.format));
+    if (planes.size() == 1) {
+        return damage;
+    }
+
+    // I420 has a plane for each chroma component, NV12 interleaves them in one
+    const int chromaBytesPerPixel = data.format == SPA_VIDEO_FORMAT_NV12 ? 2 : 1;
+    const QSize chromaSize((data.size.width() + 1) / 2, PWHelpers::planeHeight(data.format, 1, data.size.height()));
+    const QRect frame(QPoint(0, 0), data.size);
+    for (int i = 1; i < std::min<int>(planes.size(), tileDamage.size()); ++i) {
+        const QRegion chromaDamage = tileDamage[i].update(static_cast<const uint8_t *>(planes[i].data), planes[i].stride, chromaSize, chromaBytesPerPixel);
+        for (const QRect &rect : chromaDamage) {
+            damage += QRect(rect.x() * 2, rect.y() * 2, rect.width() * 2, rect.height() * 2) & frame;
+        }
+    }
+    return damage;
+}
+
 void PipeWireSourceStream::onStreamParamChanged(void *data, uint32_t id, const struct spa_pod *format)
 {
     if (!format || id != SPA_PARAM_Format) {
@@ -340,13 +504,17 @@ void PipeWireSourceStream::onStreamParamChanged(void *data, uint32_t id, const s
     Q_ASSERT(pw->d->m_allowDmaBuf || !pw->d->m_usingDmaBuf);
     const auto bufferTypes =
         pw->d->m_usingDmaBuf ? (1 << SPA_DATA_DmaBuf) | (1 << SPA_DATA_MemFd) | (1 << SPA_DATA_MemPtr) : (1 << SPA_DATA_MemFd) | (1 << SPA_DATA_MemPtr);
+    // Leased buffers are out of the stream's rotation, ask for extra ones to make up for
+    // them and for the ones of frames waiting to be emitted by a dedicated loop thread
+    const int pendingCount = pw->d->pwCore && pw->d->pwCore->isThreaded() ? 2 : 0;
+    const int bufferCount = std::clamp(3 + pw->d->maxLeasedFrames + pendingCount, 2, 16);
 
     QVarLengthArray<const spa_pod *> params = {
         (spa_pod *)spa_pod_builder_add_object(&pod_builder,
                                               SPA_TYPE_OBJECT_ParamBuffers,
                                               SPA_PARAM_Buffers,
                                               SPA_PARAM_BUFFERS_buffers,
-                                              SPA_POD_CHOICE_RANGE_Int(3, 2, 16),
+                                              SPA_POD_CHOICE_RANGE_Int(bufferCount, 2, 16),
                                               SPA_PARAM_BUFFERS_align,
                                               SPA_POD_Int(16),
                                               SPA_PARAM_BUFFERS_dataType,
@@ -380,7 +548,10 @@ void PipeWireSourceStream::onStreamParamChanged(void *data, uint32_t id, const s
     }
 
     pw_stream_update_params(pw->d->pwStream, params.data(), params.count());
-    Q_EMIT pw->streamParametersChanged();
+    // The format itself is read under the loop lock, see size() and usingDmaBuf()
+    pw->d->onStreamThread(pw, [pw] {
+        Q_EMIT pw->streamParametersChanged();
+    });
 }
 
 static void onProcess(void *data)
@@ -389,6 +560,47 @@ static void onProcess(void *data)
     stream->process();
 }
 
+void PipeWireSourceStream::onAddBuffer(void *data, pw_buffer *buffer)
+{
+    Q_UNUSED(data)
+    // Map MemFd buffers once for their whole lifetime rather than on every frame
+    PWHelpers::mapBuffer(buffer);
+}
+
+void PipeWireSourceStream::onRemoveBuffer(void *data, pw_buffer *buffer)
+{
+    PipeWireSourceStream *pw = static_cast<PipeWireSourceStream *>(data);
+    {
+        // The buffer is gone, frames still leasing it must not give it back
+        QMutexLocker locker(&pw->d->leases->mutex);
+        pw->d->leases->leased.remove(buffer);
+        pw->d->leases->released.removeAll(buffer);
+    }
+    PWHelpers::unmapBuffer(buffer);
+
+    pw->d->onStreamThread(pw, [pw] {
+        if (!pw->d->m_stopped) {
+            Q_EMIT pw->bufferRemoved();
+        }
+    });
+}
+
+void PipeWireSourceStream::onLeaseReleased(void *data, uint64_t)
+{
+    PipeWireSourceStream *pw = static_cast<PipeWireSourceStream *>(data);
+    QList<pw_buffer *> released;
+    {
+        QMutexLocker locker(&pw->d->leases->mutex);
+        released.swap(pw->d->leases->released);
+    }
+    if (!pw->d->pwStream) {
+        return;
+    }
+    for (pw_buffer *buffer : std::as_const(released)) {
+        pw_stream_queue_buffer(pw->d->pwStream, buffer);
+    }
+}
+
 PipeWireFrameData::PipeWireFrameData(spa_video_format format, void *data, QSize size, qint32 stride, PipeWireFrameCleanupFunction *cleanup)
     : format(format)
     , data(data)
@@ -396,19 +608,101 @@ PipeWireFrameData::PipeWireFrameData(spa_video_format format, void *data, QSize
     , stride(stride)
     , cleanup(cleanup)
 {
-    cleanup->ref();
+    if (cleanup) {
+        cleanup->ref();
+    }
+}
+
+namespace
+{
+// What PipeWireFrameData has no room for, its layout is fixed by the installed header
+struct FrameDataExtras {
+    QList<PipeWireFramePlane> planes;
+    bool outlivesBuffer = false;
+};
+
+// Only frames with more than one plane, or that outlive their buffer, have an entry
+struct FrameDataRegistry {
+    QMutex mutex;
+    QHash<const PipeWireFrameData *, FrameDataExtras> extras;
+};
+
+FrameDataRegistry &frameDataRegistry()
+{
+    // Never destroyed, frames may still go away while the process exits
+    static auto registry = new FrameDataRegistry;
+    return *registry;
+}
+}
+
+PipeWireFrameData::PipeWireFrameData(spa_video_format format, const QList<PipeWireFramePlane> &planes, QSize size, PipeWireFrameCleanupFunction *cleanup)
+    : format(format)
+    , data(planes.value(0).data)
+    , size(size)
+    , stride(planes.value(0).stride)
+    , cleanup(cleanup)
+{
+    if (cleanup) {
+        cleanup->ref();
+    }
+    if (planes.size() > 1) {
+        auto &registry = frameDataRegistry();
+        QMutexLocker locker(&registry.mutex);
+        registry.extras[this].planes = planes;
+    }
+}
+
+QList<PipeWireFramePlane> PipeWireFrameData::planes() const
+{
+    auto &registry = frameDataRegistry();
+    QMutexLocker locker(&registry.mutex);
+    const auto it = registry.extras.constFind(this);
+    if (it != registry.extras.cend() && !it->planes.isEmpty()) {
+        return it->planes;
+    }
+    return {{data, stride}};
+}
+
+bool PipeWireFrameData::outlivesBuffer() const
+{
+    auto &registry = frameDataRegistry();
+    QMutexLocker locker(&registry.mutex);
+    return registry.extras.value(this).outlivesBuffer;
+}
+
+void PipeWireFrameData::setOutlivesBuffer(bool outlives)
+{
+    auto &registry = frameDataRegistry();
+    QMutexLocker locker(&registry.mutex);
+    if (outlives) {
+        registry.extras[this].outlivesBuffer = true;
+    } else if (auto it = registry.extras.find(this); it != registry.extras.end()) {
+        it->outlivesBuffer = false;
+    }
 }
 
 PipeWireFrameData::~PipeWireFrameData()
 {
+    {
+        auto &registry = frameDataRegistry();
+        QMutexLocker locker(&registry.mutex);
+        registry.extras.remove(this);
+    }
     PipeWireFrameCleanupFunction::unref(cleanup);
 }
 
 QSize PipeWireSourceStream::size() const
 {
+    auto locker = d->lockLoop();
     return QSize(d->videoFormat.size.width, d->videoFormat.size.height);
 }
 
+spa_video_format PipeWireSourceStream::format() const
+{
+    auto locker = d->lockLoop();
+    return d->videoFormat.format;
+}
+
 pw_stream_state PipeWireSourceStream::state() const
 {
     return d->m_state;
@@ -416,6 +710,7 @@ pw_stream_state PipeWireSourceStream::state() const
 
 std::optional< std::chrono::nanoseconds > PipeWireSourceStream::currentPresentationTimestamp() const
 {
+    auto locker = d->lockLoop();
     return d->m_currentPresentationTimestamp;
 }
 
@@ -433,11 +728,24 @@ PipeWireSourceStream::PipeWireSourceStream(QObject *parent)
     pwStreamEvents.state_changed = &PipeWireSourceStream::onStreamStateChanged;
     pwStreamEvents.param_changed = &PipeWireSourceStream::onStreamParamChanged;
     pwStreamEvents.destroy = &PipeWireSourceStream::onDestroy;
+    pwStreamEvents.add_buffer = &PipeWireSourceStream::onAddBuffer;
+    pwStreamEvents.remove_buffer = &PipeWireSourceStream::onRemoveBuffer;
 }
 
 PipeWireSourceStream::~PipeWireSourceStream()
 {
     d->m_stopped = true;
+    auto locker = d->lockLoop();
+    if (spa_source *releaseEvent = d->leases->releaseEvent) {
+        {
+            // Leases released from now on only have to drop their reference
+            QMutexLocker locker(&d->leases->mutex);
+            d->leases->releaseEvent = nullptr;
+            d->leases->leased.clear();
+            d->leases->released.clear();
+        }
+        pw_loop_destroy_source(d->pwCore->loop(), releaseEvent);
+    }
     if (d->m_renegotiateEvent) {
         pw_loop_destroy_source(d->pwCore->loop(), d->m_renegotiateEvent);
     }
@@ -448,6 +756,7 @@ PipeWireSourceStream::~PipeWireSourceStream()
 
 Fraction PipeWireSourceStream::framerate() const
 {
+    auto locker = d->lockLoop();
     if (d->pwStream) {
         return {d->videoFormat.max_framerate.num, d->videoFormat.max_framerate.denom};
     }
@@ -457,6 +766,7 @@ Fraction PipeWireSourceStream::framerate() const
 
 void PipeWireSourceStream::setMaxFramerate(const Fraction &framerate)
 {
+    auto locker = d->lockLoop();
     d->maxFramerate = framerate;
 
     if (d->pwStream) {
@@ -466,6 +776,7 @@ void PipeWireSourceStream::setMaxFramerate(const Fraction &framerate)
 
 void PipeWireSourceStream::setRequestedSize(const QSize &size)
 {
+    auto locker = d->lockLoop();
     if (d->requestedSize == size) {
         return;
     }
@@ -490,6 +801,26 @@ void PipeWireSourceStream::setUsageHint(UsageHint hint)
     d->usageHint = hint;
 }
 
+int PipeWireSourceStream::maxLeasedFrames() const
+{
+    return d->maxLeasedFrames;
+}
+
+void PipeWireSourceStream::setMaxLeasedFrames(int count)
+{
+    d->maxLeasedFrames = std::max(0, count);
+}
+
+PipeWireSourceStream::LoopThread PipeWireSourceStream::loopThread() const
+{
+    return d->loopThread;
+}
+
+void PipeWireSourceStream::setLoopThread(LoopThread loopThread)
+{
+    d->loopThread = loopThread;
+}
+
 QList<const spa_pod *> PipeWireSourceStream::createFormatsParams(spa_pod_builder podBuilder)
 {
     const auto pwServerVersion = d->pwCore->serverVersion();
@@ -533,6 +864,14 @@ QList<const spa_pod *> PipeWireSourceStream::createFormatsParams(spa_pod_builder
         d->m_availableModifiers = availableModifiers;
     }
 
+    if (d->usageHint == UsageHint::EncodeSoftware) {
+        // Offered first so that sources which can produce YUV save us the conversion,
+        // only in memory since DMA-BUF frames are downloaded as RGBA.
+        for (spa_video_format format : {SPA_VIDEO_FORMAT_I420, SPA_VIDEO_FORMAT_NV12, SPA_VIDEO_FORMAT_YUY2}) {
+            params += buildFormat(&podBuilder, format, {}, withDontFixate, d->maxFramerate, d->requestedSize);
+        }
+    }
+
     for (auto it = d->m_availableModifiers.constBegin(), itEnd = d->m_availableModifiers.constEnd(); it != itEnd; ++it) {
         if (d->m_allowDmaBuf && !it->isEmpty()) {
             params += buildFormat(&podBuilder, it.key(), it.value(), withDontFixate, d->maxFramerate, d->requestedSize);
@@ -549,7 +888,17 @@ QList<const spa_pod *> PipeWireSourceStream::createFormatsParams(spa_pod_builder
 bool PipeWireSourceStreamPrivate::createStream(uint nodeId, uint64_t objectSerial, int fd, PipeWireSourceStream *q)
 {
     m_availableModifiers.clear();
-    pwCore = PipeWireCore::fetch(fd);
+    switch (loopThread) {
+    case PipeWireSourceStream::LoopThread::Shared:
+        pwCore = PipeWireCore::fetch(fd);
+        break;
+    case PipeWireSourceStream::LoopThread::Dedicated:
+        pwCore = PipeWireCore::fetchThreaded(fd, false);
+        break;
+    case PipeWireSourceStream::LoopThread::Realtime:
+        pwCore = PipeWireCore::fetchThreaded(fd, true);
+        break;
+    }
     if (!pwCore->error().isEmpty()) {
         qCDebug(PIPEWIRE_LOGGING) << "received error while creating the stream" << pwCore->error();
         m_error = pwCore->error();
@@ -565,6 +914,7 @@ bool PipeWireSourceStreamPrivate::createStream(uint nodeId, uint64_t objectSeria
         q->setObjectName(QStringLiteral("plasma-screencast-node-%1").arg(nodeId));
     }
 
+    auto locker = lockLoop();
     const auto pwServerVersion = pwCore->serverVersion();
     pw_properties *properties = nullptr;
     if (objectSerial != uint64_t(-1)) {
@@ -579,6 +929,8 @@ bool PipeWireSourceStreamPrivate::createStream(uint nodeId, uint64_t objectSeria
     pw_stream_add_listener(pwStream, &streamListener, &pwStreamEvents, q);
 
     m_renegotiateEvent = pw_loop_add_event(pwCore->loop(), q->onRenegotiate, q);
+    leases->loop = pwCore->loop();
+    leases->releaseEvent = pw_loop_add_event(pwCore->loop(), q->onLeaseReleased, q);
 
     uint8_t buffer[4096];
     spa_pod_builder podBuilder = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
@@ -594,6 +946,66 @@ bool PipeWireSourceStreamPrivate::createStream(uint nodeId, uint64_t objectSeria
     return true;
 }
 
+QList<PipeWireFramePlane> PipeWireSourceStreamPrivate::framePlanes(spa_buffer *spaBuffer, const QList<uint8_t *> &blocks) const
+{
+    const auto format = videoFormat.format;
+    const int planeCount = PWHelpers::planeCount(format);
+    QList<PipeWireFramePlane> planes;
+    planes.reserve(planeCount);
+
+    if (blocks.size() >= planeCount) {
+        for (int i = 0; i < planeCount; ++i) {
+            planes.append({blocks[i] + spaBuffer->datas[i].chunk->offset, spaBuffer->datas[i].chunk->stride});
+        }
+        return planes;
+    }
+
+    // All planes one after the other in the first block
+    const qint32 stride = spaBuffer->datas->chunk->stride;
+    uint8_t *plane = blocks.constFirst() + spaBuffer->datas->chunk->offset;
+    for (int i = 0; i < planeCount; ++i) {
+        const qint32 planeStride = PWHelpers::planeStride(format, i, stride);
+        planes.append({plane, planeStride});
+        plane += planeStride * PWHelpers::planeHeight(format, i, videoFormat.size.height);
+    }
+    return planes;
+}
+
+std::shared_ptr<PipeWireFrameData>
+PipeWireSourceStreamPrivate::createFrameData(pw_buffer *buffer, const QList<PipeWireFramePlane> &planes, PipeWireFrameCleanupFunction *cleanup)
+{
+    const QSize size(videoFormat.size.width, videoFormat.size.height);
+    if (maxLeasedFrames <= 0 || !pwStream) {
+        return std::make_shared<PipeWireFrameData>(videoFormat.format, planes, size, cleanup);
+    }
+
+    // The memory of MemPtr buffers is freed along with them, not reference
+    // counted like a MemFd mapping, so a lease could outlive it
+    if (buffer->buffer->datas->type == SPA_DATA_MemPtr) {
+        return PipeWireFrameData(videoFormat.format, planes, size, cleanup).copy();
+    }
+
+    QMutexLocker locker(&leases->mutex);
+    if (leases->leased.size() >= maxLeasedFrames) {
+        // Out of leases, give consumers a copy they can hold on to instead
+        locker.unlock();
+        return PipeWireFrameData(videoFormat.format, planes, size, cleanup).copy();
+    }
+    const quint64 token = leases->lease(buffer);
+    locker.unlock();
+
+    if (cleanup) {
+        cleanup->ref();
+    }
+    auto lease = new PipeWireFrameCleanupFunction([leases = leases, buffer, token, cleanup] {
+        PipeWireFrameCleanupFunction::unref(cleanup);
+        leases->release(buffer, token);
+    });
+    auto frameData = std::make_shared<PipeWireFrameData>(videoFormat.format, planes, size, lease);
+    frameData->setOutlivesBuffer(true);
+    return frameData;
+}
+
 bool PipeWireSourceStream::createStream(uint nodeid, int fd)
 {
     return d->createStream(nodeid, uint64_t(-1), fd, this);
@@ -604,6 +1016,49 @@ bool PipeWireSourceStream::createStream(quint64 objectSerial, int fd)
     return d->createStream(PW_ID_ANY, objectSerial, fd, this);
 }
 
+static std::optional<QRegion> readDamage(spa_buffer *spaBuffer)
+{
+    spa_meta *vd = spa_buffer_find_meta(spaBuffer, SPA_META_VideoDamage);
+    if (!vd) {
+        return std::nullopt;
+    }
+    QRegion damage;
+    spa_meta_region *mr;
+    spa_meta_for_each(mr, vd)
+    {
+        damage += QRect(mr->region.position.x, mr->region.position.y, mr->region.size.width, mr->region.size.height);
+    }
+    return damage;
+}
+
+static std::optional<PipeWireCursor> readCursor(spa_buffer *spaBuffer)
+{
+    struct spa_meta_cursor *cursor = static_cast<struct spa_meta_cursor *>(spa_buffer_find_meta_data(spaBuffer, SPA_META_Cursor, sizeof(*cursor)));
+    if (!cursor || !spa_meta_cursor_is_valid(cursor)) {
+        return std::nullopt;
+    }
+
+    struct spa_meta_bitmap *bitmap = nullptr;
+    if (cursor->bitmap_offset)
+        bitmap = SPA_MEMBER(cursor, cursor->bitmap_offset, struct spa_meta_bitmap);
+
+    QImage cursorTexture;
+    if (bitmap && bitmap->size.width > 0 && bitmap->size.height > 0) {
+        const size_t bufferSize = bitmap->stride * bitmap->size.height * 4;
+        void *bufferData = malloc(bufferSize);
+        memcpy(bufferData, SPA_MEMBER(bitmap, bitmap->offset, uint8_t), bufferSize);
+        cursorTexture = PWHelpers::SpaBufferToQImage(static_cast<const uchar *>(bufferData),
+                                                     bitmap->size.width,
+                                                     bitmap->size.height,
+                                                     bitmap->stride,
+                                                     spa_video_format(bitmap->format),
+                                                     new PipeWireFrameCleanupFunction([bufferData] {
+                                                         free(bufferData);
+                                                     }));
+    }
+    return PipeWireCursor{{cursor->position.x, cursor->position.y}, {cursor->hotspot.x, cursor->hotspot.y}, cursorTexture};
+}
+
 void PipeWireSourceStream::handleFrame(struct pw_buffer *buffer)
 {
     spa_buffer *spaBuffer = buffer->buffer;
@@ -626,40 +1081,8 @@ void PipeWireSourceStream::handleFrame(struct pw_buffer *buffer)
         frame.presentationTimestamp = d->m_currentPresentationTimestamp;
     }
 
-    if (spa_meta *vd = spa_buffer_find_meta(spaBuffer, SPA_META_VideoDamage)) {
-        frame.damage = QRegion();
-        spa_meta_region *mr;
-        spa_meta_for_each(mr, vd)
-        {
-            *frame.damage += QRect(mr->region.position.x, mr->region.position.y, mr->region.size.width, mr->region.size.height);
-        }
-    }
-
-    { // process cursor
-        struct spa_meta_cursor *cursor = static_cast<struct spa_meta_cursor *>(spa_buffer_find_meta_data(spaBuffer, SPA_META_Cursor, sizeof(*cursor)));
-        if (cursor && spa_meta_cursor_is_valid(cursor)) {
-            struct spa_meta_bitmap *bitmap = nullptr;
-
-            if (cursor->bitmap_offset)
-                bitmap = SPA_MEMBER(cursor, cursor->bitmap_offset, struct spa_meta_bitmap);
-
-            QImage cursorTexture;
-            if (bitmap && bitmap->size.width > 0 && bitmap->size.height > 0) {
-                const size_t bufferSize = bitmap->stride * bitmap->size.height * 4;
-                void *bufferData = malloc(bufferSize);
-                memcpy(bufferData, SPA_MEMBER(bitmap, bitmap->offset, uint8_t), bufferSize);
-                cursorTexture = PWHelpers::SpaBufferToQImage(static_cast<const uchar *>(bufferData),
-                                                             bitmap->size.width,
-                                                             bitmap->size.height,
-                                                             bitmap->stride,
-                                                             spa_video_format(bitmap->format),
-                                                             new PipeWireFrameCleanupFunction([bufferData] {
-                                                                 free(bufferData);
-                                                             }));
-            }
-            frame.cursor = {{cursor->position.x, cursor->position.y}, {cursor->hotspot.x, cursor->hotspot.y}, cursorTexture};
-        }
-    }
+    frame.damage = readDamage(spaBuffer);
+    frame.cursor = readCursor(spaBuffer);
 
     if (spaBuffer->datas->chunk->flags == SPA_CHUNK_FLAG_CORRUPTED) {
         // do not get a frame
@@ -668,21 +1091,15 @@ void PipeWireSourceStream::handleFrame(struct pw_buffer *buffer)
         if (spaBuffer->datas->chunk->size == 0) {
             qCDebug(PIPEWIRE_LOGGING) << "skipping empty memfd buffer";
         } else {
-            const uint32_t mapEnd = spaBuffer->datas->maxsize + spaBuffer->datas->mapoffset;
-            uint8_t *map = static_cast<uint8_t *>(mmap(nullptr, mapEnd, PROT_READ, MAP_PRIVATE, spaBuffer->datas->fd, 0));
-
-            if (map == MAP_FAILED) {
-                qCWarning(PIPEWIRE_LOGGING) << "Failed to mmap the memory: " << strerror(errno);
+            // The buffer is usually mapped once in onAddBuffer(), only map it here if that failed
+            if (!buffer->user_data) {
+                PWHelpers::mapBuffer(buffer);
+            }
+            auto mapping = static_cast<PipeWireBufferMapping *>(buffer->user_data);
+            if (!mapping) {
                 return;
             }
-            auto cleanup = [map, mapEnd]() {
-                munmap(map, mapEnd);
-            };
-            frame.dataFrame = std::make_shared<PipeWireFrameData>(d->videoFormat.format,
-                                                                  map,
-                                                                  QSize(d->videoFormat.size.width, d->videoFormat.size.height),
-                                                                  spaBuffer->datas->chunk->stride,
-                                                                  new PipeWireFrameCleanupFunction(cleanup));
+            frame.dataFrame = d->createFrameData(buffer, d->framePlanes(spaBuffer, mapping->blocks), mapping->cleanup);
         }
     } else if (spaBuffer->datas->type == SPA_DATA_DmaBuf) {
         DmaBufAttributes attribs;
@@ -707,11 +1124,11 @@ void PipeWireSourceStream::handleFrame(struct pw_buffer *buffer)
         if (spaBuffer->datas->chunk->size == 0) {
             qCDebug(PIPEWIRE_LOGGING) << "skipping empty memptr buffer";
         } else {
-            frame.dataFrame = std::make_shared<PipeWireFrameData>(d->videoFormat.format,
-                                                                  spaBuffer->datas->data,
-                                                                  QSize(d->videoFormat.size.width, d->videoFormat.size.height),
-                                                                  spaBuffer->datas->chunk->stride,
-                                                                  nullptr);
+            QList<uint8_t *> blocks;
+            for (uint i = 0; i < spaBuffer->n_datas && spaBuffer->datas[i].type == SPA_DATA_MemPtr; ++i) {
+                blocks.append(static_cast<uint8_t *>(spaBuffer->datas[i].data));
+            }
+            frame.dataFrame = d->createFrameData(buffer, d->framePlanes(spaBuffer, blocks), nullptr);
         }
     } else {
         if (spaBuffer->datas->type == SPA_ID_INVALID) {
@@ -722,7 +1139,209 @@ void PipeWireSourceStream::handleFrame(struct pw_buffer *buffer)
         frame.dataFrame = {};
     }
 
-    Q_EMIT frameReceived(frame);
+    if (d->m_detectDamage && !frame.damage && frame.dataFrame) {
+        frame.damage = detectDamage(d->tileDamage, *frame.dataFrame);
+    }
+
+    // What skipped and dropped frames changed goes with the next one, so consumers don't miss it
+    const bool hasImage = frame.dmabuf || frame.dataFrame;
+    if (hasImage && d->droppedFrames) {
+        if (frame.damage && d->droppedDamage) {
+            *frame.damage += *d->droppedDamage;
+        } else {
+            frame.damage.reset();
+        }
+    }
+    if (frame.cursor && frame.cursor->texture.isNull()) {
+        frame.cursor->texture = d->droppedCursorTexture;
+    }
+
+    if (d->pwCore && d->pwCore->isThreaded()) {
+        // DMA-BUFs and frame data without a lease of its own are only valid while
+        // the buffer is dequeued, keep it until the frame has been emitted
+        PipeWireSourceStreamPrivate::PendingFrame pending;
+        {
+            QMutexLocker locker(&d->leases->mutex);
+            if (!d->leases->leased.contains(buffer)) {
+                pending.buffer = buffer;
+                pending.token = d->leases->lease(buffer);
+            }
+        }
+        pending.frame = std::move(frame);
+        if (!d->pendingFrames.push(std::move(pending))) {
+            qCDebug(PIPEWIRE_LOGGING) << "dropping frame, the stream's thread is not keeping up";
+            // push() leaves the frame alone when it fails, process() queues the buffer again
+            if (pending.buffer) {
+                QMutexLocker locker(&d->leases->mutex);
+                d->leases->leased.remove(buffer);
+            }
+            d->frameDropped(hasImage, pending.frame.damage, pending.frame.cursor);
+            return;
+        }
+        if (hasImage) {
+            d->droppedFrames = false;
+        }
+        d->droppedCursorTexture = {};
+        if (!d->deliveryScheduled.exchange(true)) {
+            QMetaObject::invokeMethod(
+                this,
+                [this] {
+                    d->deliverPendingFrames(this);
+                },
+                Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    if (hasImage) {
+        d->droppedFrames = false;
+    }
+    d->droppedCursorTexture = {};
+    d->currentBuffer = buffer;
+    d->deliverFrame(frame, this);
+    d->currentBuffer = nullptr;
+}
+
+void PipeWireSourceStreamPrivate::frameDropped(bool hasImage, const std::optional<QRegion> &damage, const std::optional<PipeWireCursor> &cursor)
+{
+    if (hasImage) {
+        droppedFrames = true;
+        droppedDamage = damage;
+    }
+    if (cursor && !cursor->texture.isNull()) {
+        droppedCursorTexture = cursor->texture;
+    }
+}
+
+void PipeWireSourceStreamPrivate::skipBuffer(pw_buffer *buffer)
+{
+    spa_buffer *spaBuffer = buffer->buffer;
+    skippedFrames++;
+
+    // Only the metadata, the image is never looked at
+    auto *header = static_cast<spa_meta_header *>(spa_buffer_find_meta_data(spaBuffer, SPA_META_Header, sizeof(spa_meta_header)));
+    if (header && (header->flags & SPA_META_HEADER_FLAG_CORRUPTED)) {
+        return;
+    }
+
+    const auto type = spaBuffer->datas->type;
+    const bool hasImage = spaBuffer->datas->chunk->flags != SPA_CHUNK_FLAG_CORRUPTED
+        && (type == SPA_DATA_DmaBuf || ((type == SPA_DATA_MemFd || type == SPA_DATA_MemPtr) && spaBuffer->datas->chunk->size > 0));
+    auto damage = readDamage(spaBuffer);
+    if (!damage && m_detectDamage && type != SPA_DATA_DmaBuf) {
+        // Detection compares the next frame with the last one delivered, which covers this one
+        damage = QRegion();
+    }
+    if (hasImage && droppedFrames) {
+        if (damage && droppedDamage) {
+            *damage += *droppedDamage;
+        } else {
+            damage.reset();
+        }
+    }
+    frameDropped(hasImage, damage, readCursor(spaBuffer));
+}
+
+void PipeWireSourceStreamPrivate::deliverFrame(const PipeWireFrame &frame, PipeWireSourceStream *q)
+{
+    if (frame.presentationTimestamp) {
+        deliveryLatency.record(std::chrono::steady_clock::now().time_since_epoch() - *frame.presentationTimestamp);
+        if (deliveryLatency.count() >= s_latencyReportInterval) {
+            qCDebug(PIPEWIRE_LOGGING) << q->objectName() << "frame delivery latency:" << deliveryLatency.toString();
+            deliveryLatency.reset();
+        }
+    }
+
+    Q_EMIT q->frameReceived(frame);
+}
+
+void PipeWireSourceStreamPrivate::deliverPendingFrames(PipeWireSourceStream *q)
+{
+    // Reset first, so frames pushed while draining schedule another run
+    deliveryScheduled = false;
+    std::optional<PendingFrame> latest;
+    while (auto pending = pendingFrames.pop()) {
+        if (!isPendingValid(*pending)) {
+            // The buffer was removed from the stream, taking what the frame refers to with it
+            qCDebug(PIPEWIRE_LOGGING) << "dropping frame, its buffer is gone";
+            continue;
+        }
+        if (!latest) {
+            latest = std::move(pending);
+        } else if (alwaysLatest) {
+            // Hand only the newest of the frames that queued up on, like process() does
+            skipPending(*latest, *pending);
+        } else {
+            currentPending = &*latest;
+            deliverFrame(latest->frame, q);
+            currentPending = nullptr;
+            releasePending(*latest);
+            latest = std::move(pending);
+        }
+    }
+    if (latest) {
+        currentPending = &*latest;
+        deliverFrame(latest->frame, q);
+        currentPending = nullptr;
+        releasePending(*latest);
+    }
+}
+
+bool PipeWireSourceStreamPrivate::isPendingValid(const PendingFrame &pending) const
+{
+    if (!pending.buffer) {
+        return true;
+    }
+    QMutexLocker locker(&leases->mutex);
+    return leases->isLeased(pending.buffer, pending.token);
+}
+
+void PipeWireSourceStreamPrivate::releasePending(PendingFrame &pending)
+{
+    pending.frame = {};
+    if (pending.buffer) {
+        leases->release(pending.buffer, std::exchange(pending.token, 0));
+        pending.buffer = nullptr;
+    }
+}
+
+// A cursor texture only comes along when it changes, keep the last one
+static std::optional<PipeWireCursor> mergeCursor(const std::optional<PipeWireCursor> &older, const std::optional<PipeWireCursor> &newer)
+{
+    if (!newer) {
+        return older;
+    }
+    auto cursor = newer;
+    if (cursor->texture.isNull() && older) {
+        cursor->texture = older->texture;
+    }
+    return cursor;
+}
+
+void PipeWireSourceStreamPrivate::skipPending(PendingFrame &older, PendingFrame &newer)
+{
+    skippedFrames++;
+
+    const bool olderImage = older.frame.dmabuf || older.frame.dataFrame;
+    const bool newerImage = newer.frame.dmabuf || newer.frame.dataFrame;
+    if (olderImage && !newerImage) {
+        // Only the cursor moved since, which the frame with the image can carry
+        older.frame.cursor = mergeCursor(older.frame.cursor, newer.frame.cursor);
+        releasePending(newer);
+        return;
+    }
+
+    // What the skipped frame changed goes with the newer one
+    if (olderImage) {
+        if (newer.frame.damage && older.frame.damage) {
+            *newer.frame.damage += *older.frame.damage;
+        } else {
+            newer.frame.damage.reset();
+        }
+    }
+    newer.frame.cursor = mergeCursor(older.frame.cursor, newer.frame.cursor);
+    releasePending(older);
+    std::swap(older, newer);
 }
 
 void PipeWireSourceStream::coreFailed(const QString &errorMessage)
@@ -747,14 +1366,32 @@ void PipeWireSourceStream::process()
         qCDebug(PIPEWIRE_LOGGING) << "out of buffers";
         return;
     }
+    if (d->alwaysLatest) {
+        // Give the older buffers back right away, the frames they hold are stale
+        while (pw_buffer *newer = pw_stream_dequeue_buffer(d->pwStream)) {
+            d->skipBuffer(buf);
+            pw_stream_queue_buffer(d->pwStream, buf);
+            buf = newer;
+        }
+    }
 
     handleFrame(buf);
 
+    {
+        // A leased buffer goes back to PipeWire once its last frame reference is dropped
+        QMutexLocker locker(&d->leases->mutex);
+        if (d->leases->leased.contains(buf)) {
+            return;
+        }
+        // The lease may have already been released while the frame was being handled
+        d->leases->released.removeAll(buf);
+    }
     pw_stream_queue_buffer(d->pwStream, buf);
 }
 
 void PipeWireSourceStream::setActive(bool active)
 {
+    auto locker = d->lockLoop();
     if (!d->pwStream) {
         qCWarning(PIPEWIRE_LOGGING) << "Tried to make uncreated stream active";
         return;
@@ -767,8 +1404,14 @@ void PipeWireSourceStream::setDamageEnabled(bool withDamage)
     d->m_withDamage = withDamage;
 }
 
+void PipeWireSourceStream::setDamageDetectionEnabled(bool detect)
+{
+    d->m_detectDamage = detect;
+}
+
 bool PipeWireSourceStream::usingDmaBuf() const
 {
+    auto locker = d->lockLoop();
     return d->m_usingDmaBuf;
 }
 
@@ -782,6 +1425,59 @@ void PipeWireSourceStream::setAllowDmaBuf(bool allowed)
     d->m_allowDmaBuf = allowed;
 }
 
+bool PipeWireSourceStream::alwaysLatest() const
+{
+    return d->alwaysLatest;
+}
+
+void PipeWireSourceStream::setAlwaysLatest(bool alwaysLatest)
+{
+    d->alwaysLatest = alwaysLatest;
+}
+
+namespace
+{
+// Gives the buffer back once the last reference to it is dropped
+struct BufferHold {
+    std::shared_ptr<PipeWireSourceStreamPrivate::Leases> leases;
+    pw_buffer *buffer;
+    quint64 token;
+    ~BufferHold()
+    {
+        leases->release(buffer, token);
+    }
+};
+}
+
+std::shared_ptr<void> PipeWireSourceStream::holdCurrentBuffer()
+{
+    if (d->currentPending) {
+        // Take over the lease the frame had until it was emitted, or nothing
+        // when its frame data holds one
+        if (!d->currentPending->buffer) {
+            return {};
+        }
+        auto buffer = std::exchange(d->currentPending->buffer, nullptr);
+        return std::shared_ptr<void>(new BufferHold{d->leases, buffer, std::exchange(d->currentPending->token, 0)});
+    }
+    if (!d->currentBuffer) {
+        return {};
+    }
+
+    QMutexLocker locker(&d->leases->mutex);
+    if (d->leases->leased.contains(d->currentBuffer)) {
+        return {};
+    }
+    const quint64 token = d->leases->lease(d->currentBuffer);
+    // process() leaves it dequeued when it sees the lease
+    return std::shared_ptr<void>(new BufferHold{d->leases, d->currentBuffer, token});
+}
+
+quint64 PipeWireSourceStream::skippedFrames() const
+{
+    return d->skippedFrames;
+}
+
 void PipeWireSourceStream::onDestroy(void *data)
 {
     // When PipeWire restarts the stream will auto-delete. Make sure we don't have dangling pointers!
@@ -61,20 +61,44 @@ struct PipeWireCursor {
     }
 };
 
+struct PipeWireFramePlane {
+    void *data = nullptr;
+    qint32 stride = 0; ///< The distance from the start of a row to the next row in bytes
+};
+
 class KPIPEWIRE_EXPORT PipeWireFrameData
 {
     Q_DISABLE_COPY(PipeWireFrameData)
 public:
     PipeWireFrameData(spa_video_format format, void *data, QSize size, qint32 stride, PipeWireFrameCleanupFunction *cleanup);
+    /**
+     * For planar formats, @p planes has an entry per plane in the order libav expects them.
+     */
+    PipeWireFrameData(spa_video_format format, const QList<PipeWireFramePlane> &planes, QSize size, PipeWireFrameCleanupFunction *cleanup);
     ~PipeWireFrameData();
 
+    /**
+     * Returns a null image for the YUV formats.
+     */
     QImage toImage() const;
     std::shared_ptr<PipeWireFrameData> copy() const;
+    /**
+     * The planes of the frame, in the order libav expects them. A single one,
+     * the same as data and stride, for packed formats.
+     */
+    QList<PipeWireFramePlane> planes() const;
+    /**
+     * Whether the frame's memory stays valid and unchanged for as long as this
+     * is referenced, also after the PipeWire buffer it came in was given back.
+     * True for leased and copied frames, false by default.
+     */
+    bool outlivesBuffer() const;
+    void setOutlivesBuffer(bool outlives);
 
     const spa_video_format format;
-    void *const data = nullptr;
+    void *const data = nullptr; ///< The first plane
     const QSize size;
-    const qint32 stride = 0;
+    const qint32 stride = 0; ///< The stride of the first plane
     PipeWireFrameCleanupFunction *const cleanup = nullptr;
 };
 
@@ -122,6 +146,17 @@ public:
         EncodeHardware, ///< Stream is intended mainly for encoding video using hardware encoding.
     };
 
+    /**
+     * The thread the stream's PipeWire loop runs on.
+     *
+     * By default this will be set to Shared.
+     */
+    enum class LoopThread {
+        Shared, ///< The event loop of the thread creating the stream, along with everything else running there.
+        Dedicated, ///< A thread of its own, frames are handed over to the thread the stream lives in.
+        Realtime, ///< Like Dedicated, with the thread asking for realtime scheduling.
+    };
+
     explicit PipeWireSourceStream(QObject *parent = nullptr);
     ~PipeWireSourceStream();
 
@@ -134,6 +169,10 @@ public:
     QString error() const;
 
     QSize size() const;
+    /**
+     * The negotiated format, the YUV formats are only ever negotiated with the EncodeSoftware usage hint.
+     */
+    spa_video_format format() const;
     pw_stream_state state() const;
     /**
      * @deprecrated use createStream(quint64 objectSerial, int fd) instead
@@ -142,10 +181,75 @@ public:
     bool createStream(quint64 objectSerial, int fd);
     void setActive(bool active);
     void setDamageEnabled(bool withDamage);
+    /**
+     * Fill in PipeWireFrame::damage for frames in memory whose source does not
+     * report damage, by comparing each frame with the previous one in tiles.
+     *
+     * This costs about as much as reading the frame once. For planar formats
+     * every plane is compared. Disabled by default.
+     */
+    void setDamageDetectionEnabled(bool detect);
 
     UsageHint usageHint() const;
     void setUsageHint(UsageHint hint);
 
+    /**
+     * Allows up to @p count frames at a time to keep their buffer dequeued for as
+     * long as their PipeWireFrameData is referenced, so consumers can keep the
+     * frame data around without copying it. The buffer is given back to PipeWire
+     * once the last reference is dropped, which can happen on any thread.
+     *
+     * When all leases are in use, the data of new frames is copied instead.
+     * DMA-BUF frames are not leased, and the data of MemPtr frames is always
+     * copied as it goes away with its buffer. The default, 0, disables leasing.
+     *
+     * Needs to be set before the stream is created.
+     */
+    void setMaxLeasedFrames(int count);
+    int maxLeasedFrames() const;
+
+    /**
+     * Runs the loop on a dedicated thread so frame delivery doesn't have to wait
+     * for other events in the thread the stream lives in. frameReceived() and the
+     * other signals are still emitted in the stream's thread, and frames are
+     * dropped if that thread doesn't keep up.
+     *
+     * The buffer of a frame stays dequeued until frameReceived() returns, or until
+     * its PipeWireFrameData is no longer referenced when it is leased. As without
+     * a loop thread, DMA-BUFs need to be imported within frameReceived().
+     *
+     * Needs to be set before the stream is created.
+     */
+    void setLoopThread(LoopThread loopThread);
+    LoopThread loopThread() const;
+
+    /**
+     * When several buffers queued up while the stream's thread was busy, only
+     * hands the newest one on and gives the others straight back to PipeWire,
+     * so consumers don't work through stale frames one at a time and fall
+     * further behind. What the skipped frames damaged goes with the newest one.
+     *
+     * Meant for previews and live streams, where latency matters more than
+     * every frame. Disabled by default.
+     */
+    void setAlwaysLatest(bool alwaysLatest);
+    bool alwaysLatest() const;
+    /**
+     * How many frames were skipped for newer ones, see setAlwaysLatest().
+     */
+    quint64 skippedFrames() const;
+
+    /**
+     * Keeps the buffer of the frame being emitted by frameReceived() dequeued
+     * until the returned handle is dropped, for consumers that go on reading a
+     * DMA-BUF asynchronously once frameReceived() returned. The buffer is out of
+     * the stream's rotation in the meantime, drop the handle as soon as possible.
+     *
+     * Returns a null handle outside of frameReceived(), and when the frame's
+     * data holds a lease on the buffer already, see setMaxLeasedFrames().
+     */
+    std::shared_ptr<void> holdCurrentBuffer();
+
     void handleFrame(struct pw_buffer *buffer);
     void process();
     void renegotiateModifierFailed(spa_video_format format, quint64 modifier);
@@ -163,6 +267,11 @@ Q_SIGNALS:
     void startStreaming();
     void stopStreaming();
     void streamParametersChanged();
+    /**
+     * PipeWire took a buffer away from the stream, anything kept for it, such as
+     * an import of its DMA-BUF, can be dropped.
+     */
+    void bufferRemoved();
     void frameReceived(const PipeWireFrame &frame);
     void stateChanged(pw_stream_state state, pw_stream_state oldState);
 
@@ -171,6 +280,9 @@ private:
     static void onStreamStateChanged(void *data, pw_stream_state old, pw_stream_state state, const char *error_message);
     static void onRenegotiate(void *data, uint64_t);
     static void onDestroy(void *data);
+    static void onAddBuffer(void *data, pw_buffer *buffer);
+    static void onRemoveBuffer(void *data, pw_buffer *buffer);
+    static void onLeaseReleased(void *data, uint64_t);
     QList<const spa_pod *> createFormatsParams(spa_pod_builder podBuilder);
 
     void coreFailed(const QString &errorMessage);
@@ -7,12 +7,26 @@
 #include "pwhelpers.h"
 #include "logging.h"
 
+#include <sys/mman.h>
+
 QImage::Format SpaToQImageFormat(quint32 format)
 {
     switch (format) {
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    // QImage's 32-bit formats are in native byte order, which makes them BGRx/BGRA in memory
+    case SPA_VIDEO_FORMAT_BGRx:
+        return QImage::Format_RGB32;
+    case SPA_VIDEO_FORMAT_BGRA:
+        return QImage::Format_ARGB32_Premultiplied;
+#else
+    case SPA_VIDEO_FORMAT_xRGB:
+        return QImage::Format_RGB32;
+    case SPA_VIDEO_FORMAT_ARGB:
+        return QImage::Format_ARGB32_Premultiplied;
     case SPA_VIDEO_FORMAT_BGRx:
     case SPA_VIDEO_FORMAT_BGRA:
         return QImage::Format_RGBA8888_Premultiplied; // Handled in SpaBufferToQImage
+#endif
     case SPA_VIDEO_FORMAT_ABGR:
     case SPA_VIDEO_FORMAT_xBGR:
         return QImage::Format_ARGB32; // Handled in SpaBufferToQImage
@@ -34,14 +48,19 @@ QImage::Format SpaToQImageFormat(quint32 format)
 
 QImage PWHelpers::SpaBufferToQImage(const uchar *data, int width, int height, qsizetype bytesPerLine, spa_video_format format, PipeWireFrameCleanupFunction *c)
 {
-    c->ref();
+    if (c) {
+        c->ref();
+    }
     switch (format) {
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
     case SPA_VIDEO_FORMAT_BGRx:
     case SPA_VIDEO_FORMAT_BGRA:
+#endif
     case SPA_VIDEO_FORMAT_xBGR:
     case SPA_VIDEO_FORMAT_ABGR: {
-        // This is needed because QImage does not support BGRA
-        // This is obviously a much slower path, it makes sense to avoid it as much as possible
+        // This is needed because QImage has no format with this byte order
+        // This is obviously a much slower path, it makes sense to avoid it as much as possible.
+        // PipeWireSourceItem does so by swizzling the texture instead when it renders with OpenGL.
         return QImage(data, width, height, bytesPerLine, SpaToQImageFormat(format), &PipeWireFrameCleanupFunction::unref, c).rgbSwapped();
     }
     case SPA_VIDEO_FORMAT_GRAY8:
@@ -53,17 +72,134 @@ QImage PWHelpers::SpaBufferToQImage(const uchar *data, int width, int height, qs
     }
 }
 
+bool PWHelpers::isYuvFormat(spa_video_format format)
+{
+    switch (format) {
+    case SPA_VIDEO_FORMAT_I420:
+    case SPA_VIDEO_FORMAT_NV12:
+    case SPA_VIDEO_FORMAT_YUY2:
+        return true;
+    default:
+        return false;
+    }
+}
+
+int PWHelpers::planeCount(spa_video_format format)
+{
+    switch (format) {
+    case SPA_VIDEO_FORMAT_I420:
+        return 3;
+    case SPA_VIDEO_FORMAT_NV12:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+int PWHelpers::planeHeight(spa_video_format format, int plane, int height)
+{
+    switch (format) {
+    case SPA_VIDEO_FORMAT_I420:
+    case SPA_VIDEO_FORMAT_NV12:
+        // Chroma is subsampled vertically
+        return plane == 0 ? height : (height + 1) / 2;
+    default:
+        return height;
+    }
+}
+
+qint32 PWHelpers::planeStride(spa_video_format format, int plane, qint32 stride)
+{
+    switch (format) {
+    case SPA_VIDEO_FORMAT_I420:
+        return plane == 0 ? stride : stride / 2;
+    default:
+        // NV12's interleaved chroma plane is as wide as its luma plane
+        return stride;
+    }
+}
+
 QImage PipeWireFrameData::toImage() const
 {
+    if (PWHelpers::isYuvFormat(format)) {
+        qCWarning(PIPEWIRE_LOGGING) << "cannot convert YUV frames to QImage" << format;
+        return {};
+    }
     return PWHelpers::SpaBufferToQImage(static_cast<uchar *>(data), size.width(), size.height(), stride, format, cleanup);
 }
 
 std::shared_ptr<PipeWireFrameData> PipeWireFrameData::copy() const
 {
-    const uint bufferSize = size.height() * stride * 4;
-    auto newMap = malloc(bufferSize);
-    memcpy(newMap, data, bufferSize);
-    return std::make_shared<PipeWireFrameData>(format, newMap, size, stride, new PipeWireFrameCleanupFunction([newMap] {
-                                                   free(newMap);
-                                               }));
+    const auto planes = this->planes();
+    size_t bufferSize = 0;
+    for (int i = 0; i < planes.size(); ++i) {
+        bufferSize += size_t(PWHelpers::planeHeight(format, i, size.height())) * planes[i].stride;
+    }
+    auto newMap = static_cast<uint8_t *>(malloc(bufferSize));
+
+    QList<PipeWireFramePlane> newPlanes;
+    newPlanes.reserve(planes.size());
+    size_t offset = 0;
+    for (int i = 0; i < planes.size(); ++i) {
+        const size_t planeSize = size_t(PWHelpers::planeHeight(format, i, size.height())) * planes[i].stride;
+        memcpy(newMap + offset, planes[i].data, planeSize);
+        newPlanes.append({newMap + offset, planes[i].stride});
+        offset += planeSize;
+    }
+    auto frameData = std::make_shared<PipeWireFrameData>(format, newPlanes, size, new PipeWireFrameCleanupFunction([newMap] {
+                                                             free(newMap);
+                                                         }));
+    frameData->setOutlivesBuffer(true);
+    return frameData;
+}
+
+void PWHelpers::mapBuffer(pw_buffer *buffer)
+{
+    spa_buffer *spaBuffer = buffer->buffer;
+    if (spaBuffer->n_datas < 1 || spaBuffer->datas->type != SPA_DATA_MemFd) {
+        return;
+    }
+
+    QList<std::pair<uint8_t *, size_t>> maps;
+    auto unmapAll = [](const QList<std::pair<uint8_t *, size_t>> &maps) {
+        for (const auto &[map, length] : maps) {
+            munmap(map, length);
+        }
+    };
+
+    auto mapping = new PipeWireBufferMapping;
+    // Planar formats may come with a data block per plane
+    for (uint i = 0; i < spaBuffer->n_datas && spaBuffer->datas[i].type == SPA_DATA_MemFd; ++i) {
+        const spa_data &data = spaBuffer->datas[i];
+        const size_t mapEnd = data.maxsize + data.mapoffset;
+        uint8_t *map = static_cast<uint8_t *>(mmap(nullptr, mapEnd, PROT_READ, MAP_PRIVATE, data.fd, 0));
+        if (map == MAP_FAILED) {
+            qCWarning(PIPEWIRE_LOGGING) << "Failed to mmap the memory: " << strerror(errno);
+            unmapAll(maps);
+            delete mapping;
+            return;
+        }
+        maps.append({map, mapEnd});
+        mapping->blocks.append(map + data.mapoffset);
+    }
+
+    mapping->data = mapping->blocks.constFirst();
+    mapping->cleanup = new PipeWireFrameCleanupFunction([maps, unmapAll] {
+        unmapAll(maps);
+    });
+    // The buffer holds a reference of its own until it gets removed from the stream
+    mapping->cleanup->ref();
+    buffer->user_data = mapping;
+}
+
+void PWHelpers::unmapBuffer(pw_buffer *buffer)
+{
+    auto mapping = static_cast<PipeWireBufferMapping *>(buffer->user_data);
+    if (!mapping) {
+        return;
+    }
+
+    buffer->user_data = nullptr;
+    PipeWireFrameCleanupFunction::unref(mapping->cleanup);
+    delete mapping;
 }
@@ -41,8 +41,7 @@ public:
             return;
         }
         auto self = static_cast<PipeWireFrameCleanupFunction *>(x);
-        self->m_ref--;
-        if (self->m_ref == 0) {
+        if (!self->m_ref.deref()) {
             self->m_cleanup();
             delete self;
         }
@@ -53,9 +52,53 @@ private:
     std::function<void()> m_cleanup;
 };
 
+/**
+ * The mapping of a MemFd backed pw_buffer, created once when the buffer is added to
+ * the stream and stored in its user_data so that every frame delivered in it can
+ * reuse it instead of mapping and unmapping the memory again.
+ *
+ * The mapping is owned by @p cleanup, frames that still reference it keep it alive
+ * after the buffer has been removed from the stream.
+ */
+struct PipeWireBufferMapping {
+    uint8_t *data = nullptr;
+    /// The memory of each data block of the buffer, for planar formats that spread their planes over several
+    QList<uint8_t *> blocks;
+    PipeWireFrameCleanupFunction *cleanup = nullptr;
+};
+
 namespace PWHelpers
 {
 
 KPIPEWIRE_EXPORT QImage
 SpaBufferToQImage(const uchar *data, int width, int height, qsizetype bytesPerLine, spa_video_format format, PipeWireFrameCleanupFunction *cleanup);
+
+/**
+ * Whether @p format is one of the YUV formats that are negotiated for software
+ * encoding. Frames in these formats can't be converted to a QImage.
+ */
+KPIPEWIRE_EXPORT bool isYuvFormat(spa_video_format format);
+/**
+ * The number of planes frames in @p format consist of, 1 for packed formats.
+ */
+KPIPEWIRE_EXPORT int planeCount(spa_video_format format);
+/**
+ * The number of lines of @p plane in a frame of @p height lines.
+ */
+KPIPEWIRE_EXPORT int planeHeight(spa_video_format format, int plane, int height);
+/**
+ * The stride of @p plane when all planes are stored in a single block whose first
+ * plane has @p stride, which is how PipeWire lays them out by default.
+ */
+KPIPEWIRE_EXPORT qint32 planeStride(spa_video_format format, int plane, qint32 stride);
+
+/**
+ * Maps the memory of a MemFd backed @p buffer and stores it as a PipeWireBufferMapping
+ * in its user_data. Does nothing for other buffer types.
+ */
+KPIPEWIRE_EXPORT void mapBuffer(pw_buffer *buffer);
+/**
+ * Releases the mapping created by mapBuffer(), if any.
+ */
+KPIPEWIRE_EXPORT void unmapBuffer(pw_buffer *buffer);
 }
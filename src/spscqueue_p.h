@@ -0,0 +1,87 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+/**
+ * A bounded, lock-free queue for handing values from exactly one producer
+ * thread to exactly one consumer thread.
+ *
+ * Neither side ever blocks: push() fails when the queue is full and pop()
+ * returns nothing when it is empty, so the caller decides whether to drop or
+ * to retry later.
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(std::size_t capacity)
+        // One slot is always kept free to tell a full queue from an empty one
+        : m_slots(capacity + 1)
+    {
+    }
+
+    std::size_t capacity() const
+    {
+        return m_slots.size() - 1;
+    }
+
+    // Only to be called from the producer thread.
+    bool push(T &&value)
+    {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        const std::size_t next = increment(head);
+        if (next == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        m_slots[head] = std::move(value);
+        m_head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Only to be called from the consumer thread.
+    std::optional<T> pop()
+    {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) {
+            return std::nullopt;
+        }
+        std::optional<T> value = std::move(m_slots[tail]);
+        // Don't keep whatever the value references alive until the slot is reused
+        m_slots[tail] = T{};
+        m_tail.store(increment(tail), std::memory_order_release);
+        return value;
+    }
+
+    // A snapshot, only exact when called from either end while the other is idle.
+    std::size_t size() const
+    {
+        const std::size_t head = m_head.load(std::memory_order_acquire);
+        const std::size_t tail = m_tail.load(std::memory_order_acquire);
+        return head >= tail ? head - tail : head + m_slots.size() - tail;
+    }
+
+    bool isEmpty() const
+    {
+        return size() == 0;
+    }
+
+private:
+    std::size_t increment(std::size_t index) const
+    {
+        return index + 1 == m_slots.size() ? 0 : index + 1;
+    }
+
+    std::vector<T> m_slots;
+    // Kept on separate cache lines so the two threads don't contend on them
+    alignas(64) std::atomic_size_t m_head = 0;
+    alignas(64) std::atomic_size_t m_tail = 0;
+};
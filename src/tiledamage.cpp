@@ -0,0 +1,274 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include "tiledamage_p.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILEDAMAGE_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TILEDAMAGE_NEON 1
+#endif
+
+using TileHash = TileDamage::TileHash;
+using TileState = TileDamage::TileState;
+
+namespace
+{
+// Every 4 bytes of a tile's row have a lane in its state, which is mixed as
+// x = (state ^ data) * Multiplier, state = x ^ (x >> 16) for each row. Each step
+// is a bijection of the state and of the data, so a change within a single column
+// of lanes always changes the hash. The lanes of a row do not depend on each
+// other, which keeps the SIMD units busy instead of waiting on multiplications.
+constexpr uint32_t Multiplier = 0x9E3779B1;
+constexpr uint32_t Seed = 0x85EBCA77;
+
+// Hashes one row of every tile into its state, @p tileBytes at a time
+using HashRowFunction = void (*)(const uint8_t *row, int rowBytes, int tileBytes, TileState *states);
+
+void hashRowGeneric(const uint8_t *row, int rowBytes, int tileBytes, TileState *states)
+{
+    const auto hashTileRow = [&](const uint8_t *data, TileState *tile) {
+        for (int i = 0; i < tileBytes / 4; ++i) {
+            uint32_t word;
+            std::memcpy(&word, data + i * 4, sizeof(word));
+            const uint32_t x = (tile->lanes[i] ^ word) * Multiplier;
+            tile->lanes[i] = x ^ (x >> 16);
+        }
+    };
+
+    const int fullTiles = rowBytes / tileBytes;
+    for (int tile = 0; tile < fullTiles; ++tile) {
+        hashTileRow(row + tile * tileBytes, states + tile);
+    }
+    if (const int rest = rowBytes - fullTiles * tileBytes) {
+        uint8_t tail[sizeof(TileState)] = {};
+        std::memcpy(tail, row + fullTiles * tileBytes, rest);
+        hashTileRow(tail, states + fullTiles);
+    }
+}
+
+#if TILEDAMAGE_X86
+template<int Vectors>
+__attribute__((target("avx2"))) inline void hashTileRowAvx2(const uint8_t *data, __m256i *state, __m256i multiplier)
+{
+    for (int i = 0; i < Vectors; ++i) {
+        const auto x = _mm256_mullo_epi32(_mm256_xor_si256(_mm256_load_si256(state + i), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + i)),
+                                          multiplier);
+        _mm256_store_si256(state + i, _mm256_xor_si256(x, _mm256_srli_epi32(x, 16)));
+    }
+}
+
+template<int Vectors>
+__attribute__((target("avx2"))) void hashRowAvx2(const uint8_t *row, int rowBytes, TileState *states)
+{
+    constexpr int tileBytes = Vectors * sizeof(__m256i);
+    const auto multiplier = _mm256_set1_epi32(int(Multiplier));
+    const int fullTiles = rowBytes / tileBytes;
+    for (int tile = 0; tile < fullTiles; ++tile) {
+        hashTileRowAvx2<Vectors>(row + tile * tileBytes, reinterpret_cast<__m256i *>(states[tile].lanes), multiplier);
+    }
+    if (const int rest = rowBytes - fullTiles * tileBytes) {
+        alignas(32) uint8_t tail[tileBytes] = {};
+        std::memcpy(tail, row + fullTiles * tileBytes, rest);
+        hashTileRowAvx2<Vectors>(tail, reinterpret_cast<__m256i *>(states[fullTiles].lanes), multiplier);
+    }
+}
+
+void hashRowAvx2(const uint8_t *row, int rowBytes, int tileBytes, TileState *states)
+{
+    // Tiles are 64, 128, 192 or 256 bytes wide, unroll for each of them
+    switch (tileBytes) {
+    case 256:
+        return hashRowAvx2<8>(row, rowBytes, states);
+    case 192:
+        return hashRowAvx2<6>(row, rowBytes, states);
+    case 128:
+        return hashRowAvx2<4>(row, rowBytes, states);
+    default:
+        return hashRowAvx2<2>(row, rowBytes, states);
+    }
+}
+
+template<int Vectors>
+__attribute__((target("sse4.1"))) inline void hashTileRowSse41(const uint8_t *data, __m128i *state, __m128i multiplier)
+{
+    for (int i = 0; i < Vectors; ++i) {
+        const auto x = _mm_mullo_epi32(_mm_xor_si128(_mm_load_si128(state + i), _mm_loadu_si128(reinterpret_cast<const __m128i *>(data) + i)), multiplier);
+        _mm_store_si128(state + i, _mm_xor_si128(x, _mm_srli_epi32(x, 16)));
+    }
+}
+
+template<int Vectors>
+__attribute__((target("sse4.1"))) void hashRowSse41(const uint8_t *row, int rowBytes, TileState *states)
+{
+    constexpr int tileBytes = Vectors * sizeof(__m128i);
+    const auto multiplier = _mm_set1_epi32(int(Multiplier));
+    const int fullTiles = rowBytes / tileBytes;
+    for (int tile = 0; tile < fullTiles; ++tile) {
+        hashTileRowSse41<Vectors>(row + tile * tileBytes, reinterpret_cast<__m128i *>(states[tile].lanes), multiplier);
+    }
+    if (const int rest = rowBytes - fullTiles * tileBytes) {
+        alignas(16) uint8_t tail[tileBytes] = {};
+        std::memcpy(tail, row + fullTiles * tileBytes, rest);
+        hashTileRowSse41<Vectors>(tail, reinterpret_cast<__m128i *>(states[fullTiles].lanes), multiplier);
+    }
+}
+
+void hashRowSse41(const uint8_t *row, int rowBytes, int tileBytes, TileState *states)
+{
+    switch (tileBytes) {
+    case 256:
+        return hashRowSse41<16>(row, rowBytes, states);
+    case 192:
+        return hashRowSse41<12>(row, rowBytes, states);
+    case 128:
+        return hashRowSse41<8>(row, rowBytes, states);
+    default:
+        return hashRowSse41<4>(row, rowBytes, states);
+    }
+}
+#endif
+
+#if TILEDAMAGE_NEON
+void hashRowNeon(const uint8_t *row, int rowBytes, int tileBytes, TileState *states)
+{
+    const auto multiplier = vdupq_n_u32(Multiplier);
+    const auto hashTileRow = [&](const uint8_t *data, TileState *tile) {
+        for (int i = 0; i < tileBytes / 16; ++i) {
+            const auto x = vmulq_u32(veorq_u32(vld1q_u32(tile->lanes + i * 4), vreinterpretq_u32_u8(vld1q_u8(data + i * 16))), multiplier);
+            vst1q_u32(tile->lanes + i * 4, veorq_u32(x, vshrq_n_u32(x, 16)));
+        }
+    };
+
+    const int fullTiles = rowBytes / tileBytes;
+    for (int tile = 0; tile < fullTiles; ++tile) {
+        hashTileRow(row + tile * tileBytes, states + tile);
+    }
+    if (const int rest = rowBytes - fullTiles * tileBytes) {
+        uint8_t tail[sizeof(TileState)] = {};
+        std::memcpy(tail, row + fullTiles * tileBytes, rest);
+        hashTileRow(tail, states + fullTiles);
+    }
+}
+#endif
+
+// Fold the lanes of a tile into its hash, again a bijection of each lane
+TileHash fold(const TileState &state)
+{
+    constexpr int width = std::size(TileHash{}.lanes);
+    TileHash hash;
+    for (int lane = 0; lane < width; ++lane) {
+        uint32_t h = Seed;
+        for (int i = lane; i < int(std::size(state.lanes)); i += width) {
+            h = (h ^ state.lanes[i]) * Multiplier;
+            h ^= h >> 16;
+        }
+        hash.lanes[lane] = h;
+    }
+    return hash;
+}
+
+struct Implementation {
+    HashRowFunction hashRow;
+    const char *name;
+};
+
+const Implementation &implementation()
+{
+    static const Implementation implementation = []() -> Implementation {
+#if TILEDAMAGE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return {hashRowAvx2, "AVX2"};
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return {hashRowSse41, "SSE4.1"};
+        }
+#elif TILEDAMAGE_NEON
+        return {hashRowNeon, "NEON"};
+#endif
+        return {hashRowGeneric, "generic"};
+    }();
+    return implementation;
+}
+}
+
+QRegion TileDamage::update(const uint8_t *data, qint32 stride, const QSize &size, int bytesPerPixel)
+{
+    const QRect frame(QPoint(0, 0), size);
+    if (!data || size.isEmpty() || bytesPerPixel <= 0) {
+        reset();
+        return frame;
+    }
+
+    const int tilesPerRow = (size.width() + TileSize - 1) / TileSize;
+    const int tileRows = (size.height() + TileSize - 1) / TileSize;
+    const bool complete = size != m_size || stride != m_stride || bytesPerPixel != m_bytesPerPixel;
+    if (complete) {
+        m_size = size;
+        m_stride = stride;
+        m_bytesPerPixel = bytesPerPixel;
+        m_hashes.assign(tilesPerRow * tileRows, {});
+    }
+    m_band.resize(tilesPerRow);
+
+    const auto hashRow = ::implementation().hashRow;
+    const int rowBytes = size.width() * bytesPerPixel;
+    const int tileBytes = TileSize * bytesPerPixel;
+
+    TileState seed;
+    std::fill(std::begin(seed.lanes), std::end(seed.lanes), Seed);
+
+    QRegion damage;
+    for (int tileRow = 0; tileRow < tileRows; ++tileRow) {
+        // Walk the band row by row, the memory is read front to back once
+        std::fill(m_band.begin(), m_band.end(), seed);
+        const int firstRow = tileRow * TileSize;
+        const int lastRow = std::min(firstRow + TileSize, size.height());
+        for (int y = firstRow; y < lastRow; ++y) {
+            hashRow(data + qsizetype(y) * stride, rowBytes, tileBytes, m_band.data());
+        }
+
+        // Merge neighbouring changed tiles to keep the region small
+        auto previous = m_hashes.begin() + tileRow * tilesPerRow;
+        int runStart = -1;
+        for (int tile = 0; tile <= tilesPerRow; ++tile) {
+            bool changed = false;
+            if (tile < tilesPerRow) {
+                const auto hash = fold(m_band[tile]);
+                changed = complete || std::memcmp(&previous[tile], &hash, sizeof(TileHash)) != 0;
+                previous[tile] = hash;
+            }
+            if (changed && runStart < 0) {
+                runStart = tile;
+            } else if (!changed && runStart >= 0) {
+                damage += QRect(runStart * TileSize, firstRow, (tile - runStart) * TileSize, TileSize) & frame;
+                runStart = -1;
+            }
+        }
+    }
+
+    return damage;
+}
+
+void TileDamage::reset()
+{
+    m_hashes.clear();
+    m_size = {};
+    m_stride = 0;
+    m_bytesPerPixel = 0;
+}
+
+const char *TileDamage::implementation()
+{
+    return ::implementation().name;
+}
@@ -0,0 +1,71 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <QRegion>
+#include <QSize>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Finds the parts of a frame that changed since the previous one, for sources
+ * that do not report damage themselves.
+ *
+ * Frames are split into TileSize x TileSize tiles. Every tile is hashed with
+ * the widest SIMD instructions the CPU has, and the tiles whose hash differs
+ * from the one of the previous frame make up the damage. Only the hashes are
+ * kept, not the previous frame.
+ *
+ * It is not thread safe, use one per stream.
+ */
+class TileDamage
+{
+public:
+    static constexpr int TileSize = 64;
+
+    /**
+     * Compare a frame to the previous one.
+     *
+     * The first frame, and a frame that differs in size, stride or format from
+     * the previous one, are damaged completely.
+     *
+     * @param data The first row of the frame, or of one plane of a planar one.
+     * @param stride The distance between the start of two rows in bytes.
+     * @param bytesPerPixel The size of a pixel in @p data.
+     *
+     * @return The changed tiles, clipped to @p size. Empty when nothing changed.
+     */
+    QRegion update(const uint8_t *data, qint32 stride, const QSize &size, int bytesPerPixel);
+
+    /**
+     * Forget the previous frame, so the next one is damaged completely.
+     */
+    void reset();
+
+    /**
+     * The name of the instruction set used for hashing, for logs and benchmarks.
+     */
+    static const char *implementation();
+
+    // The state of a tile while it is hashed, eight AVX2 registers
+    struct alignas(32) TileState {
+        uint32_t lanes[64];
+    };
+    // The hash of a tile that is kept until the next frame
+    struct TileHash {
+        uint32_t lanes[16];
+    };
+
+private:
+    std::vector<TileHash> m_hashes;
+    // The tiles of the row of tiles being hashed
+    std::vector<TileState> m_band;
+    QSize m_size;
+    qint32 m_stride = 0;
+    int m_bytesPerPixel = 0;
+};
@@ -0,0 +1,62 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Wakes a worker thread up when there is new work for it, without losing
+ * wakeups that happen while it is busy.
+ *
+ * Every notify() bumps a generation counter. The worker takes the generation
+ * before looking for work and parks in wait() with it afterwards, so it only
+ * sleeps if nobody notified it in between. Parking uses std::atomic::wait,
+ * which is a futex on Linux, so neither side needs a mutex.
+ *
+ * Conditions that end the loop need to be checked after taking the generation,
+ * like any other work, or a stop request in between goes unnoticed and the
+ * worker parks for good.
+ *
+ * @code
+ * for (;;) {
+ *     const auto seen = signal.generation();
+ *     if (!running) {
+ *         break;
+ *     }
+ *     doWork();
+ *     signal.wait(seen);
+ * }
+ * @endcode
+ */
+class WorkerSignal
+{
+public:
+    uint32_t generation() const
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+
+    // Can be called from any thread.
+    void notify()
+    {
+        m_generation.fetch_add(1, std::memory_order_release);
+        m_generation.notify_one();
+    }
+
+    // Returns right away if notify() was called since @p seen was taken.
+    void wait(uint32_t seen) const
+    {
+        // std::atomic::wait may return spuriously, so check the predicate again
+        while (m_generation.load(std::memory_order_acquire) == seen) {
+            m_generation.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+private:
+    std::atomic_uint32_t m_generation = 0;
+};
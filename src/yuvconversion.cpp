@@ -0,0 +1,592 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#include "yuvconversion_p.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUVCONVERSION_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define YUVCONVERSION_NEON 1
+#endif
+
+namespace
+{
+// Coefficients are fixed point with 15 fractional bits, so that they fit the
+// 16 bit multiplications of the SIMD instructions. Chroma is computed from the
+// sums of 2x2 pixels, which adds 2 more bits.
+constexpr int Shift = 15;
+constexpr int ChromaShift = Shift + 2;
+
+struct Coefficients {
+    int16_t yr, yg, yb;
+    int16_t ur, ug, ub;
+    int16_t vr, vg, vb;
+    // Including the rounding
+    int32_t yOffset;
+    int32_t chromaOffset;
+};
+
+constexpr Coefficients makeCoefficients(bool fullRange)
+{
+    // BT.601, Y = Kr * R + Kg * G + Kb * B, U and V are the scaled differences of B and R to it
+    constexpr double kr = 0.299;
+    constexpr double kb = 0.114;
+    const double lumaScale = (fullRange ? 255.0 : 219.0) / 255 * (1 << Shift);
+    const double chromaScale = (fullRange ? 255.0 : 224.0) / 255 * (1 << Shift);
+    const auto round = [](double value) {
+        return int(value < 0 ? value - 0.5 : value + 0.5);
+    };
+
+    Coefficients c{};
+    c.yr = round(kr * lumaScale);
+    c.yb = round(kb * lumaScale);
+    // Derived from the others so that they add up exactly: white stays white and grey has no chroma
+    c.yg = round(lumaScale) - c.yr - c.yb;
+    c.ur = round(-kr / (2 * (1 - kb)) * chromaScale);
+    c.ub = round(0.5 * chromaScale);
+    c.ug = -c.ur - c.ub;
+    c.vr = round(0.5 * chromaScale);
+    c.vb = round(-kb / (2 * (1 - kr)) * chromaScale);
+    c.vg = -c.vr - c.vb;
+    c.yOffset = ((fullRange ? 0 : 16) << Shift) + (1 << (Shift - 1));
+    c.chromaOffset = (128 << ChromaShift) + (1 << (ChromaShift - 1));
+    return c;
+}
+
+constexpr Coefficients LimitedRange = makeCoefficients(false);
+constexpr Coefficients FullRange = makeCoefficients(true);
+
+// Where red, green and blue are in the pixels of the formats that are converted
+enum Layout {
+    RGBx,
+    BGRx,
+    xRGB,
+    xBGR,
+    RGB,
+    BGR,
+    LayoutCount,
+};
+
+std::optional<Layout> layout(spa_video_format format)
+{
+    switch (format) {
+    case SPA_VIDEO_FORMAT_RGBx:
+    case SPA_VIDEO_FORMAT_RGBA:
+        return RGBx;
+    case SPA_VIDEO_FORMAT_BGRx:
+    case SPA_VIDEO_FORMAT_BGRA:
+        return BGRx;
+    case SPA_VIDEO_FORMAT_xRGB:
+    case SPA_VIDEO_FORMAT_ARGB:
+        return xRGB;
+    case SPA_VIDEO_FORMAT_xBGR:
+    case SPA_VIDEO_FORMAT_ABGR:
+        return xBGR;
+    case SPA_VIDEO_FORMAT_RGB:
+        return RGB;
+    case SPA_VIDEO_FORMAT_BGR:
+        return BGR;
+    default:
+        return std::nullopt;
+    }
+}
+
+inline uint8_t clamp8(int value)
+{
+    return uint8_t(std::clamp(value, 0, 255));
+}
+
+// Converts two rows of pixels into two rows of luma and one of each chroma plane.
+// For the last row of odd heights, @p bottom is @p top and @p yBottom is @p yTop.
+using ConvertRowsFunction = void (*)(const uint8_t *top,
+                                     const uint8_t *bottom,
+                                     int width,
+                                     const Coefficients &c,
+                                     uint8_t *yTop,
+                                     uint8_t *yBottom,
+                                     uint8_t *u,
+                                     uint8_t *v);
+
+struct Generic {
+    template<int Bpp, int R, int G, int B>
+    static void convertRows(const uint8_t *top, const uint8_t *bottom, int width, const Coefficients &c, uint8_t *yTop, uint8_t *yBottom, uint8_t *u, uint8_t *v)
+    {
+        const auto luma = [&c](const uint8_t *pixel) {
+            return clamp8((c.yr * pixel[R] + c.yg * pixel[G] + c.yb * pixel[B] + c.yOffset) >> Shift);
+        };
+
+        for (int x = 0; x < width; x += 2) {
+            const int next = std::min(x + 1, width - 1);
+            const std::array<const uint8_t *, 4> pixels = {top + x * Bpp, top + next * Bpp, bottom + x * Bpp, bottom + next * Bpp};
+            yTop[x] = luma(pixels[0]);
+            yTop[next] = luma(pixels[1]);
+            yBottom[x] = luma(pixels[2]);
+            yBottom[next] = luma(pixels[3]);
+
+            int red = 0;
+            int green = 0;
+            int blue = 0;
+            for (const uint8_t *pixel : pixels) {
+                red += pixel[R];
+                green += pixel[G];
+                blue += pixel[B];
+            }
+            u[x / 2] = clamp8((c.ur * red + c.ug * green + c.ub * blue + c.chromaOffset) >> ChromaShift);
+            v[x / 2] = clamp8((c.vr * red + c.vg * green + c.vb * blue + c.chromaOffset) >> ChromaShift);
+        }
+    }
+};
+
+// A pair of 16 bit coefficients, for multiplying with the 16 bit pairs of channels below
+inline int32_t pair(int16_t low, int16_t high)
+{
+    return int32_t(uint32_t(uint16_t(high)) << 16 | uint16_t(low));
+}
+
+// Shuffles two channels of each pixel into a pair of 16 bit values, in every
+// 128 bit lane of four pixels. A channel of -1 leaves its value 0.
+template<int Bpp, int First, int Second>
+struct PairShuffle {
+    static constexpr std::array<int8_t, 64> bytes = [] {
+        std::array<int8_t, 64> bytes{};
+        for (int i = 0; i < int(bytes.size()); ++i) {
+            const int pixel = (i % 16) / 4;
+            const int channel = i % 4 == 0 ? First : i % 4 == 2 ? Second : -1;
+            bytes[i] = channel < 0 ? -1 : int8_t(pixel * Bpp + channel);
+        }
+        return bytes;
+    }();
+};
+
+// Loads of 3 byte pixels read 16 bytes for every 12, keep this many pixels away from the end of a row
+template<int Bpp>
+constexpr int OverreadPixels = Bpp == 3 ? 2 : 0;
+
+#if YUVCONVERSION_X86
+// Rows are converted 16 pixels at a time, 8 in each vector. The channels are
+// shuffled into 16 bit pairs of red and green, and of blue and 0, which
+// _mm256_madd_epi16() multiplies and adds up in one go.
+struct Avx2 {
+    template<int Bpp>
+    __attribute__((target("avx2"))) static inline __m256i load(const uint8_t *pixels)
+    {
+        if constexpr (Bpp == 4) {
+            return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels));
+        }
+        // Four pixels in the low 12 bytes of each lane
+        return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels))),
+                                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 12)),
+                                       1);
+    }
+
+    // Multiplies the channels with the coefficients of a plane and adds them up, 32 bits per pixel
+    template<int Bits>
+    __attribute__((target("avx2"))) static inline __m256i dot(__m256i rg, __m256i b, __m256i rgCoefficients, __m256i bCoefficients, __m256i offset)
+    {
+        const auto products = _mm256_add_epi32(_mm256_madd_epi16(rg, rgCoefficients), _mm256_madd_epi16(b, bCoefficients));
+        return _mm256_srai_epi32(_mm256_add_epi32(products, offset), Bits);
+    }
+
+    // Adds up the channels of both rows, then each pixel with its right neighbour into the even lanes
+    __attribute__((target("avx2"))) static inline __m256i sum2x2(__m256i top, __m256i bottom)
+    {
+        const auto sums = _mm256_add_epi16(top, bottom);
+        return _mm256_add_epi16(sums, _mm256_srli_epi64(sums, 32));
+    }
+
+    // The even lanes of both vectors, in order
+    __attribute__((target("avx2"))) static inline __m256i evenLanes(__m256i first, __m256i second)
+    {
+        return _mm256_permutevar8x32_epi32(_mm256_blend_epi32(first, _mm256_slli_epi64(second, 32), 0xAA), _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7));
+    }
+
+    template<int Bpp, int R, int G, int B>
+    __attribute__((target("avx2"))) static void
+    convertRows(const uint8_t *top, const uint8_t *bottom, int width, const Coefficients &c, uint8_t *yTop, uint8_t *yBottom, uint8_t *u, uint8_t *v)
+    {
+        const auto rgShuffle = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(PairShuffle<Bpp, R, G>::bytes.data()));
+        const auto bShuffle = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(PairShuffle<Bpp, B, -1>::bytes.data()));
+        const auto yRG = _mm256_set1_epi32(pair(c.yr, c.yg));
+        const auto yB = _mm256_set1_epi32(pair(c.yb, 0));
+        const auto uRG = _mm256_set1_epi32(pair(c.ur, c.ug));
+        const auto uB = _mm256_set1_epi32(pair(c.ub, 0));
+        const auto vRG = _mm256_set1_epi32(pair(c.vr, c.vg));
+        const auto vB = _mm256_set1_epi32(pair(c.vb, 0));
+        const auto yOffset = _mm256_set1_epi32(c.yOffset);
+        const auto chromaOffset = _mm256_set1_epi32(c.chromaOffset);
+
+        int x = 0;
+        for (; x <= width - 16 - OverreadPixels<Bpp>; x += 16) {
+            __m256i rg[2][2];
+            __m256i b[2][2];
+            for (int row = 0; row < 2; ++row) {
+                const uint8_t *pixels = (row == 0 ? top : bottom) + x * Bpp;
+                __m256i y[2];
+                for (int half = 0; half < 2; ++half) {
+                    const auto loaded = load<Bpp>(pixels + half * 8 * Bpp);
+                    rg[row][half] = _mm256_shuffle_epi8(loaded, rgShuffle);
+                    b[row][half] = _mm256_shuffle_epi8(loaded, bShuffle);
+                    y[half] = dot<Shift>(rg[row][half], b[row][half], yRG, yB, yOffset);
+                }
+                const auto words = _mm256_permute4x64_epi64(_mm256_packs_epi32(y[0], y[1]), 0xD8);
+                const auto bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0xD8);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>((row == 0 ? yTop : yBottom) + x), _mm256_castsi256_si128(bytes));
+            }
+
+            __m256i rgSums[2];
+            __m256i bSums[2];
+            for (int half = 0; half < 2; ++half) {
+                rgSums[half] = sum2x2(rg[0][half], rg[1][half]);
+                bSums[half] = sum2x2(b[0][half], b[1][half]);
+            }
+            const auto chromaU = evenLanes(dot<ChromaShift>(rgSums[0], bSums[0], uRG, uB, chromaOffset), dot<ChromaShift>(rgSums[1], bSums[1], uRG, uB, chromaOffset));
+            const auto chromaV = evenLanes(dot<ChromaShift>(rgSums[0], bSums[0], vRG, vB, chromaOffset), dot<ChromaShift>(rgSums[1], bSums[1], vRG, vB, chromaOffset));
+            const auto words = _mm256_permute4x64_epi64(_mm256_packs_epi32(chromaU, chromaV), 0xD8);
+            const auto bytes = _mm256_packus_epi16(words, words);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), _mm256_castsi256_si128(bytes));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), _mm256_extracti128_si256(bytes, 1));
+        }
+
+        if (x < width) {
+            Generic::convertRows<Bpp, R, G, B>(top + x * Bpp, bottom + x * Bpp, width - x, c, yTop + x, yBottom + x, u + x / 2, v + x / 2);
+        }
+    }
+};
+
+// Like Avx2, with 32 pixels at a time and instructions that collect lanes and
+// narrow them without shuffling them in place first
+struct Avx512 {
+    template<int Bpp>
+    __attribute__((target("avx512f,avx512bw"))) static inline __m512i load(const uint8_t *pixels)
+    {
+        if constexpr (Bpp == 4) {
+            return _mm512_loadu_si512(pixels);
+        }
+        auto loaded = _mm512_castsi128_si512(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels)));
+        loaded = _mm512_inserti32x4(loaded, _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 12)), 1);
+        loaded = _mm512_inserti32x4(loaded, _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 24)), 2);
+        return _mm512_inserti32x4(loaded, _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 36)), 3);
+    }
+
+    template<int Bits>
+    __attribute__((target("avx512f,avx512bw"))) static inline __m512i dot(__m512i rg, __m512i b, __m512i rgCoefficients, __m512i bCoefficients, __m512i offset)
+    {
+        const auto products = _mm512_add_epi32(_mm512_madd_epi16(rg, rgCoefficients), _mm512_madd_epi16(b, bCoefficients));
+        return _mm512_srai_epi32(_mm512_add_epi32(products, offset), Bits);
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) static inline __m512i sum2x2(__m512i top, __m512i bottom)
+    {
+        const auto sums = _mm512_add_epi16(top, bottom);
+        return _mm512_add_epi16(sums, _mm512_srli_epi64(sums, 32));
+    }
+
+    // Stores the even lanes of both vectors as 16 bytes
+    __attribute__((target("avx512f,avx512bw"))) static inline void storeEvenLanes(__m512i first, __m512i second, uint8_t *destination)
+    {
+        const auto evenLanes = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(destination), _mm512_cvtusepi32_epi8(_mm512_permutex2var_epi32(first, evenLanes, second)));
+    }
+
+    template<int Bpp, int R, int G, int B>
+    __attribute__((target("avx512f,avx512bw"))) static void
+    convertRows(const uint8_t *top, const uint8_t *bottom, int width, const Coefficients &c, uint8_t *yTop, uint8_t *yBottom, uint8_t *u, uint8_t *v)
+    {
+        const auto rgShuffle = _mm512_loadu_si512(PairShuffle<Bpp, R, G>::bytes.data());
+        const auto bShuffle = _mm512_loadu_si512(PairShuffle<Bpp, B, -1>::bytes.data());
+        const auto yRG = _mm512_set1_epi32(pair(c.yr, c.yg));
+        const auto yB = _mm512_set1_epi32(pair(c.yb, 0));
+        const auto uRG = _mm512_set1_epi32(pair(c.ur, c.ug));
+        const auto uB = _mm512_set1_epi32(pair(c.ub, 0));
+        const auto vRG = _mm512_set1_epi32(pair(c.vr, c.vg));
+        const auto vB = _mm512_set1_epi32(pair(c.vb, 0));
+        const auto yOffset = _mm512_set1_epi32(c.yOffset);
+        const auto chromaOffset = _mm512_set1_epi32(c.chromaOffset);
+
+        int x = 0;
+        for (; x <= width - 32 - OverreadPixels<Bpp>; x += 32) {
+            __m512i rg[2][2];
+            __m512i b[2][2];
+            for (int row = 0; row < 2; ++row) {
+                const uint8_t *pixels = (row == 0 ? top : bottom) + x * Bpp;
+                uint8_t *luma = (row == 0 ? yTop : yBottom) + x;
+                for (int half = 0; half < 2; ++half) {
+                    const auto loaded = load<Bpp>(pixels + half * 16 * Bpp);
+                    rg[row][half] = _mm512_shuffle_epi8(loaded, rgShuffle);
+                    b[row][half] = _mm512_shuffle_epi8(loaded, bShuffle);
+                    const auto y = dot<Shift>(rg[row][half], b[row][half], yRG, yB, yOffset);
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(luma + half * 16), _mm512_cvtusepi32_epi8(y));
+                }
+            }
+
+            __m512i rgSums[2];
+            __m512i bSums[2];
+            for (int half = 0; half < 2; ++half) {
+                rgSums[half] = sum2x2(rg[0][half], rg[1][half]);
+                bSums[half] = sum2x2(b[0][half], b[1][half]);
+            }
+            storeEvenLanes(dot<ChromaShift>(rgSums[0], bSums[0], uRG, uB, chromaOffset), dot<ChromaShift>(rgSums[1], bSums[1], uRG, uB, chromaOffset), u + x / 2);
+            storeEvenLanes(dot<ChromaShift>(rgSums[0], bSums[0], vRG, vB, chromaOffset), dot<ChromaShift>(rgSums[1], bSums[1], vRG, vB, chromaOffset), v + x / 2);
+        }
+
+        if (x < width) {
+            Avx2::convertRows<Bpp, R, G, B>(top + x * Bpp, bottom + x * Bpp, width - x, c, yTop + x, yBottom + x, u + x / 2, v + x / 2);
+        }
+    }
+};
+
+// Like Avx2, with 8 pixels at a time
+struct Sse41 {
+    template<int Bits>
+    __attribute__((target("sse4.1"))) static inline __m128i dot(__m128i rg, __m128i b, __m128i rgCoefficients, __m128i bCoefficients, __m128i offset)
+    {
+        const auto products = _mm_add_epi32(_mm_madd_epi16(rg, rgCoefficients), _mm_madd_epi16(b, bCoefficients));
+        return _mm_srai_epi32(_mm_add_epi32(products, offset), Bits);
+    }
+
+    __attribute__((target("sse4.1"))) static inline __m128i sum2x2(__m128i top, __m128i bottom)
+    {
+        const auto sums = _mm_add_epi16(top, bottom);
+        return _mm_add_epi16(sums, _mm_srli_epi64(sums, 32));
+    }
+
+    __attribute__((target("sse4.1"))) static inline __m128i evenLanes(__m128i first, __m128i second)
+    {
+        return _mm_shuffle_epi32(_mm_blend_epi16(first, _mm_slli_epi64(second, 32), 0xCC), _MM_SHUFFLE(3, 1, 2, 0));
+    }
+
+    template<int Bpp, int R, int G, int B>
+    __attribute__((target("sse4.1"))) static void
+    convertRows(const uint8_t *top, const uint8_t *bottom, int width, const Coefficients &c, uint8_t *yTop, uint8_t *yBottom, uint8_t *u, uint8_t *v)
+    {
+        const auto rgShuffle = _mm_loadu_si128(reinterpret_cast<const __m128i *>(PairShuffle<Bpp, R, G>::bytes.data()));
+        const auto bShuffle = _mm_loadu_si128(reinterpret_cast<const __m128i *>(PairShuffle<Bpp, B, -1>::bytes.data()));
+        const auto yRG = _mm_set1_epi32(pair(c.yr, c.yg));
+        const auto yB = _mm_set1_epi32(pair(c.yb, 0));
+        const auto uRG = _mm_set1_epi32(pair(c.ur, c.ug));
+        const auto uB = _mm_set1_epi32(pair(c.ub, 0));
+        const auto vRG = _mm_set1_epi32(pair(c.vr, c.vg));
+        const auto vB = _mm_set1_epi32(pair(c.vb, 0));
+        const auto yOffset = _mm_set1_epi32(c.yOffset);
+        const auto chromaOffset = _mm_set1_epi32(c.chromaOffset);
+
+        int x = 0;
+        for (; x <= width - 8 - OverreadPixels<Bpp>; x += 8) {
+            __m128i rg[2][2];
+            __m128i b[2][2];
+            for (int row = 0; row < 2; ++row) {
+                const uint8_t *pixels = (row == 0 ? top : bottom) + x * Bpp;
+                __m128i y[2];
+                for (int half = 0; half < 2; ++half) {
+                    const auto loaded = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + half * 4 * Bpp));
+                    rg[row][half] = _mm_shuffle_epi8(loaded, rgShuffle);
+                    b[row][half] = _mm_shuffle_epi8(loaded, bShuffle);
+                    y[half] = dot<Shift>(rg[row][half], b[row][half], yRG, yB, yOffset);
+                }
+                const auto words = _mm_packs_epi32(y[0], y[1]);
+                _mm_storel_epi64(reinterpret_cast<__m128i *>((row == 0 ? yTop : yBottom) + x), _mm_packus_epi16(words, words));
+            }
+
+            __m128i rgSums[2];
+            __m128i bSums[2];
+            for (int half = 0; half < 2; ++half) {
+                rgSums[half] = sum2x2(rg[0][half], rg[1][half]);
+                bSums[half] = sum2x2(b[0][half], b[1][half]);
+            }
+            const auto chromaU = evenLanes(dot<ChromaShift>(rgSums[0], bSums[0], uRG, uB, chromaOffset), dot<ChromaShift>(rgSums[1], bSums[1], uRG, uB, chromaOffset));
+            const auto chromaV = evenLanes(dot<ChromaShift>(rgSums[0], bSums[0], vRG, vB, chromaOffset), dot<ChromaShift>(rgSums[1], bSums[1], vRG, vB, chromaOffset));
+            const auto words = _mm_packs_epi32(chromaU, chromaV);
+            const auto bytes = _mm_packus_epi16(words, words);
+            const int32_t uBytes = _mm_cvtsi128_si32(bytes);
+            const int32_t vBytes = _mm_extract_epi32(bytes, 1);
+            std::memcpy(u + x / 2, &uBytes, sizeof(uBytes));
+            std::memcpy(v + x / 2, &vBytes, sizeof(vBytes));
+        }
+
+        if (x < width) {
+            Generic::convertRows<Bpp, R, G, B>(top + x * Bpp, bottom + x * Bpp, width - x, c, yTop + x, yBottom + x, u + x / 2, v + x / 2);
+        }
+    }
+};
+#endif
+
+#if YUVCONVERSION_NEON
+// 16 pixels at a time, the structured loads split the channels already
+struct Neon {
+    template<int Bpp, int R, int G, int B>
+    static void convertRows(const uint8_t *top, const uint8_t *bottom, int width, const Coefficients &c, uint8_t *yTop, uint8_t *yBottom, uint8_t *u, uint8_t *v)
+    {
+        const auto luma = [&c](uint8x8_t red, uint8x8_t green, uint8x8_t blue) {
+            const auto r = vreinterpretq_s16_u16(vmovl_u8(red));
+            const auto g = vreinterpretq_s16_u16(vmovl_u8(green));
+            const auto b = vreinterpretq_s16_u16(vmovl_u8(blue));
+            auto low = vdupq_n_s32(c.yOffset);
+            auto high = low;
+            low = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(low, vget_low_s16(r), c.yr), vget_low_s16(g), c.yg), vget_low_s16(b), c.yb);
+            high = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(high, vget_high_s16(r), c.yr), vget_high_s16(g), c.yg), vget_high_s16(b), c.yb);
+            return vqmovn_u16(vcombine_u16(vqshrun_n_s32(low, Shift), vqshrun_n_s32(high, Shift)));
+        };
+        const auto chroma = [&c](int16x8_t r, int16x8_t g, int16x8_t b, int16_t cr, int16_t cg, int16_t cb) {
+            auto low = vdupq_n_s32(c.chromaOffset);
+            auto high = low;
+            low = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(low, vget_low_s16(r), cr), vget_low_s16(g), cg), vget_low_s16(b), cb);
+            high = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(high, vget_high_s16(r), cr), vget_high_s16(g), cg), vget_high_s16(b), cb);
+            return vqmovn_u16(vcombine_u16(vqmovun_s32(vshrq_n_s32(low, ChromaShift)), vqmovun_s32(vshrq_n_s32(high, ChromaShift))));
+        };
+
+        int x = 0;
+        for (; x <= width - 16; x += 16) {
+            uint8x16_t red[2];
+            uint8x16_t green[2];
+            uint8x16_t blue[2];
+            for (int row = 0; row < 2; ++row) {
+                const uint8_t *pixels = (row == 0 ? top : bottom) + x * Bpp;
+                if constexpr (Bpp == 4) {
+                    const auto channels = vld4q_u8(pixels);
+                    red[row] = channels.val[R];
+                    green[row] = channels.val[G];
+                    blue[row] = channels.val[B];
+                } else {
+                    const auto channels = vld3q_u8(pixels);
+                    red[row] = channels.val[R];
+                    green[row] = channels.val[G];
+                    blue[row] = channels.val[B];
+                }
+                uint8_t *destination = (row == 0 ? yTop : yBottom) + x;
+                vst1_u8(destination, luma(vget_low_u8(red[row]), vget_low_u8(green[row]), vget_low_u8(blue[row])));
+                vst1_u8(destination + 8, luma(vget_high_u8(red[row]), vget_high_u8(green[row]), vget_high_u8(blue[row])));
+            }
+
+            // Add up each pixel with its right neighbour, then both rows
+            const auto sum = [](uint8x16_t upper, uint8x16_t lower) {
+                return vreinterpretq_s16_u16(vpadalq_u8(vpaddlq_u8(upper), lower));
+            };
+            const auto r = sum(red[0], red[1]);
+            const auto g = sum(green[0], green[1]);
+            const auto b = sum(blue[0], blue[1]);
+            vst1_u8(u + x / 2, chroma(r, g, b, c.ur, c.ug, c.ub));
+            vst1_u8(v + x / 2, chroma(r, g, b, c.vr, c.vg, c.vb));
+        }
+
+        if (x < width) {
+            Generic::convertRows<Bpp, R, G, B>(top + x * Bpp, bottom + x * Bpp, width - x, c, yTop + x, yBottom + x, u + x / 2, v + x / 2);
+        }
+    }
+};
+#endif
+
+using Kernels = std::array<ConvertRowsFunction, LayoutCount>;
+
+// The kernels of an instruction set, in the order of Layout
+template<typename InstructionSet>
+constexpr Kernels kernels()
+{
+    return {
+        InstructionSet::template convertRows<4, 0, 1, 2>,
+        InstructionSet::template convertRows<4, 2, 1, 0>,
+        InstructionSet::template convertRows<4, 1, 2, 3>,
+        InstructionSet::template convertRows<4, 3, 2, 1>,
+        InstructionSet::template convertRows<3, 0, 1, 2>,
+        InstructionSet::template convertRows<3, 2, 1, 0>,
+    };
+}
+
+struct Implementation {
+    Kernels kernels;
+    const char *name;
+};
+
+const Implementation &implementation()
+{
+    static const Implementation implementation = []() -> Implementation {
+#if YUVCONVERSION_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+            return {kernels<Avx512>(), "AVX-512"};
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return {kernels<Avx2>(), "AVX2"};
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return {kernels<Sse41>(), "SSE4.1"};
+        }
+#elif YUVCONVERSION_NEON
+        return {kernels<Neon>(), "NEON"};
+#endif
+        return {kernels<Generic>(), "generic"};
+    }();
+    return implementation;
+}
+
+// Grey has no chroma, and its luma is only scaled
+void convertGray(const uint8_t *data, qint32 stride, const QSize &size, const Coefficients &c, uint8_t *const *planes, const int *strides)
+{
+    const int scale = c.yr + c.yg + c.yb;
+    for (int y = 0; y < size.height(); ++y) {
+        const uint8_t *row = data + qsizetype(y) * stride;
+        uint8_t *luma = planes[0] + qsizetype(y) * strides[0];
+        for (int x = 0; x < size.width(); ++x) {
+            luma[x] = clamp8((scale * row[x] + c.yOffset) >> Shift);
+        }
+    }
+    const QSize chromaSize((size.width() + 1) / 2, (size.height() + 1) / 2);
+    for (int plane = 1; plane < 3; ++plane) {
+        for (int y = 0; y < chromaSize.height(); ++y) {
+            std::memset(planes[plane] + qsizetype(y) * strides[plane], 128, chromaSize.width());
+        }
+    }
+}
+}
+
+bool YuvConversion::supports(spa_video_format format)
+{
+    return format == SPA_VIDEO_FORMAT_GRAY8 || layout(format);
+}
+
+void YuvConversion::convert(const uint8_t *data,
+                            qint32 stride,
+                            spa_video_format format,
+                            const QSize &size,
+                            bool fullRange,
+                            uint8_t *const *planes,
+                            const int *strides)
+{
+    const Coefficients &c = fullRange ? FullRange : LimitedRange;
+    if (format == SPA_VIDEO_FORMAT_GRAY8) {
+        convertGray(data, stride, size, c, planes, strides);
+        return;
+    }
+
+    const auto pixelLayout = layout(format);
+    Q_ASSERT(pixelLayout);
+    if (!pixelLayout) {
+        return;
+    }
+    const auto convertRows = ::implementation().kernels[*pixelLayout];
+    for (int y = 0; y < size.height(); y += 2) {
+        const int next = std::min(y + 1, size.height() - 1);
+        convertRows(data + qsizetype(y) * stride,
+                    data + qsizetype(next) * stride,
+                    size.width(),
+                    c,
+                    planes[0] + qsizetype(y) * strides[0],
+                    planes[0] + qsizetype(next) * strides[0],
+                    planes[1] + qsizetype(y / 2) * strides[1],
+                    planes[2] + qsizetype(y / 2) * strides[2]);
+    }
+}
+
+const char *YuvConversion::implementation()
+{
+    return ::implementation().name;
+}
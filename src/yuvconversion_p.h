@@ -0,0 +1,55 @@
+/*
+    SPDX-FileCopyrightText: 2026 agent <agent@local>
+
+    SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+*/
+
+#pragma once
+
+#include <QSize>
+
+#include <cstdint>
+
+#include <spa/param/video/raw.h>
+
+/**
+ * Converts packed RGB frames to YUV420P, in place of the format conversion
+ * swscale does in the filter graphs of software encoders.
+ *
+ * Frames are converted with the BT.601 coefficients swscale uses, each chroma
+ * sample being the average of the 2x2 pixels it covers, like the conversion
+ * on the GPU in DmaBufHandler. Rows are converted two at a time with the widest
+ * SIMD instructions the CPU has, the last row and column of odd sizes are
+ * repeated.
+ */
+namespace YuvConversion
+{
+/**
+ * Whether frames in @p format can be converted: the formats with 8 bit red,
+ * green and blue in 3 or 4 bytes per pixel, and GRAY8.
+ */
+bool supports(spa_video_format format);
+
+/**
+ * Convert a frame to YUV420P.
+ *
+ * @param data The first row of the frame.
+ * @param stride The distance between the start of two rows of @p data in bytes.
+ * @param fullRange Whether to convert to full instead of limited range.
+ * @param planes The Y, U and V planes to write to, like AVFrame::data. The U
+ * and V planes are half the size of the frame, rounded up.
+ * @param strides The strides of @p planes, like AVFrame::linesize.
+ */
+void convert(const uint8_t *data,
+             qint32 stride,
+             spa_video_format format,
+             const QSize &size,
+             bool fullRange,
+             uint8_t *const *planes,
+             const int *strides);
+
+/**
+ * The name of the instruction set used for converting, for logs and benchmarks.
+ */
+const char *implementation();
+}